@@ -0,0 +1,58 @@
+#!/bin/bash
+# Computes the janus_evaluate_verify matrices in independent blocks so the work
+# can be spread across processes or machines sharing a file system, then merges
+# the partial results. Blocks already on disk are skipped, so an interrupted run
+# resumes by running the script again. When the query and target are the same,
+# janus_evaluate_verify runs in symmetric mode and only blocks touching the
+# upper triangle are computed, janus_merge_matrix mirrors the rest.
+SDK_PATH="/usr/local"
+TEMP_PATH="/tmp"
+ALGORITHM=""
+TARGET_GALLERY="/path/to/galleries/target.gal"
+QUERY_GALLERY="/path/to/galleries/query.gal"
+TARGET_METADATA="/path/to/protocol/target.csv"
+QUERY_METADATA="/path/to/protocol/query.csv"
+MATRIX="/path/to/matrices/verify"
+BLOCKS="/path/to/matrices/blocks"
+BLOCK_SIZE=1000
+JOBS=$(nproc)
+
+# Templates are the runs of consecutive rows sharing a TEMPLATE_ID
+count_templates() {
+    awk -F, 'NR == 1 { for (i = 1; i <= NF; i++) if ($i == "TEMPLATE_ID") c = i; next }
+             $c != last { n++; last = $c }
+             END { print n + 0 }' "$1"
+}
+
+# compute the block of rows [$1, $2) and columns [$3, $4)
+run_block() {
+    BLOCK=$BLOCKS/block_$1_$3
+    janus_evaluate_verify $SDK_PATH $TEMP_PATH $TARGET_GALLERY $QUERY_GALLERY $TARGET_METADATA $QUERY_METADATA \
+        $BLOCK.mtx $BLOCK.mask ${ALGORITHM:+-algorithm "$ALGORITHM"} -rows $1 $2 -columns $3 $4
+}
+export -f run_block
+export SDK_PATH TEMP_PATH ALGORITHM TARGET_GALLERY QUERY_GALLERY TARGET_METADATA QUERY_METADATA BLOCKS
+
+ROWS=$(count_templates $QUERY_METADATA)
+COLUMNS=$(count_templates $TARGET_METADATA)
+SYMMETRIC=0
+if [ "$QUERY_GALLERY" = "$TARGET_GALLERY" ] && [ "$QUERY_METADATA" = "$TARGET_METADATA" ]; then
+    SYMMETRIC=1
+fi
+mkdir -p $BLOCKS
+
+# compute the blocks that have not completed yet
+for ((r = 0; r < ROWS; r += BLOCK_SIZE)); do
+    for ((c = 0; c < COLUMNS; c += BLOCK_SIZE)); do
+        if [ $SYMMETRIC -eq 1 ] && [ $((c + BLOCK_SIZE)) -le $r ]; then
+            continue
+        fi
+        if [ ! -f $BLOCKS/block_${r}_${c}.mtx ] || [ ! -f $BLOCKS/block_${r}_${c}.mask ]; then
+            echo $r $((r + BLOCK_SIZE)) $c $((c + BLOCK_SIZE))
+        fi
+    done
+done | xargs -P $JOBS -L 1 bash -c 'run_block "$@"' _ || exit 1
+
+# merge the partial results
+janus_merge_matrix $MATRIX.mtx $BLOCKS/block_*.mtx || exit 1
+janus_merge_matrix $MATRIX.mask $BLOCKS/block_*.mask || exit 1
@@ -36,13 +36,14 @@ extern "C" {
  * \mainpage
  * \section overview Overview
  *
- * *libjanus* is a *C* API for the IARPA Janus program consisting of three
- * header files:
+ * *libjanus* is a *C* API for the IARPA Janus program consisting of the
+ * following header files:
  *
  * Header            | Documentation  | Required               | Description
  * ----------------- | -------------  | ---------------------- | -----------
  * iarpa_janus.h     | \ref janus     | **Yes**                | \copybrief janus
  * iarpa_janus_io.h  | \ref janus_io  | No (Provided)          | \copybrief janus_io
+ * iarpa_janus.hpp   | \ref janus_cpp | No (Provided)          | \copybrief janus_cpp
  * iarpa_janus_aux.h | \ref janus_aux | No (Phases 2 & 3 only) | \copybrief janus_aux
  *
  * - [<b>Source Code</b>](https://github.com/biometrics/janus) [github.com]
@@ -148,6 +149,15 @@ extern "C" {
  * - \anchor thread_unsafe \par thread-unsafe
  *   Can not be called simultaneously from multiple threads.
  *
+ * Between \ref janus_initialize and \ref janus_finalize, which are
+ * \ref thread_unsafe, implementations must honor these markings for calls
+ * from any number of application threads. In particular, concurrent calls to
+ * \ref janus_augment on distinct templates and to \ref janus_verify or
+ * \ref janus_search on shared finalized templates and galleries must not
+ * require synchronization by the calling application. Implementations built
+ * on thread-unsafe libraries are expected to give each thread its own
+ * library state rather than serialize calls.
+ *
  * \section implementer_notes Implementer Notes
  * - Define \c JANUS_LIBRARY during compilation to export Janus symbols and
  *   compile a Unix implementation with \c \-fvisibility=hidden.
@@ -564,6 +574,58 @@ JANUS_EXPORT janus_error janus_write_template(const char* template_file,
  */
 typedef janus_data *janus_flat_template;
 
+/*!
+ * \brief Value of janus_template_summary::magic, the characters "JTS1" in
+ *        little-endian order.
+ */
+#define JANUS_TEMPLATE_SUMMARY_MAGIC 0x3153544a
+
+/*!
+ * \brief Current value of janus_template_summary::version.
+ */
+#define JANUS_TEMPLATE_SUMMARY_VERSION 1
+
+/*!
+ * \brief Flags describing a \ref janus_template_summary.
+ */
+typedef enum janus_template_flags
+{
+    JANUS_TEMPLATE_TRUNCATED = 0x1 /*!< Recognition information was dropped to
+                                        fit within
+                                        \ref janus_max_template_size */
+} janus_template_flags;
+
+/*!
+ * \brief Optional prefix of a \ref janus_flat_template describing its
+ *        contents.
+ *
+ * Flat templates are otherwise opaque to the calling application.
+ * Implementations may begin the buffer written by
+ * \ref janus_flatten_template with this structure in native byte order so
+ * that the calling application can skip work whose outcome is already known,
+ * such as comparisons against a template in which every image failed to
+ * enroll.
+ * The remainder of the buffer is implementation-defined, and implementations
+ * must accept flat templates carrying the prefix wherever they accept flat
+ * templates.
+ * Later versions may append fields, so readers should skip #size bytes rather
+ * than \c sizeof(janus_template_summary).
+ */
+typedef struct janus_template_summary
+{
+    uint32_t magic;     /*!< \brief #JANUS_TEMPLATE_SUMMARY_MAGIC. */
+    uint16_t version;   /*!< \brief #JANUS_TEMPLATE_SUMMARY_VERSION. */
+    uint16_t size;      /*!< \brief Size of the prefix in bytes. */
+    uint32_t num_faces; /*!< \brief Faces with recognition information. */
+    uint32_t num_media; /*!< \brief Images and frames passed to
+                                    \ref janus_augment. */
+    uint32_t backend;   /*!< \brief Implementation-defined identifier of the
+                                    template format. */
+    uint32_t flags;     /*!< \brief Bitwise-or of #janus_template_flags. */
+    float empty_score;  /*!< \brief Similarity \ref janus_verify returns
+                                    when either template has no faces. */
+} janus_template_summary;
+
 /*!
  * \brief Commit a janus_flat_template to disk 
  *
@@ -593,8 +655,9 @@ JANUS_EXPORT size_t janus_max_template_size();
  *                      finalized template from.
  * \param[in,out] flat_template A pre-allocated buffer provided by the calling
  *                              application no smaller than
- *                              \ref janus_max_template_size to contain the
- *                              finalized template.
+ *                              \ref janus_flattened_size, or
+ *                              \ref janus_max_template_size if unavailable,
+ *                              to contain the finalized template.
  * \param[out] bytes Size of the buffer actually used to store the template.
  * \remark This function is \ref reentrant.
  */
@@ -602,6 +665,69 @@ JANUS_EXPORT janus_error janus_flatten_template(const janus_template template_,
                                                 janus_flat_template flat_template,
                                                 size_t *bytes);
 
+/*!
+ * \brief The exact size of the finalized template \ref janus_flatten_template
+ *        would construct from \p template_.
+ *
+ * Allows the calling application to allocate a buffer of the required size
+ * instead of \ref janus_max_template_size.
+ * Implementations should answer from sizes recorded as recognition
+ * information is added to \p template_, as the harness calls this before
+ * every \ref janus_flatten_template. Serializing the template to measure it
+ * doubles the cost of flattening.
+ * \param[in] template_ The recognition information to query.
+ * \param[out] bytes Size of the finalized template.
+ * \note Optional, implementations may return \ref JANUS_NOT_IMPLEMENTED.
+ * \remark This function is \ref reentrant.
+ * \see janus_flatten_template
+ */
+JANUS_EXPORT janus_error janus_flattened_size(const janus_template template_,
+                                              size_t *bytes);
+
+/*!
+ * \brief Add the recognition information in a finalized template to a
+ *        template.
+ *
+ * After this call \p template_ behaves as if it had also been provided the
+ * images used to construct \p flat_template with \ref janus_augment.
+ * This allows the calling application to cache the result of augmenting a
+ * single image and reuse it across templates.
+ *
+ * \param[in] flat_template A finalized template previously constructed by
+ *                          \ref janus_flatten_template.
+ * \param[in] bytes Size of \p flat_template.
+ * \param[in,out] template_ The template to add the recognition information to.
+ * \note Optional, implementations may return \ref JANUS_NOT_IMPLEMENTED.
+ * \remark This function is \ref reentrant.
+ * \see janus_flatten_template
+ */
+JANUS_EXPORT janus_error janus_merge_flat_template(const janus_flat_template flat_template,
+                                                   const size_t bytes,
+                                                   janus_template template_);
+
+
+/*!
+ * \brief Reduce a template to a bounded number of representative faces.
+ *
+ * Templates constructed from long videos or large image collections contain
+ * many redundant faces, which increases the size of flattened templates and
+ * the cost of every \ref janus_verify and \ref janus_search involving them.
+ * This function discards all but a representative subset of the recognition
+ * information in \p template_, chosen by an implementation-defined
+ * clustering or quality criterion.
+ *
+ * \param[in,out] template_ The template to compact.
+ * \param[in] max_faces Upper bound on the number of faces retained, 0 for no
+ *                      limit.
+ * \param[in] max_bytes Upper bound on the size of the template after
+ *                      \ref janus_flatten_template, 0 for no limit.
+ * \note Optional, implementations may return \ref JANUS_NOT_IMPLEMENTED.
+ * \remark This function is \ref reentrant.
+ * \see janus_flatten_template
+ */
+JANUS_EXPORT janus_error janus_compact_template(janus_template template_,
+                                                const size_t max_faces,
+                                                const size_t max_bytes);
 
 /*!
  * \brief Return a similarity score for two templates.
@@ -719,16 +845,19 @@ JANUS_EXPORT janus_error janus_enroll(const janus_template template_,
                                       janus_gallery gallery);
 
 /*!
- * \brief Commit a janus_flat_gallery to disk 
+ * \brief Commit a gallery to disk as a janus_flat_gallery.
  *
- * Call this function to commit a janus_flat_gallery to disk.
- * \param[in] flat_gallery_file The name of the flat gallery file on disk. 
- * \param[in] flat_gallery The flat gallery to write to disk.
+ * The file contents are identical to the buffer constructed by
+ * \ref janus_flatten_gallery, but are written directly from the
+ * implementation's own representation, so the calling application need not
+ * allocate a buffer large enough to hold the entire finalized gallery.
+ * \param[in] flat_gallery_file The name of the flat gallery file on disk.
+ * \param[in] gallery The gallery to write to disk.
  * \remark This function is \ref reentrant.
- * \see janus_allocate_template
+ * \see janus_flatten_gallery janus_read_flat_gallery
  */
 JANUS_EXPORT janus_error janus_write_flat_gallery(const char* flat_gallery_file,
-                                                  const janus_flat_gallery flat_gallery);
+                                                  const janus_gallery gallery);
 /*!
  * \brief Free memory for a gallery previously allocated by
  * \ref janus_allocate_gallery.
@@ -754,6 +883,7 @@ JANUS_EXPORT janus_error janus_write_flat_gallery(const char* flat_gallery_file,
  *                             \ref janus_enroll with \a gallery.
  * \param[out] bytes Size of the buffer actually used to store the gallery.
  * \remark This function is \ref reentrant.
+ * \see janus_write_flat_gallery
  */
 JANUS_EXPORT janus_error janus_flatten_gallery(const janus_gallery gallery,
                                                janus_flat_gallery flat_gallery,
@@ -0,0 +1,422 @@
+/*******************************************************************************
+ * Copyright (c) 2013 Noblis, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and/or associated documentation files (the
+ * "Materials"), to deal in the Materials without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Materials, and to
+ * permit persons to whom the Materials are furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Materials.
+ *
+ * THE MATERIALS ARE PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * MATERIALS OR THE USE OR OTHER DEALINGS IN THE MATERIALS.
+ ******************************************************************************/
+
+#ifndef IARPA_JANUS_HPP
+#define IARPA_JANUS_HPP
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <iarpa_janus.h>
+#include <iarpa_janus_io.h>
+
+/*!
+ * \defgroup janus_cpp Janus C++
+ * \brief Header-only C++11 ownership wrappers.
+ *
+ * Owning types release their resource with the matching deallocator when
+ * destroyed and are move-only, so a handle can not be freed twice or leaked
+ * on an early return. Views reference memory owned elsewhere and are cheap to
+ * copy. Errors are reported as #janus_error return values, as in the C API.
+ *
+ * Handles are passed to C functions expecting an output parameter with
+ * \c put(), which releases any resource already held:
+ * \code
+ * janus::Template template_;
+ * JANUS_CHECK(janus_allocate_template(template_.put()))
+ * JANUS_CHECK(janus_augment(image.get(), attributes.view(), template_.get()))
+ * \endcode
+ * \addtogroup janus_cpp
+ *  @{
+ */
+
+namespace janus
+{
+
+/*!
+ * \brief Move-only owner of an opaque handle released by \a Free.
+ */
+template <typename Handle, typename Result, Result (*Free)(Handle)>
+class UniqueHandle
+{
+    Handle handle;
+
+public:
+    UniqueHandle() : handle(NULL) {}
+    explicit UniqueHandle(Handle handle) : handle(handle) {}
+    UniqueHandle(const UniqueHandle &) = delete;
+    UniqueHandle(UniqueHandle &&other) : handle(other.release()) {}
+    ~UniqueHandle() { reset(); }
+
+    UniqueHandle &operator=(const UniqueHandle &) = delete;
+    UniqueHandle &operator=(UniqueHandle &&other)
+    {
+        if (this != &other)
+            reset(other.release());
+        return *this;
+    }
+
+    Handle get() const { return handle; }
+    Handle *put() { reset(); return &handle; } /*!< \brief Output parameter for a C function that creates the handle. */
+    explicit operator bool() const { return handle != NULL; }
+
+    Handle release()
+    {
+        Handle released = handle;
+        handle = NULL;
+        return released;
+    }
+
+    void reset(Handle replacement = NULL)
+    {
+        if (handle)
+            Free(handle);
+        handle = replacement;
+    }
+};
+
+typedef UniqueHandle<janus_template, janus_error, janus_free_template> Template; /*!< \brief Owner of a \ref janus_template. */
+typedef UniqueHandle<janus_gallery, janus_error, janus_free_gallery> Gallery;    /*!< \brief Owner of a \ref janus_gallery. */
+typedef UniqueHandle<janus_video, void, janus_close_video> Video;                /*!< \brief Owner of a \ref janus_video. */
+
+/*!
+ * \brief Move-only owner of a \ref janus_image released by
+ *        \ref janus_free_image.
+ */
+class Image
+{
+    janus_image image;
+
+public:
+    Image() { clear(); }
+    explicit Image(const janus_image &image) : image(image) {}
+    Image(const Image &) = delete;
+    Image(Image &&other) : image(other.release()) {}
+    ~Image() { reset(); }
+
+    Image &operator=(const Image &) = delete;
+    Image &operator=(Image &&other)
+    {
+        if (this != &other) {
+            reset();
+            image = other.release();
+        }
+        return *this;
+    }
+
+    const janus_image &get() const { return image; }
+    janus_image *put() { reset(); return &image; } /*!< \brief Output parameter for \ref janus_read_image or \ref janus_read_frame. */
+    explicit operator bool() const { return image.data != NULL; }
+
+    janus_image release()
+    {
+        const janus_image released = image;
+        clear();
+        return released;
+    }
+
+    void reset()
+    {
+        if (image.data)
+            janus_free_image(image);
+        clear();
+    }
+
+private:
+    void clear()
+    {
+        image.data = NULL;
+        image.width = image.height = 0;
+        image.color_space = JANUS_GRAY8;
+    }
+};
+
+/*!
+ * \brief Move-only owner of a byte buffer allocated with \c new[], such as a
+ *        flat template, flat gallery or templates file read into memory.
+ */
+class Buffer
+{
+    std::unique_ptr<janus_data[]> buffer;
+    size_t length;
+
+public:
+    Buffer() : length(0) {}
+    explicit Buffer(size_t size) : buffer(new janus_data[size]), length(size) {}
+    Buffer(janus_data *data, size_t size) : buffer(data), length(size) {} /*!< \brief Take ownership of \p data. */
+    Buffer(Buffer &&other) : buffer(std::move(other.buffer)), length(other.length) { other.length = 0; }
+
+    Buffer &operator=(Buffer &&other)
+    {
+        if (this != &other) {
+            buffer = std::move(other.buffer);
+            length = other.length;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    janus_data *data() const { return buffer.get(); }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+
+    janus_data *release()
+    {
+        length = 0;
+        return buffer.release();
+    }
+
+    /*!
+     * \brief Replace the contents with those of a file.
+     */
+    janus_error read(const char *file_name)
+    {
+        std::ifstream file(file_name, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            return JANUS_OPEN_ERROR;
+        const std::streamoff size = file.tellg();
+        if (size < 0)
+            return JANUS_READ_ERROR;
+        file.seekg(0, std::ios::beg);
+        Buffer contents((size_t)size);
+        if (!file.read((char*)contents.data(), size))
+            return JANUS_READ_ERROR;
+        *this = std::move(contents);
+        return JANUS_SUCCESS;
+    }
+};
+
+/*!
+ * \brief Non-owning view of a \ref janus_flat_template.
+ *
+ * The C API takes flat templates as mutable pointers but does not modify
+ * them.
+ */
+struct FlatTemplateView
+{
+    janus_flat_template data; /*!< \brief First byte of the template. */
+    size_t bytes;             /*!< \brief Size of the template. */
+
+    FlatTemplateView() : data(NULL), bytes(0) {}
+    FlatTemplateView(const janus_data *data, size_t bytes) : data(const_cast<janus_data*>(data)), bytes(bytes) {}
+
+    /*!
+     * \brief Read the \ref janus_template_summary prefix, false if the
+     *        implementation did not write one.
+     */
+    bool summary(janus_template_summary *summary) const
+    {
+        if (bytes < sizeof(janus_template_summary))
+            return false;
+        memcpy(summary, data, sizeof(janus_template_summary));
+        return (summary->magic == JANUS_TEMPLATE_SUMMARY_MAGIC) &&
+               (summary->size >= sizeof(janus_template_summary)) && (summary->size <= bytes);
+    }
+};
+
+/*!
+ * \brief Non-owning view of a \ref janus_flat_gallery.
+ */
+struct FlatGalleryView
+{
+    janus_flat_gallery data; /*!< \brief First byte of the gallery. */
+    size_t bytes;            /*!< \brief Size of the gallery. */
+
+    FlatGalleryView() : data(NULL), bytes(0) {}
+    FlatGalleryView(const janus_data *data, size_t bytes) : data(const_cast<janus_data*>(data)), bytes(bytes) {}
+    explicit FlatGalleryView(const Buffer &buffer) : data(buffer.data()), bytes(buffer.size()) {}
+};
+
+/*!
+ * \brief Move-only owner of a flat template.
+ */
+class FlatTemplate
+{
+    Buffer buffer;
+    size_t bytes;
+
+public:
+    FlatTemplate() : bytes(0) {}
+    FlatTemplate(FlatTemplate &&other) : buffer(std::move(other.buffer)), bytes(other.bytes) { other.bytes = 0; }
+
+    FlatTemplate &operator=(FlatTemplate &&other)
+    {
+        if (this != &other) {
+            buffer = std::move(other.buffer);
+            bytes = other.bytes;
+            other.bytes = 0;
+        }
+        return *this;
+    }
+
+    /*!
+     * \brief Replace the contents with \ref janus_flatten_template of
+     *        \p template_, allocating \ref janus_flattened_size bytes if
+     *        implemented and \ref janus_max_template_size otherwise.
+     */
+    janus_error flatten(janus_template template_)
+    {
+        size_t size;
+        const janus_error size_error = janus_flattened_size(template_, &size);
+        if (size_error == JANUS_NOT_IMPLEMENTED)
+            size = janus_max_template_size();
+        else if (size_error != JANUS_SUCCESS)
+            return size_error;
+
+        Buffer flattened(size);
+        size_t flattened_bytes;
+        const janus_error flatten_error = janus_flatten_template(template_, flattened.data(), &flattened_bytes);
+        if (flatten_error != JANUS_SUCCESS)
+            return flatten_error;
+        buffer = std::move(flattened);
+        bytes = flattened_bytes;
+        return JANUS_SUCCESS;
+    }
+
+    FlatTemplateView view() const { return FlatTemplateView(buffer.data(), bytes); }
+    janus_flat_template data() const { return buffer.data(); }
+    size_t size() const { return bytes; }
+};
+
+/*!
+ * \brief A template within a file written by \ref janus_create_templates.
+ */
+struct TemplateRecord
+{
+    janus_template_id template_id; /*!< \brief Identifier from the metadata. */
+    FlatTemplateView flat_template; /*!< \brief Template within the file. */
+};
+
+/*!
+ * \brief Allocation-free iteration over the records of a file written by
+ *        \ref janus_create_templates.
+ *
+ * Records are parsed in place as the iterator advances, a truncated trailing
+ * record ends the iteration.
+ * \code
+ * janus::Buffer templates;
+ * JANUS_CHECK(templates.read("templates.gal"))
+ * for (const janus::TemplateRecord &record : janus::TemplateRecords(templates))
+ *     ...
+ * \endcode
+ */
+class TemplateRecords
+{
+    const janus_data *begin_, *end_;
+
+public:
+    class iterator
+    {
+        const janus_data *position, *end;
+        TemplateRecord record;
+
+        void parse()
+        {
+            const size_t header = sizeof(janus_template_id) + sizeof(size_t);
+            size_t bytes = 0;
+            if (size_t(end - position) >= header)
+                memcpy(&bytes, position + sizeof(janus_template_id), sizeof(bytes));
+            if ((size_t(end - position) < header) || (bytes > size_t(end - position) - header)) {
+                position = end;
+                return;
+            }
+            memcpy(&record.template_id, position, sizeof(record.template_id));
+            record.flat_template = FlatTemplateView(position + header, bytes);
+        }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef TemplateRecord value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const TemplateRecord *pointer;
+        typedef const TemplateRecord &reference;
+
+        iterator(const janus_data *position, const janus_data *end) : position(position), end(end) { parse(); }
+
+        reference operator*() const { return record; }
+        pointer operator->() const { return &record; }
+        bool operator==(const iterator &other) const { return position == other.position; }
+        bool operator!=(const iterator &other) const { return position != other.position; }
+
+        iterator &operator++()
+        {
+            position = record.flat_template.data + record.flat_template.bytes;
+            parse();
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+    };
+
+    TemplateRecords(const janus_data *data, size_t bytes) : begin_(data), end_(data + bytes) {}
+    explicit TemplateRecords(const Buffer &buffer) : begin_(buffer.data()), end_(buffer.data() + buffer.size()) {}
+
+    iterator begin() const { return iterator(begin_, end_); }
+    iterator end() const { return iterator(end_, end_); }
+};
+
+/*!
+ * \brief A \ref janus_attribute_list that owns its arrays.
+ */
+class AttributeList
+{
+    std::vector<janus_attribute> attributes;
+    std::vector<double> values;
+
+public:
+    void push_back(janus_attribute attribute, double value)
+    {
+        attributes.push_back(attribute);
+        values.push_back(value);
+    }
+
+    size_t size() const { return attributes.size(); }
+
+    /*!
+     * \brief The list in the form expected by the C API, valid until the
+     *        next call to #push_back.
+     */
+    janus_attribute_list view() const
+    {
+        janus_attribute_list list;
+        list.size = attributes.size();
+        list.attributes = attributes.empty() ? NULL : const_cast<janus_attribute*>(&attributes[0]);
+        list.values = values.empty() ? NULL : const_cast<double*>(&values[0]);
+        return list;
+    }
+};
+
+} // namespace janus
+
+/*! @}*/
+
+#endif /* IARPA_JANUS_HPP */
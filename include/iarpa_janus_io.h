@@ -134,6 +134,18 @@ JANUS_EXPORT janus_error janus_open_video(const char *file_name, janus_video *vi
  */
 JANUS_EXPORT janus_error janus_read_frame(janus_video video, janus_image *image);
 
+/*!
+ * \brief Positions the video such that the next call to \ref janus_read_frame
+ *        returns the requested frame.
+ *
+ * Implementations should prefer seeking to the nearest preceding keyframe and
+ * decoding forward over decoding every frame from the start of the video.
+ * \param[in] video Video to position.
+ * \param[in] frame Zero-based index of the next frame to read.
+ * \see janus_open_video janus_read_frame
+ */
+JANUS_EXPORT janus_error janus_seek_frame(janus_video video, int frame);
+
 /*!
  * \brief Closes a video previously opened by \ref janus_open_video.
  * \param[in] video The video to close.
@@ -165,6 +177,8 @@ TEMPLATE_ID        , SUBJECT_ID, FILE_NAME, MEDIA_ID, FRAME, <janus_attribute>,
  * - \a \<janus_attribute\> adheres to \ref janus_enum.
  * - All rows associated with the same \c TEMPLATE_ID occur sequentially.
  * - All rows associated with the same \c TEMPLATE_ID and \c FILE_NAME occur sequentially ordered by \c FRAME.
+ * - Rows referencing a video file (\c .avi, \c .mp4, etc.) with a \c FRAME value are decoded in-process:
+ *   the video is opened once per template with \ref janus_open_video and only the requested frames are read.
  * - A cell is empty when no value is available for the specified #janus_attribute.
  *
  * \par Examples:
@@ -174,6 +188,140 @@ TEMPLATE_ID        , SUBJECT_ID, FILE_NAME, MEDIA_ID, FRAME, <janus_attribute>,
  */
 typedef const char *janus_metadata;
 
+/*!
+ * \brief A row of a #janus_metadata file.
+ *
+ * Pointers are only valid for the duration of the
+ * \ref janus_metadata_callback receiving the row.
+ * \see janus_parse_metadata
+ */
+typedef struct janus_metadata_row
+{
+    janus_template_id template_id;   /*!< \brief \c TEMPLATE_ID. */
+    int subject_id;                  /*!< \brief \c SUBJECT_ID. */
+    const char *file_name;           /*!< \brief \c FILE_NAME. */
+    janus_attribute_list attributes; /*!< \brief Remaining cells, omitting empty ones. */
+    const char *header;              /*!< \brief Unparsed header line of the file. */
+    const char *line;                /*!< \brief Unparsed row. */
+} janus_metadata_row;
+
+/*!
+ * \brief Called by \ref janus_parse_metadata for each row.
+ *
+ * Returning anything other than \ref JANUS_SUCCESS stops parsing.
+ */
+typedef janus_error (*janus_metadata_callback)(const janus_metadata_row *row, void *user_data);
+
+/*!
+ * \brief Parse a #janus_metadata file in a single streaming pass.
+ *
+ * Rows are parsed exactly as by the high-level enrollment functions, but
+ * never held in memory, so files of any length may be processed.
+ * \param[in] metadata File to parse.
+ * \param[in] callback Function called with each row in file order.
+ * \param[in] user_data Passed to \p callback.
+ * \return \ref JANUS_OPEN_ERROR if \p metadata can not be read, otherwise
+ *         the first error returned by \p callback.
+ */
+JANUS_EXPORT janus_error janus_parse_metadata(janus_metadata metadata, janus_metadata_callback callback, void *user_data);
+
+/*!
+ * \brief Enable a persistent on-disk cache of per-image augmentation results.
+ *
+ * When enabled, the high-level enrollment functions key every row of a
+ * #janus_metadata file by a hash of the media file contents, its
+ * #janus_attribute_list and \p algorithm.
+ * Rows already present in the cache skip image decoding and
+ * \ref janus_augment entirely, instead their recognition information is added
+ * to the template with \ref janus_merge_flat_template.
+ * The cache persists across runs, so media shared by multiple templates,
+ * protocols or splits is only augmented once.
+ * Least recently used entries are evicted when the cache exceeds
+ * \p max_bytes.
+ *
+ * Concurrent processes may share the cache. Entries are recorded in the
+ * journal \c janus_cache.idx under \p cache_path, read under a shared and
+ * written under an exclusive \c flock on \c janus_cache.idx.lock, which
+ * requires a file system that supports it. Cache hits are journaled in
+ * batches, and the journal is rewritten without superseded lines once they
+ * outnumber the entries.
+ *
+ * \param[in] cache_path Existing directory to store the cache in, usually the
+ *                       \a temp_path provided to \ref janus_initialize.
+ *                       \c NULL disables the cache.
+ * \param[in] algorithm The \a algorithm provided to \ref janus_initialize.
+ * \param[in] max_bytes Upper bound on the total size of cached entries.
+ * \note The cache is disabled by default and is silently disabled if the
+ *       implementation does not support \ref janus_merge_flat_template.
+ * \see janus_metrics
+ */
+JANUS_EXPORT janus_error janus_set_feature_cache(const char *cache_path, const char *algorithm, size_t max_bytes);
+
+/*!
+ * \brief Enable a persistent on-disk cache of \ref janus_verify scores.
+ *
+ * When enabled, \ref janus_evaluate_verify, \ref janus_evaluate_verify_block
+ * and \ref janus_evaluate_verify_pairs key every comparison by 64-bit hashes
+ * of the contents of both flat templates and \p algorithm, and only call
+ * \ref janus_verify for comparisons not already in the cache. Runs with
+ * changed metadata, and identical templates within a run, reuse earlier
+ * scores.
+ *
+ * The cache is a hash table stored in \c janus_scores.jsc under
+ * \p cache_path and mapped into memory. Concurrent processes, such as the
+ * blocks of a distributed \ref janus_evaluate_verify_block run, may share it.
+ * Lookups take no lock, while new scores are buffered and written in batches
+ * under an \c flock on \c janus_scores.jsc.lock, which requires a file system
+ * that supports it. Buffered scores are written by the end of each evaluation.
+ * \param[in] cache_path Existing directory to store the cache in, usually the
+ *                       \a temp_path provided to \ref janus_initialize.
+ *                       \c NULL disables the cache, the default.
+ * \param[in] algorithm The \a algorithm provided to \ref janus_initialize.
+ * \see janus_metrics
+ */
+JANUS_EXPORT janus_error janus_set_score_cache(const char *cache_path, const char *algorithm);
+
+/*!
+ * \brief Enable suppression of redundant video frames during enrollment.
+ *
+ * Applies to rows decoded in-process from a video file.
+ * Frames are visited in increasing order and grouped into runs of consecutive
+ * near-duplicates, from which only the sharpest frame is passed to
+ * \ref janus_augment.
+ * Near-duplicates are detected by comparing 16x16 grayscale thumbnails and
+ * sharpness is estimated by the mean gradient magnitude, both computed from a
+ * sparse grid of pixels.
+ *
+ * \param[in] similarity_threshold Mean absolute thumbnail difference (0-255)
+ *                                 below which consecutive frames are
+ *                                 near-duplicates, 0 disables duplicate
+ *                                 suppression.
+ * \param[in] max_frames Upper bound on the frames augmented per video in a
+ *                       template, spread evenly across the requested frames,
+ *                       0 for no limit.
+ * \note Disabled by default.
+ * \see janus_metrics
+ */
+JANUS_EXPORT janus_error janus_set_frame_selection(double similarity_threshold, int max_frames);
+
+/*!
+ * \brief Enable template compaction during enrollment.
+ *
+ * Each template is passed to \ref janus_compact_template after all of its
+ * media have been augmented, bounding the size of flattened templates and the
+ * cost of comparisons against them.
+ * Flattened template sizes before and after compaction are recorded in
+ * \ref janus_metrics.
+ *
+ * \param[in] max_faces Upper bound on faces retained per template, 0 for no
+ *                      limit.
+ * \param[in] max_bytes Upper bound on the flattened template size, 0 for no
+ *                      limit.
+ * \note Disabled by default, and silently disabled if the implementation
+ *       does not provide \ref janus_compact_template.
+ */
+JANUS_EXPORT janus_error janus_set_template_compaction(size_t max_faces, size_t max_bytes);
+
 /*!
  * \brief High-level function for enrolling a template from a metadata file.
  * \param [in] data_path Prefix path to files in metadata.
@@ -192,8 +340,30 @@ JANUS_EXPORT janus_error janus_create_template(const char *data_path, janus_meta
  */
 JANUS_EXPORT janus_error janus_create_templates(const char *data_path, janus_metadata metadata, const char *gallery_file, int verbose);
 
+/*!
+ * \brief Continue an interrupted \ref janus_create_templates.
+ *
+ * \ref janus_create_templates periodically records its progress in
+ * \c \<gallery_file\>.checkpoint. Resuming keeps every complete record in
+ * \p gallery_file, truncates a partially written one, and continues
+ * enrollment from the next template in \p metadata. Templates that fail to
+ * enroll with a hard error, including images or videos that can not be
+ * opened, are reported on \c stderr, counted in
+ * \ref janus_metrics::janus_skipped_template_count and omitted from
+ * \p gallery_file in both functions. Video frames that can not be decoded
+ * are dropped with a warning.
+ * \param [in] data_path Prefix path to files in metadata.
+ * \param [in] metadata #janus_metadata to enroll, unchanged since the interrupted run.
+ * \param [in] gallery_file File to append the remaining templates to.
+ * \param [in] verbose Print information and warnings during gallery enrollment.
+ */
+JANUS_EXPORT janus_error janus_resume_create_templates(const char *data_path, janus_metadata metadata, const char *gallery_file, int verbose);
+
 /*!
  * \brief High-level function for enrolling a gallery from a metadata file.
+ *
+ * Templates that fail to enroll with a hard error are skipped as in
+ * \ref janus_create_templates.
  * \param [in] data_path Prefix path to files in metadata.
  * \param [in] metadata #janus_metadata to enroll.
  * \param [in] gallery File to save the templates to.
@@ -201,6 +371,84 @@ JANUS_EXPORT janus_error janus_create_templates(const char *data_path, janus_met
  */
 JANUS_EXPORT janus_error janus_create_gallery(const char *data_path, janus_metadata metadata, janus_gallery gallery, int verbose);
 
+/*!
+ * \brief Enroll a gallery from a metadata file for two-stage search with
+ *        \ref janus_evaluate_cascade_search.
+ *
+ * Writes three files:
+ * - \p gallery_file The flat gallery \ref janus_create_gallery would
+ *   produce, searched exhaustively.
+ * - \c \<gallery_file\>.summary A flat gallery of the same templates, each
+ *   reduced by \ref janus_compact_template with \p summary_faces as
+ *   \a max_faces, for screening.
+ * - \c \<gallery_file\>.templates The flat templates in the format of
+ *   \ref janus_create_templates, for exact rescoring of screened candidates.
+ *
+ * What \a max_faces counts is up to the implementation. PittPatt keeps that
+ * many face lists, one for each image or video frame added to the template,
+ * each of which may hold several faces. If the implementation does not
+ * support \ref janus_compact_template the summary gallery holds the complete
+ * templates. Templates that fail to enroll are skipped as in
+ * \ref janus_create_templates.
+ * \param [in] data_path Prefix path to files in metadata.
+ * \param [in] metadata #janus_metadata to enroll.
+ * \param [in] gallery_file Flat gallery file to write.
+ * \param [in] summary_faces \a max_faces of \ref janus_compact_template for the summary gallery.
+ * \param [in] verbose Print information and warnings during gallery enrollment.
+ */
+JANUS_EXPORT janus_error janus_create_cascade_gallery(const char *data_path, janus_metadata metadata, const char *gallery_file, size_t summary_faces, int verbose);
+
+/*!
+ * \brief An incrementally updated gallery.
+ *
+ * A text file journaling the segments and removals that make up the gallery,
+ * one entry per line:
+ * - <tt>segment \<name\></tt> A batch of enrolled templates, stored
+ *   alongside the index as a flat gallery \c \<name\>.gal for
+ *   \ref janus_search and a templates file \c \<name\>.templates in the
+ *   format of \ref janus_create_templates for compaction.
+ * - <tt>tombstone \<template_id\> \<name\></tt> Removes the template from
+ *   all preceding segments. \c \<name\> is the segment holding the
+ *   template, when omitted it may be any preceding segment. Only templates
+ *   in the gallery are tombstoned.
+ *
+ * Adding or removing templates costs time proportional to the size of the
+ * change rather than the gallery. Searches see the merged view of all
+ * segments less tombstoned templates.
+ * \see janus_append_gallery janus_remove_from_gallery janus_compact_gallery
+ *      janus_evaluate_incremental_search
+ */
+typedef const char *janus_gallery_index;
+
+/*!
+ * \brief Enroll templates from a metadata file as a new gallery segment.
+ *
+ * Templates already in the gallery with the same \c TEMPLATE_ID are replaced.
+ * The index is created if it does not exist. Templates that fail to enroll
+ * with a hard error are skipped as in \ref janus_create_templates.
+ * \param [in] data_path Prefix path to files in metadata.
+ * \param [in] metadata #janus_metadata to enroll.
+ * \param [in] index Gallery to append to.
+ * \param [in] verbose Print information and warnings during enrollment.
+ */
+JANUS_EXPORT janus_error janus_append_gallery(const char *data_path, janus_metadata metadata, janus_gallery_index index, int verbose);
+
+/*!
+ * \brief Remove the templates listed in a metadata file from a gallery.
+ * \param [in] metadata #janus_metadata whose \c TEMPLATE_ID values to remove.
+ * \param [in] index Gallery to remove from.
+ */
+JANUS_EXPORT janus_error janus_remove_from_gallery(janus_metadata metadata, janus_gallery_index index);
+
+/*!
+ * \brief Rewrite all live templates in a gallery as a single segment.
+ *
+ * Discards tombstoned templates and the superseded segment files.
+ * Requires \ref janus_merge_flat_template.
+ * \param [in] index Gallery to compact.
+ */
+JANUS_EXPORT janus_error janus_compact_gallery(janus_gallery_index index);
+
 /*!
  * \brief A dense binary 2D matrix file.
  *
@@ -219,9 +467,97 @@ typedef const char *janus_matrix;
  * \param[in] target Target gallery file name recorded in the matrix header.
  * \param[in] query Query gallery file name recorded in the matrix header.
  * \param[in] matrix File to write the matrix to.
+ * \see janus_set_matrix_encoding
  */
 JANUS_EXPORT janus_error janus_write_matrix(void *data, int rows, int columns, int is_mask, janus_metadata target, janus_metadata query, janus_matrix matrix);
 
+/*!
+ * \brief Encodings for the data of similarity matricies.
+ * \see janus_set_matrix_encoding
+ */
+typedef enum janus_score_encoding
+{
+    JANUS_SCORES_FLOAT32, /*!< \brief 4-byte floats, matrix type \c MF. */
+    JANUS_SCORES_FLOAT16, /*!< \brief 2-byte IEEE half precision floats, matrix type \c MH.
+                                Scores are rounded to 11 significant bits and saturate at +/-65504. */
+    JANUS_SCORES_QUANTIZED8 /*!< \brief 1-byte codes, matrix type <tt>MQ</tt>, with the
+                                  offset and scale recorded in the header after the
+                                  dimensions. Code \c 0 is \c -FLT_MAX, codes \c 1 to
+                                  \c 255 are <tt>offset + (code - 1) * scale</tt>,
+                                  accurate to within <tt>scale / 2</tt>. */
+} janus_score_encoding;
+
+/*!
+ * \brief Encodings for the data of mask matricies.
+ * \see janus_set_matrix_encoding
+ */
+typedef enum janus_mask_encoding
+{
+    JANUS_MASK_BYTE, /*!< \brief 1 byte per element, matrix type \c MB. */
+    JANUS_MASK_PACKED2 /*!< \brief 2 bits per element, matrix type \c MP, four elements
+                             per byte starting from the least significant bits.
+                             \c 0x00, \c 0x7f and \c 0xff are stored as \c 0, \c 1
+                             and \c 2. */
+} janus_mask_encoding;
+
+/*!
+ * \brief Select the encoding of matricies written by \ref janus_write_matrix
+ *        and the evaluation functions.
+ *
+ * The compact encodings reduce matrix I/O by 2-4x for similarity matricies
+ * and 4x for masks, but are not understood by readers of the MBGC format.
+ * Use \ref janus_read_matrix or \ref janus_decode_matrix to recover the
+ * standard layout. Defaults to \ref JANUS_SCORES_FLOAT32 and
+ * \ref JANUS_MASK_BYTE.
+ * \param[in] scores Encoding for similarity matricies.
+ * \param[in] mask Encoding for mask matricies.
+ */
+JANUS_EXPORT janus_error janus_set_matrix_encoding(janus_score_encoding scores, janus_mask_encoding mask);
+
+/*!
+ * \brief Parse the \c -score_encoding or \c -mask_encoding command line
+ *        option shared by the matrix writing utilities.
+ *
+ * Score encodings are named \c float32, \c float16 and \c quantized8, mask
+ * encodings \c byte and \c packed2. Unrecognized names are reported on
+ * \c stderr.
+ * \param[in] option The option, \c -score_encoding or \c -mask_encoding.
+ * \param[in] value The encoding name following the option.
+ * \param[in,out] scores Set if \p option is \c -score_encoding.
+ * \param[in,out] mask Set if \p option is \c -mask_encoding.
+ * \return \ref JANUS_PARSE_ERROR if \p option or \p value is not recognized.
+ * \see janus_set_matrix_encoding
+ */
+JANUS_EXPORT janus_error janus_parse_encoding(const char *option, const char *value, janus_score_encoding *scores, janus_mask_encoding *mask);
+
+/*!
+ * \brief Read a matrix in any encoding written by \ref janus_write_matrix
+ *        or the evaluation functions.
+ *
+ * Packed triangular matricies from symmetric verification are expanded to
+ * full square matricies, see \ref janus_set_symmetric_verify.
+ * \param[in] matrix File to read the matrix from.
+ * \param[out] data Decoded matrix, a float* of similarity values or a uint8_t* of mask values, to be freed with \ref janus_free_matrix.
+ * \param[out] rows Matrix rows.
+ * \param[out] columns Matrix columns.
+ * \param[out] is_mask Non-zero if \p data is a mask.
+ */
+JANUS_EXPORT janus_error janus_read_matrix(janus_matrix matrix, void **data, int *rows, int *columns, int *is_mask);
+
+/*!
+ * \brief Free a matrix returned by \ref janus_read_matrix.
+ * \param[in] data Matrix data to free.
+ */
+JANUS_EXPORT janus_error janus_free_matrix(void *data);
+
+/*!
+ * \brief Rewrite a matrix in any encoding in the standard \c MF or \c MB
+ *        layout read by MBGC tools.
+ * \param[in] encoded File to read the matrix from.
+ * \param[in] decoded File to write the matrix to.
+ */
+JANUS_EXPORT janus_error janus_decode_matrix(janus_matrix encoded, janus_matrix decoded);
+
 /*!
  * \brief Create similarity and mask matricies from two galleries with calls to janus_search.
  *
@@ -234,9 +570,105 @@ JANUS_EXPORT janus_error janus_write_matrix(void *data, int rows, int columns, i
  * \param[in] simmat Similarity matrix file to be created.
  * \param[in] mask Mask matrix file to be created.
  * \param[in] num_requested_returns Desired number of returned results for each call to janus_search.
+ * \note Queries whose \ref janus_template_summary reports no faces return no
+ *       results without calling janus_search.
  */
 JANUS_EXPORT janus_error janus_evaluate_search(janus_flat_gallery target, size_t target_bytes, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int num_requested_returns);
 
+/*!
+ * \brief Equivalent to \ref janus_evaluate_search against the merged view of
+ *        an incremental gallery.
+ * \param[in] target Gallery to constitute the columns of the matrix.
+ * \param[in] query Templates file created fron janus_create_templates to constitute the rows for the matrix.
+ * \param[in] target_metadata metadata file for the live templates in \p target.
+ * \param[in] query_metadata metadata file for \p query.
+ * \param[in] simmat Similarity matrix file to be created.
+ * \param[in] mask Mask matrix file to be created.
+ * \param[in] num_requested_returns Desired number of returned results for each query.
+ */
+JANUS_EXPORT janus_error janus_evaluate_incremental_search(janus_gallery_index target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int num_requested_returns);
+
+/*!
+ * \brief Equivalent to \ref janus_evaluate_search with a two-stage cascade
+ *        against a gallery written by \ref janus_create_cascade_gallery.
+ *
+ * Each query is first searched against the summary gallery, and only the
+ * \p num_survivors best candidates are rescored with \ref janus_verify
+ * against their complete templates. Results are the exhaustive results
+ * whenever every true top result survives screening, at a cost proportional
+ * to the summary size rather than the complete gallery size.
+ * Timings of the two stages are reported as
+ * \ref janus_metrics::janus_cascade_screen_speed and
+ * \ref janus_metrics::janus_cascade_rescore_speed.
+ * \param[in] target Flat gallery file written by \ref janus_create_cascade_gallery.
+ * \param[in] query Templates file created fron janus_create_templates to constitute the rows for the matrix.
+ * \param[in] target_metadata metadata file for \p target.
+ * \param[in] query_metadata metadata file for \p query.
+ * \param[in] simmat Similarity matrix file to be created.
+ * \param[in] mask Mask matrix file to be created.
+ * \param[in] num_requested_returns Desired number of returned results for each query.
+ * \param[in] num_survivors Candidates rescored per query, at least
+ *                          \p num_requested_returns.
+ * \param[in] measure_agreement Also search \p target exhaustively and count
+ *                              the queries whose rank-1 and rank-\p num_requested_returns
+ *                              results agree, see
+ *                              \ref janus_metrics::janus_cascade_rank1_agreement_count.
+ */
+JANUS_EXPORT janus_error janus_evaluate_cascade_search(const char *target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int num_requested_returns, int num_survivors, int measure_agreement);
+
+/*!
+ * \brief Evaluate accuracy while \ref janus_evaluate_verify and
+ *        \ref janus_evaluate_search run, instead of from their matrices.
+ *
+ * Genuine and impostor scores are accumulated into fixed size histograms as
+ * they are computed, and the results are written to \p results as a CSV file
+ * with a <tt>Plot,X,Y</tt> header and the rows:
+ * - <tt>Metadata,\<count\>,Genuine|Impostor|Searches</tt> Number of scores and
+ *   of queries with a genuine match in the target.
+ * - <tt>EER,,\<rate\></tt> Equal error rate.
+ * - <tt>TAR@FAR,\<far\>,\<tar\></tt> for false accept rates from 1e-6 to 1e-1.
+ * - <tt>DET,\<far\>,\<frr\></tt> Detection error tradeoff, four points per decade.
+ * - <tt>CMC,\<rank\>,\<rate\></tt> Cumulative match characteristic, the fraction
+ *   of queries with a genuine match in the target retrieved at or before
+ *   each rank.
+ *
+ * Scores are resolved to a relative precision of 2^-11. Either matrix file
+ * passed to the evaluation functions may then be \c NULL to skip writing it,
+ * and when both are \c NULL \ref janus_evaluate_verify holds only one row of
+ * scores in memory. In symmetric mode it instead streams the upper triangle,
+ * scoring genuine pairs before impostor pairs and holding only per-query CMC
+ * state, without the asynchronous worker pool.
+ * Partial matrices from \ref janus_evaluate_verify_block are not evaluated.
+ * \param[in] results CSV file to write, or \c NULL to disable online evaluation, the default.
+ */
+JANUS_EXPORT janus_error janus_set_online_evaluation(const char *results);
+
+/*!
+ * \brief Configure symmetric all-vs-all verification in
+ *        \ref janus_evaluate_verify and \ref janus_evaluate_verify_block.
+ *
+ * In symmetric mode the query and target templates are assumed identical and
+ * \ref janus_verify symmetric, so each unordered pair of templates is
+ * compared once and the result mirrored, halving the number of comparisons.
+ * Self-comparisons on the diagonal are not performed, they are scored
+ * \c -FLT_MAX and masked \c 0x00 so they are excluded from evaluation.
+ *
+ * If \p packed is non-zero, \ref janus_evaluate_verify writes only the
+ * strictly upper triangle of each matrix, packed row-major, in the format of
+ * \ref janus_write_matrix with a \c T appended to the matrix type, such as
+ * \c MFT or \c MBT. Partial matrices from \ref janus_evaluate_verify_block
+ * are never packed, but in symmetric mode only their elements on or above
+ * the diagonal are computed and their type is marked the same way.
+ * \ref janus_read_matrix expands packed matrices.
+ *
+ * \param[in] symmetric Zero to use symmetric mode only when the query and
+ *                      target templates and metadata are the same files,
+ *                      which is the default. Positive to always use symmetric
+ *                      mode, negative to never use it.
+ * \param[in] packed Write packed triangular matrices in symmetric mode.
+ */
+JANUS_EXPORT janus_error janus_set_symmetric_verify(int symmetric, int packed);
+
 /*!
  * \brief Create similarity and mask matricies from two galleries with calls to janus_verify.
  *
@@ -247,9 +679,206 @@ JANUS_EXPORT janus_error janus_evaluate_search(janus_flat_gallery target, size_t
  * \param[in] query_metadata metadata file for \p query.
  * \param[in] simmat Similarity matrix file to be created.
  * \param[in] mask Mask matrix file to be created.
+ * \note Comparisons involving a template whose \ref janus_template_summary
+ *       reports no faces are scored janus_template_summary::empty_score
+ *       without calling janus_verify. If the asynchronous worker pool is
+ *       running, see \ref janus_initialize_async, rows are scored
+ *       concurrently in decreasing order of expected cost.
  */
 JANUS_EXPORT janus_error janus_evaluate_verify(const char *target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask);
 
+/*!
+ * \brief Compute one rectangular block of the matrices produced by
+ *        \ref janus_evaluate_verify.
+ *
+ * Blocks are independent and may be computed concurrently by separate
+ * processes or machines. The partial matrices record the block bounds and
+ * the full matrix dimensions, and are renamed into place only once
+ * complete, so an existing block file never needs to be recomputed.
+ * Combine them with \ref janus_merge_matrix_blocks. In symmetric mode, see
+ * \ref janus_set_symmetric_verify, elements below the diagonal are left to
+ * the merge, so blocks entirely below it need not be computed.
+ * \param[in] target Templates file created from janus_create_templates to constitute the columns of the matrix.
+ * \param[in] query Templates file created from janus_create_templates to constitute the rows for the matrix.
+ * \param[in] target_metadata metadata file for \p target.
+ * \param[in] query_metadata metadata file for \p query.
+ * \param[in] simmat Partial similarity matrix file to be created.
+ * \param[in] mask Partial mask matrix file to be created.
+ * \param[in] row_begin First query template index in the block.
+ * \param[in] row_end One past the last query template index in the block, or -1 for all remaining rows.
+ * \param[in] column_begin First target template index in the block.
+ * \param[in] column_end One past the last target template index in the block, or -1 for all remaining columns.
+ */
+JANUS_EXPORT janus_error janus_evaluate_verify_block(const char *target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int row_begin, int row_end, int column_begin, int column_end);
+
+/*!
+ * \brief Merge partial matrices from \ref janus_evaluate_verify_block into a
+ *        single matrix in the format of \ref janus_write_matrix.
+ *
+ * All blocks must be of the same type and describe the same target, query
+ * and dimensions, and together they must cover every element of the matrix.
+ * Blocks computed in symmetric mode need only cover the elements on or above
+ * the diagonal, which are mirrored below it.
+ * \param[in] blocks Partial matrix files to merge.
+ * \param[in] num_blocks Length of \p blocks.
+ * \param[in] matrix Matrix file to be created.
+ */
+JANUS_EXPORT janus_error janus_merge_matrix_blocks(const janus_matrix *blocks, int num_blocks, janus_matrix matrix);
+
+/*!
+ * \brief Compare only the listed pairs of templates with calls to janus_verify.
+ *
+ * A sparse alternative to \ref janus_evaluate_verify for protocols that
+ * enumerate their genuine and impostor comparisons, with cost proportional
+ * to the number of pairs rather than the size of the matrix. Only the
+ * templates referenced by \p pairs are read, and pairs are compared grouped
+ * by query template.
+ *
+ * \p pairs is a CSV file with a header row followed by one
+ * <tt>QUERY_TEMPLATE_ID,TARGET_TEMPLATE_ID</tt> row per comparison.
+ * \p scores and \p mask are CSV files with one row per pair, in the same
+ * order, with columns <tt>QUERY_TEMPLATE_ID,TARGET_TEMPLATE_ID,SCORE</tt> and
+ * <tt>QUERY_TEMPLATE_ID,TARGET_TEMPLATE_ID,GENUINE</tt> respectively.
+ * \c GENUINE is \c 1 if the templates share a \c SUBJECT_ID and \c 0 otherwise.
+ * Every pair must reference templates in the metadata files, otherwise
+ * \ref JANUS_MISSING_TEMPLATE_ID is returned. Pairs referencing a template
+ * missing from \p query or \p target, such as one that failed to enroll,
+ * are scored \c -FLT_MAX.
+ * \param[in] target Templates file created from janus_create_templates for the target templates.
+ * \param[in] query Templates file created from janus_create_templates for the query templates.
+ * \param[in] target_metadata metadata file for \p target.
+ * \param[in] query_metadata metadata file for \p query.
+ * \param[in] pairs Pair list to compare.
+ * \param[in] scores Score file to be created.
+ * \param[in] mask Mask file to be created.
+ */
+JANUS_EXPORT janus_error janus_evaluate_verify_pairs(const char *target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, const char *pairs, const char *scores, const char *mask);
+
+/*!
+ * \brief Handle to a private type tracking an asynchronous operation.
+ *
+ * Returned by \ref janus_augment_async, \ref janus_verify_async and
+ * \ref janus_search_async. Every future must eventually be passed to
+ * \ref janus_free_future.
+ * \see janus_poll janus_wait
+ */
+typedef struct janus_future_type *janus_future;
+
+/*!
+ * \brief Completion callback for an asynchronous operation.
+ *
+ * Called from a worker thread with the result of the operation and the
+ * \a user_data provided when it was submitted, before the associated
+ * \ref janus_future becomes ready.
+ */
+typedef void (*janus_callback)(janus_error error, void *user_data);
+
+/*!
+ * \brief Start the worker pool backing the asynchronous API.
+ *
+ * Call after \ref janus_initialize. Workers call the synchronous API, so
+ * the implementation must honor the \ref thread_safety contract.
+ * Asynchronous calls fail until the pool is started.
+ * \param[in] num_workers Number of worker threads, 0 for one per hardware
+ *                        thread.
+ * \remark This function is \ref thread_unsafe.
+ * \see janus_finalize_async
+ */
+JANUS_EXPORT janus_error janus_initialize_async(int num_workers);
+
+/*!
+ * \brief Complete all outstanding asynchronous operations and stop the worker
+ *        pool.
+ *
+ * Call before \ref janus_finalize.
+ * \remark This function is \ref thread_unsafe.
+ */
+JANUS_EXPORT janus_error janus_finalize_async();
+
+/*!
+ * \brief Asynchronous \ref janus_augment.
+ *
+ * \p image, \p attributes and \p template_ must remain valid, and
+ * \p template_ must not be used by any other call, until the operation
+ * completes.
+ * \param[in] image Passed to \ref janus_augment.
+ * \param[in] attributes Passed to \ref janus_augment.
+ * \param[in,out] template_ Passed to \ref janus_augment.
+ * \param[in] callback Optional completion callback, or \c NULL.
+ * \param[in] user_data Passed to \p callback.
+ * \param[out] future Handle to the pending operation.
+ * \return \ref JANUS_UNKNOWN_ERROR, without submitting the operation, if the
+ *         worker pool is not running, see \ref janus_initialize_async.
+ * \remark This function is \ref thread_safe.
+ */
+JANUS_EXPORT janus_error janus_augment_async(const janus_image image, const janus_attribute_list attributes, janus_template template_, janus_callback callback, void *user_data, janus_future *future);
+
+/*!
+ * \brief Asynchronous \ref janus_verify.
+ *
+ * \p a, \p b and \p similarity must remain valid until the operation
+ * completes.
+ * \remark This function is \ref thread_safe.
+ * \see janus_augment_async
+ */
+JANUS_EXPORT janus_error janus_verify_async(const janus_flat_template a, const size_t a_bytes, const janus_flat_template b, const size_t b_bytes, float *similarity, janus_callback callback, void *user_data, janus_future *future);
+
+/*!
+ * \brief Asynchronous \ref janus_search.
+ *
+ * \p probe, \p gallery and the output buffers must remain valid until the
+ * operation completes.
+ * \remark This function is \ref thread_safe.
+ * \see janus_augment_async
+ */
+JANUS_EXPORT janus_error janus_search_async(const janus_flat_template probe, const size_t probe_bytes, const janus_flat_gallery gallery, const size_t gallery_bytes, const int num_requested_returns, janus_template_id *template_ids, float *similarities, int *num_actual_returns, janus_callback callback, void *user_data, janus_future *future);
+
+/*!
+ * \brief Check whether an asynchronous operation has completed.
+ * \return Non-zero once the operation has completed.
+ * \remark This function is \ref thread_safe.
+ */
+JANUS_EXPORT int janus_poll(const janus_future future);
+
+/*!
+ * \brief Block until an asynchronous operation completes.
+ * \return The result of the operation.
+ * \remark This function is \ref thread_safe.
+ */
+JANUS_EXPORT janus_error janus_wait(const janus_future future);
+
+/*!
+ * \brief Wait for and release an asynchronous operation.
+ * \remark This function is \ref reentrant.
+ */
+JANUS_EXPORT void janus_free_future(janus_future future);
+
+/*!
+ * \brief Instrumentation levels of the harness.
+ *
+ * The level is fixed at compile time by defining \c JANUS_INSTRUMENTATION,
+ * usually through the CMake option of the same name, and defaults to
+ * \ref JANUS_INSTRUMENTATION_HISTOGRAMS.
+ * Measurements below the selected level are compiled out of the harness
+ * entirely, so the timing calls around \ref janus_augment,
+ * \ref janus_verify and \ref janus_search cost nothing at
+ * \ref JANUS_INSTRUMENTATION_OFF.
+ * \see janus_metrics
+ */
+#define JANUS_INSTRUMENTATION_OFF        0 /*!< \brief Nothing is recorded. */
+#define JANUS_INSTRUMENTATION_COUNTERS   1 /*!< \brief Calls are counted but not timed. */
+#define JANUS_INSTRUMENTATION_HISTOGRAMS 2 /*!< \brief Calls are timed and summarized in \ref janus_metric. */
+#define JANUS_INSTRUMENTATION_TRACING    3 /*!< \brief As above, and each timed call is also written to \ref janus_set_trace_file. */
+
+#ifndef JANUS_INSTRUMENTATION
+#define JANUS_INSTRUMENTATION JANUS_INSTRUMENTATION_HISTOGRAMS
+#endif
+
+/*!
+ * \brief Number of bins in \ref janus_metric::histogram.
+ */
+#define JANUS_HISTOGRAM_BINS 64
+
 /*!
  * \brief A statistic.
  * \see janus_metrics
@@ -257,10 +886,69 @@ JANUS_EXPORT janus_error janus_evaluate_verify(const char *target, const char *q
 struct janus_metric
 {
     size_t count;  /*!< \brief Number of samples. */
-    double mean;   /*!< \brief Sample average. */
-    double stddev; /*!< \brief Sample standard deviation. */
+    double mean;   /*!< \brief Sample average, \c NaN below \ref JANUS_INSTRUMENTATION_HISTOGRAMS. */
+    double stddev; /*!< \brief Sample standard deviation, \c NaN below \ref JANUS_INSTRUMENTATION_HISTOGRAMS. */
+    size_t histogram[JANUS_HISTOGRAM_BINS]; /*!< \brief Half-octave sample counts, bin \a i holds samples in
+                                                 [2<sup>(i-16)/2</sup>, 2<sup>(i-15)/2</sup>) with the first and last
+                                                 bins unbounded. \see janus_metric_percentile */
+};
+
+/*!
+ * \brief Memory held by the harness for one kind of data.
+ *
+ * Only buffers allocated by the harness itself are accounted for, memory
+ * allocated by the implementation is reflected in the per-stage peak resident
+ * set sizes of \ref janus_metrics.
+ * \note Not recorded at \ref JANUS_INSTRUMENTATION_OFF.
+ * \see janus_metrics
+ */
+struct janus_memory
+{
+    size_t live_bytes; /*!< \brief Bytes held when the metrics were retrieved. */
+    size_t peak_bytes; /*!< \brief Most bytes held at once since the metrics were last retrieved. */
 };
 
+/*!
+ * \brief Estimate a percentile from \ref janus_metric::histogram.
+ * \param[in] metric The statistic to summarize.
+ * \param[in] percentile Fraction of samples in [0, 1], for example \c 0.99.
+ * \return The geometric center of the bin containing the percentile, or
+ *         \c NaN if the histogram is empty.
+ * \remark This function is \ref thread_safe.
+ */
+JANUS_EXPORT double janus_metric_percentile(const struct janus_metric *metric, double percentile);
+
+/*!
+ * \brief Receives every sample as it is recorded.
+ * \param[in] metric Name of the statistic, as printed by \ref janus_print_metrics.
+ * \param[in] value The sample, in the units of the statistic.
+ * \param[in] user_data The pointer provided to \ref janus_set_sample_sink.
+ * \note Called from the recording thread, so it must be \ref thread_safe.
+ */
+typedef void (*janus_sample_sink)(const char *metric, double value, void *user_data);
+
+/*!
+ * \brief Forward samples to an application defined function in addition to
+ *        \ref janus_metrics.
+ * \param[in] sink Function to call, or \c NULL to stop forwarding.
+ * \param[in] user_data Passed to every call of \p sink.
+ * \return \ref JANUS_NOT_IMPLEMENTED below
+ *         \ref JANUS_INSTRUMENTATION_HISTOGRAMS.
+ * \note Should not be called while other threads are recording samples.
+ */
+JANUS_EXPORT janus_error janus_set_sample_sink(janus_sample_sink sink, void *user_data);
+
+/*!
+ * \brief Write every timed call to a Chrome trace event file.
+ *
+ * The file may be opened with \c chrome://tracing or any viewer supporting
+ * the trace event format, with one complete event per call.
+ * \param[in] file_name File to write, or \c NULL to close the current file.
+ * \return \ref JANUS_NOT_IMPLEMENTED below \ref JANUS_INSTRUMENTATION_TRACING.
+ * \remark This function is \ref thread_safe.
+ */
+JANUS_EXPORT janus_error janus_set_trace_file(const char *file_name);
+
 /*!
  * \brief All statistics.
  * \see janus_get_metrics
@@ -271,18 +959,58 @@ struct janus_metrics
     struct janus_metric janus_augment_speed; /*!< \brief ms */
     struct janus_metric janus_finalize_template_speed; /*!< \brief ms */
     struct janus_metric janus_read_image_speed; /*!< \brief ms */
+    struct janus_metric janus_read_frame_speed; /*!< \brief ms */
     struct janus_metric janus_free_image_speed; /*!< \brief ms */
     struct janus_metric janus_verify_speed; /*!< \brief ms */
     struct janus_metric janus_search_speed; /*!< \brief ms */
     struct janus_metric janus_gallery_size_speed; /*!< \brief ms */
     struct janus_metric janus_finalize_gallery_speed; /*!< \brief ms */
     struct janus_metric janus_template_size; /*!< \brief KB */
+    struct janus_metric janus_compact_template_speed; /*!< \brief ms */
+    struct janus_metric janus_uncompacted_template_size; /*!< \brief KB, flattened size before \ref janus_compact_template */
+    struct janus_metric janus_compacted_template_size; /*!< \brief KB, flattened size after \ref janus_compact_template */
+    struct janus_metric janus_cascade_screen_speed; /*!< \brief ms, first stage of \ref janus_evaluate_cascade_search */
+    struct janus_metric janus_cascade_rescore_speed; /*!< \brief ms, second stage of \ref janus_evaluate_cascade_search */
     int          janus_missing_attributes_count; /*!< \brief Count of \ref JANUS_MISSING_ATTRIBUTES */
     int          janus_failure_to_enroll_count; /*!< \brief Count of \ref JANUS_FAILURE_TO_ENROLL */
     int          janus_other_errors_count; /*!< \brief Count of \ref janus_error excluding \ref JANUS_MISSING_ATTRIBUTES, \ref JANUS_FAILURE_TO_ENROLL, and \ref JANUS_SUCCESS */
+    int          janus_skipped_template_count; /*!< \brief Count of templates omitted from enrollment after a hard error, see \ref janus_create_templates */
+    int          janus_feature_cache_hit_count; /*!< \brief Count of images served from the feature cache \see janus_set_feature_cache */
+    int          janus_feature_cache_miss_count; /*!< \brief Count of images augmented and added to the feature cache */
+    int          janus_feature_cache_eviction_count; /*!< \brief Count of entries evicted from the feature cache */
+    int          janus_score_cache_hit_count; /*!< \brief Count of comparisons served from the score cache \see janus_set_score_cache */
+    int          janus_score_cache_miss_count; /*!< \brief Count of comparisons computed and added to the score cache */
+    int          janus_skipped_verify_count; /*!< \brief Count of comparisons scored without \ref janus_verify because a template has no faces \see janus_template_summary */
+    int          janus_skipped_search_count; /*!< \brief Count of queries answered without \ref janus_search because the query has no faces */
+    int          janus_frames_considered_count; /*!< \brief Count of video frames decoded during enrollment \see janus_set_frame_selection */
+    int          janus_frames_augmented_count; /*!< \brief Count of decoded video frames passed to \ref janus_augment */
+    int          janus_cascade_rescored_count; /*!< \brief Count of candidates rescored by \ref janus_evaluate_cascade_search */
+    int          janus_cascade_compared_count; /*!< \brief Count of cascade searches compared against exhaustive search */
+    int          janus_cascade_rank1_agreement_count; /*!< \brief Count of compared searches with the same top result */
+    int          janus_cascade_rankk_expected_count; /*!< \brief Count of top results returned by the compared exhaustive searches */
+    int          janus_cascade_rankk_agreement_count; /*!< \brief Count of those results also returned by the cascade */
+    struct janus_memory janus_image_memory; /*!< \brief Decoded images and video frames */
+    struct janus_memory janus_flat_template_memory; /*!< \brief Flat templates read or written by the harness */
+    struct janus_memory janus_gallery_memory; /*!< \brief Flat galleries searched or written by the harness */
+    struct janus_memory janus_matrix_memory; /*!< \brief Similarity and mask matrices */
+    struct janus_memory janus_metadata_memory; /*!< \brief Parsed #janus_metadata files, approximate */
+    size_t       janus_enrollment_peak_rss; /*!< \brief KB, peak resident set size during template or gallery creation \see janus_verify_peak_rss */
+    size_t       janus_search_peak_rss; /*!< \brief KB, peak resident set size during search evaluation \see janus_verify_peak_rss */
+    size_t       janus_verify_peak_rss; /*!< \brief KB, peak resident set size during verification evaluation. The largest resident set size
+                                                 sampled every 10 ms while the stage runs, so shorter spikes may be missed. The process
+                                                 high-water mark is not used, as it includes earlier stages and can't be reset without
+                                                 disturbing other measurements of the process. */
 };
 
-/*! \brief Retrieve and reset performance metrics. */
+/*!
+ * \brief Retrieve and reset performance metrics.
+ *
+ * Metrics are accumulated lock-free and may be recorded from any thread.
+ * Statistics retrieved while other threads are recording may be momentarily
+ * inconsistent.
+ * The detail recorded depends on \c JANUS_INSTRUMENTATION, see
+ * \ref JANUS_INSTRUMENTATION_OFF.
+ */
 JANUS_EXPORT struct janus_metrics janus_get_metrics();
 
 /*!
@@ -291,6 +1019,30 @@ JANUS_EXPORT struct janus_metrics janus_get_metrics();
  */
 JANUS_EXPORT void janus_print_metrics(struct janus_metrics metrics);
 
+/*!
+ * \brief Write metrics to a JSON file.
+ *
+ * Each \ref janus_metrics field is written under its own name. A
+ * \ref janus_metric is written as an object with \c count, \c mean,
+ * \c stddev, \c units and \c histogram members. A \ref janus_memory is
+ * written as an object with \c live_bytes and \c peak_bytes members.
+ * Undefined statistics are written as \c null.
+ * \param[in] metrics Metrics to write, usually from \ref janus_get_metrics.
+ * \param[in] file_name File to write.
+ * \see janus_read_metrics
+ */
+JANUS_EXPORT janus_error janus_write_metrics(struct janus_metrics metrics, const char *file_name);
+
+/*!
+ * \brief Read metrics written by \ref janus_write_metrics.
+ *
+ * Fields missing from the file, for example when it was written by an older
+ * version of the harness, are read as empty.
+ * \param[in] file_name File to read.
+ * \param[out] metrics The metrics.
+ */
+JANUS_EXPORT janus_error janus_read_metrics(const char *file_name, struct janus_metrics *metrics);
+
 /*! @}*/
 
 /*!
@@ -1,17 +1,29 @@
-// These file is designed to have no dependencies outside the C++ Standard Library
+// These file is designed to have no dependencies outside the C++ Standard Library,
+// operating system services are confined to janus_platform.cpp
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <mutex>
+#include <set>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 #include "iarpa_janus_io.h"
+#include "iarpa_janus.hpp"
+#include "janus_platform.cpp"
 
 using namespace std;
 
@@ -120,449 +132,3534 @@ janus_attribute janus_attribute_from_string(const char *attribute)
     return JANUS_INVALID_ATTRIBUTE;
 }
 
-// For computing metrics
-static vector<double> janus_initialize_template_samples;
-static vector<double> janus_augment_samples;
-static vector<double> janus_finalize_template_samples;
-static vector<double> janus_finalize_gallery_samples;
-static vector<double> janus_read_image_samples;
-static vector<double> janus_free_image_samples;
-static vector<double> janus_verify_samples;
-static vector<double> janus_template_size_samples;
-static vector<double> janus_gallery_size_samples;
-static vector<double> janus_search_samples;
-static int janus_missing_attributes_count = 0;
-static int janus_failure_to_enroll_count = 0;
-static int janus_other_errors_count = 0;
+// For computing metrics, accumulated lock-free so any thread may add samples
+struct Samples
+{
+    const char *name;
+    atomic<size_t> count;
+    atomic<double> sum, sumOfSquares;
+    atomic<size_t> histogram[JANUS_HISTOGRAM_BINS];
+
+    Samples(const char *name)
+        : name(name), count(0), sum(0), sumOfSquares(0)
+    {
+        for (int i=0; i<JANUS_HISTOGRAM_BINS; i++)
+            histogram[i] = 0;
+    }
+};
+
+static Samples janus_initialize_template_samples("janus_initialize_template");
+static Samples janus_augment_samples("janus_augment");
+static Samples janus_finalize_template_samples("janus_finalize_template");
+static Samples janus_finalize_gallery_samples("janus_finalize_gallery");
+static Samples janus_read_image_samples("janus_read_image");
+static Samples janus_read_frame_samples("janus_read_frame");
+static Samples janus_free_image_samples("janus_free_image");
+static Samples janus_verify_samples("janus_verify");
+static Samples janus_template_size_samples("janus_flat_template");
+static Samples janus_compact_template_samples("janus_compact_template");
+static Samples janus_uncompacted_template_size_samples("uncompacted_template");
+static Samples janus_compacted_template_size_samples("compacted_template");
+static Samples janus_gallery_size_samples("janus_gallery_size");
+static Samples janus_search_samples("janus_search");
+static Samples janus_cascade_screen_samples("janus_cascade_screen");
+static Samples janus_cascade_rescore_samples("janus_cascade_rescore");
+static atomic<int> janus_missing_attributes_count(0);
+static atomic<int> janus_failure_to_enroll_count(0);
+static atomic<int> janus_other_errors_count(0);
+static atomic<int> janus_skipped_template_count(0);
+static atomic<int> janus_feature_cache_hit_count(0);
+static atomic<int> janus_feature_cache_miss_count(0);
+static atomic<int> janus_feature_cache_eviction_count(0);
+static atomic<int> janus_score_cache_hit_count(0);
+static atomic<int> janus_score_cache_miss_count(0);
+static atomic<int> janus_skipped_verify_count(0);
+static atomic<int> janus_skipped_search_count(0);
+static atomic<int> janus_frames_considered_count(0);
+static atomic<int> janus_frames_augmented_count(0);
+static atomic<int> janus_cascade_rescored_count(0);
+static atomic<int> janus_cascade_compared_count(0);
+static atomic<int> janus_cascade_rank1_agreement_count(0);
+static atomic<int> janus_cascade_rankk_expected_count(0);
+static atomic<int> janus_cascade_rankk_agreement_count(0);
+
+// For accounting memory held by the harness, see janus_memory
+struct MemoryUsage
+{
+    atomic<size_t> live, peak;
+
+    MemoryUsage()
+        : live(0), peak(0) {}
+};
+
+static MemoryUsage janus_image_memory;
+static MemoryUsage janus_flat_template_memory;
+static MemoryUsage janus_gallery_memory;
+static MemoryUsage janus_matrix_memory;
+static MemoryUsage janus_metadata_memory;
+static atomic<size_t> janus_enrollment_peak_rss(0);
+static atomic<size_t> janus_search_peak_rss(0);
+static atomic<size_t> janus_verify_peak_rss(0);
+
+static void _janus_add_sample(Samples &samples, double sample);
+
+static janus_sample_sink janus_sample_sink_function = NULL;
+static void *janus_sample_sink_user_data = NULL;
+
+janus_error janus_set_sample_sink(janus_sample_sink sink, void *user_data)
+{
+#if JANUS_INSTRUMENTATION < JANUS_INSTRUMENTATION_HISTOGRAMS
+    (void) sink;
+    (void) user_data;
+    return JANUS_NOT_IMPLEMENTED;
+#else
+    janus_sample_sink_function = sink;
+    janus_sample_sink_user_data = user_data;
+    return JANUS_SUCCESS;
+#endif
+}
 
-static void _janus_add_sample(vector<double> &samples, double sample);
+// Half-octave bins, see janus_metric::histogram
+static int _janus_histogram_bin(double sample)
+{
+    if (!(sample > 0))
+        return 0;
+    int exponent;
+    const double mantissa = frexp(sample, &exponent);
+    const int bin = 2 * (exponent - 1) + (2 * mantissa >= M_SQRT2 ? 1 : 0) + 16;
+    return min(max(bin, 0), JANUS_HISTOGRAM_BINS - 1);
+}
 
 #ifndef JANUS_CUSTOM_ADD_SAMPLE
 
-static void _janus_add_sample(vector<double> &samples, double sample)
+static void _janus_atomic_add(atomic<double> &value, double delta)
+{
+    double expected = value.load(memory_order_relaxed);
+    while (!value.compare_exchange_weak(expected, expected + delta, memory_order_relaxed));
+}
+
+static void _janus_add_sample(Samples &samples, double sample)
 {
-    samples.push_back(sample);
+    _janus_atomic_add(samples.sum, sample);
+    _janus_atomic_add(samples.sumOfSquares, sample * sample);
+    samples.histogram[_janus_histogram_bin(sample)].fetch_add(1, memory_order_relaxed);
+    samples.count.fetch_add(1, memory_order_relaxed);
+    if (janus_sample_sink_function)
+        janus_sample_sink_function(samples.name, sample, janus_sample_sink_user_data);
 }
 
 #endif // JANUS_CUSTOM_ADD_SAMPLE
 
-struct TemplateData
+// Chrome trace event file, see janus_set_trace_file
+static mutex janus_trace_lock;
+static FILE *janus_trace_file = NULL;
+static size_t janus_trace_events = 0;
+static const chrono::steady_clock::time_point janus_trace_origin = chrono::steady_clock::now();
+
+janus_error janus_set_trace_file(const char *file_name)
 {
-    vector<string> fileNames;
-    vector<janus_template_id> templateIDs;
-    map<janus_template_id, int> subjectIDLUT;
-    vector<janus_attribute_list> attributeLists;
+    lock_guard<mutex> guard(janus_trace_lock);
+    if (janus_trace_file) {
+        fprintf(janus_trace_file, "\n]\n");
+        fclose(janus_trace_file);
+        janus_trace_file = NULL;
+    }
+    if (!file_name)
+        return JANUS_SUCCESS;
+#if JANUS_INSTRUMENTATION < JANUS_INSTRUMENTATION_TRACING
+    return JANUS_NOT_IMPLEMENTED;
+#else
+    janus_trace_file = fopen(file_name, "w");
+    if (!janus_trace_file)
+        return JANUS_OPEN_ERROR;
+    janus_trace_events = 0;
+    fprintf(janus_trace_file, "[\n");
+    return JANUS_SUCCESS;
+#endif
+}
+
+static atomic<int> janus_trace_threads(0);
+
+static void _janus_trace(const Samples &samples, chrono::steady_clock::time_point start, chrono::steady_clock::time_point stop)
+{
+    thread_local const int thread_id = ++janus_trace_threads;
+    lock_guard<mutex> guard(janus_trace_lock);
+    if (!janus_trace_file)
+        return;
+    fprintf(janus_trace_file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+            janus_trace_events++ ? ",\n" : "", samples.name,
+            chrono::duration<double, micro>(start - janus_trace_origin).count(),
+            chrono::duration<double, micro>(stop - start).count(),
+            _janus_process_id(), thread_id);
+}
+
+static void _janus_atomic_max(atomic<size_t> &value, size_t candidate)
+{
+    size_t expected = value.load(memory_order_relaxed);
+    while ((candidate > expected) && !value.compare_exchange_weak(expected, candidate, memory_order_relaxed));
+}
+
+// Memory accounting, common to every policy that records anything
+struct MemoryAccounting
+{
+    static void allocate(MemoryUsage &usage, size_t bytes)
+    {
+        _janus_atomic_max(usage.peak, usage.live.fetch_add(bytes, memory_order_relaxed) + bytes);
+    }
+
+    static void release(MemoryUsage &usage, size_t bytes)
+    {
+        usage.live.fetch_sub(bytes, memory_order_relaxed);
+    }
+
+    // Stages record the largest resident set size sampled while they run.
+    // The process high-water mark is never reset, since it would include every
+    // earlier stage and resetting it disturbs anyone else measuring the
+    // process, including overlapping stages. Returns false if not sampled.
+    static bool sampleStage(atomic<size_t> &stageRSS)
+    {
+        _janus_atomic_max(stageRSS, _janus_current_rss());
+        return true;
+    }
 };
 
-struct TemplateIterator : public TemplateData
+// Instrumentation policies, each call site takes a Timestamp with now() and
+// passes it to record() once the call returns, while sizes are passed to
+// measure(). Only the policy selected by JANUS_INSTRUMENTATION is used, so
+// disabled measurements compile away entirely.
+struct NullInstrumentation
 {
-    size_t i;
-    bool verbose;
+    static const bool measures = false;
+    struct Timestamp {};
+    static Timestamp now() { return Timestamp(); }
+    static void record(Samples &, const Timestamp &) {}
+    static void measure(Samples &, double) {}
+    static void allocate(MemoryUsage &, size_t) {}
+    static void release(MemoryUsage &, size_t) {}
+    static bool sampleStage(atomic<size_t> &) { return false; }
+};
 
-    TemplateIterator(janus_metadata metadata, bool verbose)
-        : i(0), verbose(verbose)
+struct CountingInstrumentation : public MemoryAccounting
+{
+    static const bool measures = false;
+    struct Timestamp {};
+    static Timestamp now() { return Timestamp(); }
+    static void record(Samples &samples, const Timestamp &) { samples.count.fetch_add(1, memory_order_relaxed); }
+    static void measure(Samples &samples, double) { samples.count.fetch_add(1, memory_order_relaxed); }
+};
+
+struct HistogramInstrumentation : public MemoryAccounting
+{
+    static const bool measures = true;
+    typedef clock_t Timestamp;
+    static Timestamp now() { return clock(); }
+    static void record(Samples &samples, const Timestamp &start) { _janus_add_sample(samples, 1000.0 * (clock() - start) / CLOCKS_PER_SEC); }
+    static void measure(Samples &samples, double sample) { _janus_add_sample(samples, sample); }
+};
+
+struct TracingInstrumentation : public MemoryAccounting
+{
+    static const bool measures = true;
+    struct Timestamp
+    {
+        clock_t cpu;
+        chrono::steady_clock::time_point wall;
+    };
+
+    static Timestamp now()
+    {
+        Timestamp timestamp;
+        timestamp.cpu = clock();
+        timestamp.wall = chrono::steady_clock::now();
+        return timestamp;
+    }
+
+    static void record(Samples &samples, const Timestamp &start)
+    {
+        HistogramInstrumentation::record(samples, start.cpu);
+        _janus_trace(samples, start.wall, chrono::steady_clock::now());
+    }
+
+    static void measure(Samples &samples, double sample) { _janus_add_sample(samples, sample); }
+};
+
+#if   JANUS_INSTRUMENTATION == JANUS_INSTRUMENTATION_OFF
+typedef NullInstrumentation Instrumentation;
+#elif JANUS_INSTRUMENTATION == JANUS_INSTRUMENTATION_COUNTERS
+typedef CountingInstrumentation Instrumentation;
+#elif JANUS_INSTRUMENTATION == JANUS_INSTRUMENTATION_HISTOGRAMS
+typedef HistogramInstrumentation Instrumentation;
+#else
+typedef TracingInstrumentation Instrumentation;
+#endif
+
+// Charges bytes to a category for its lifetime, copies are charged separately
+struct MemoryCharge
+{
+    MemoryUsage *usage;
+    size_t bytes;
+
+    explicit MemoryCharge(MemoryUsage &usage, size_t bytes = 0)
+        : usage(&usage), bytes(bytes)
+    {
+        Instrumentation::allocate(usage, bytes);
+    }
+
+    MemoryCharge(const MemoryCharge &other)
+        : usage(other.usage), bytes(other.bytes)
+    {
+        Instrumentation::allocate(*usage, bytes);
+    }
+
+    MemoryCharge &operator=(const MemoryCharge &other)
+    {
+        if (this != &other) {
+            Instrumentation::allocate(*other.usage, other.bytes);
+            Instrumentation::release(*usage, bytes);
+            usage = other.usage;
+            bytes = other.bytes;
+        }
+        return *this;
+    }
+
+    ~MemoryCharge()
+    {
+        Instrumentation::release(*usage, bytes);
+    }
+
+    void resize(size_t size)
+    {
+        if (size > bytes) Instrumentation::allocate(*usage, size - bytes);
+        else              Instrumentation::release(*usage, bytes - size);
+        bytes = size;
+    }
+};
+
+// Interval between resident set size samples of a running stage
+static const int janus_rss_sample_ms = 10;
+
+// Samples the resident set size over the lifetime of a pipeline stage, at
+// its start and end and periodically from a watcher thread in between
+struct StageMemory
+{
+    atomic<size_t> &stageRSS;
+    mutex lock;
+    condition_variable stopped;
+    bool stopping;
+    thread watcher;
+
+    explicit StageMemory(atomic<size_t> &stageRSS)
+        : stageRSS(stageRSS), stopping(false)
+    {
+        if (Instrumentation::sampleStage(stageRSS))
+            watcher = thread(&StageMemory::watch, this);
+    }
+
+    ~StageMemory()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        stopped.notify_all();
+        if (watcher.joinable())
+            watcher.join();
+        Instrumentation::sampleStage(stageRSS);
+    }
+
+    void watch()
+    {
+        unique_lock<mutex> guard(lock);
+        while (!stopped.wait_for(guard, chrono::milliseconds(janus_rss_sample_ms), [this] { return stopping; }))
+            Instrumentation::sampleStage(stageRSS);
+    }
+};
+
+static janus_data *_janus_buffer(vector<janus_data> &buffer)
+{
+    return buffer.empty() ? NULL : &buffer[0];
+}
+
+// Flatten into an exactly sized buffer, falling back to janus_max_template_size
+// for implementations without janus_flattened_size
+static janus_error _janus_flatten_template(const janus_template template_, vector<janus_data> &buffer, size_t *bytes)
+{
+    size_t capacity;
+    const janus_error size_error = janus_flattened_size(template_, &capacity);
+    if (size_error == JANUS_NOT_IMPLEMENTED)
+        capacity = janus_max_template_size();
+    else if (size_error != JANUS_SUCCESS)
+        return size_error;
+
+    buffer.resize(capacity);
+    *bytes = 0;
+    JANUS_CHECK(janus_flatten_template(template_, _janus_buffer(buffer), bytes))
+    buffer.resize(*bytes);
+    return JANUS_SUCCESS;
+}
+
+// Persistent per-image augmentation cache, see janus_set_feature_cache
+struct FeatureCache
+{
+    string path, algorithm;
+    size_t maxBytes, bytes;
+    uint64_t tick; // Logical time of the most recent use
+    map<uint64_t, pair<size_t, uint64_t> > entries; // key -> (bytes, last use)
+    map<uint64_t, uint64_t> lru; // last use -> key
+    vector<janus_data> flatBuffer;
+
+    // Processes sharing the cache hold a lock on janus_cache.idx.lock, shared
+    // to read the journal and exclusive to append to or compact it. Each
+    // process replays only the lines appended since it last read the journal.
+    static const size_t journal_batch = 256;
+    InterprocessLock lock;
+    uint64_t generation; // Incremented by every compaction of the journal
+    size_t journalOffset, journalLines; // Replayed so far
+    vector<pair<uint64_t, size_t> > journalPending; // Records not yet journaled
+
+    FeatureCache()
+        : maxBytes(0), bytes(0), tick(0), generation(0), journalOffset(0), journalLines(0) {}
+
+    ~FeatureCache()
+    {
+        close();
+    }
+
+    bool enabled() const
+    {
+        return !path.empty();
+    }
+
+    // 64-bit FNV-1a
+    static uint64_t hash(const void *data, size_t size, uint64_t seed = 14695981039346656037ULL)
+    {
+        const unsigned char *buffer = (const unsigned char*) data;
+        for (size_t i=0; i<size; i++) {
+            seed ^= buffer[i];
+            seed *= 1099511628211ULL;
+        }
+        return seed;
+    }
+
+    static bool hashFile(const string &fileName, uint64_t *digest)
+    {
+        ifstream file(fileName.c_str(), ios::in | ios::binary);
+        if (!file.is_open())
+            return false;
+
+        *digest = hash(NULL, 0);
+        char buffer[65536];
+        while (file) {
+            file.read(buffer, sizeof(buffer));
+            *digest = hash(buffer, file.gcount(), *digest);
+        }
+        return true;
+    }
+
+    uint64_t key(uint64_t mediaHash, const janus_attribute_list &attributes) const
+    {
+        uint64_t digest = hash(&mediaHash, sizeof(mediaHash));
+        digest = hash(attributes.attributes, attributes.size * sizeof(janus_attribute), digest);
+        digest = hash(attributes.values, attributes.size * sizeof(double), digest);
+        return hash(algorithm.data(), algorithm.size(), digest);
+    }
+
+    string entryFile(uint64_t key) const
     {
-        ifstream file(metadata);
+        char name[64];
+        snprintf(name, sizeof(name), "/janus_cache_%016llx.jfc", (unsigned long long) key);
+        return path + name;
+    }
+
+    string indexFile() const
+    {
+        return path + "/janus_cache.idx";
+    }
+
+    janus_error open(const string &cachePath, const string &cacheAlgorithm, size_t cacheMaxBytes)
+    {
+        close();
+        path = cachePath;
+        algorithm = cacheAlgorithm;
+        maxBytes = cacheMaxBytes;
+        if (!lock.open(indexFile() + ".lock")) {
+            close();
+            return JANUS_OPEN_ERROR;
+        }
+
+        InterprocessLock::Guard guard(lock, true);
+        sync();
+        evict();
+        return flushJournal();
+    }
+
+    void close()
+    {
+        if (enabled()) {
+            InterprocessLock::Guard guard(lock, true);
+            sync();
+            flushJournal();
+        }
+        lock.close();
+        path.clear();
+        algorithm.clear();
+        maxBytes = bytes = 0;
+        tick = 0;
+        entries.clear();
+        lru.clear();
+        generation = 0;
+        journalOffset = journalLines = 0;
+        journalPending.clear();
+    }
+
+    // Add a cached augmentation to the template, returns false on a cache miss
+    bool merge(uint64_t key, janus_template template_)
+    {
+        map<uint64_t, pair<size_t, uint64_t> >::const_iterator it = entries.find(key);
+        if (it == entries.end()) {
+            // The entry may have been stored by another process
+            InterprocessLock::Guard guard(lock, false);
+            sync();
+            it = entries.find(key);
+            if (it == entries.end())
+                return false;
+        }
+        if (it->second.first < sizeof(uint64_t)) {
+            erase(key);
+            return false;
+        }
+
+        const Instrumentation::Timestamp start = Instrumentation::now();
+        ifstream file(entryFile(key).c_str(), ios::in | ios::binary);
+        uint64_t storedKey = 0;
+        vector<janus_data> buffer(it->second.first - sizeof(storedKey));
+        file.read((char*)&storedKey, sizeof(storedKey));
+        if (!buffer.empty())
+            file.read((char*)&buffer[0], buffer.size());
+        if (!file || (storedKey != key)) {
+            erase(key);
+            return false;
+        }
+
+        if (janus_merge_flat_template(buffer.empty() ? NULL : &buffer[0], buffer.size(), template_) != JANUS_SUCCESS) {
+            erase(key);
+            return false;
+        }
+        Instrumentation::record(janus_augment_samples, start);
+
+        // Hits are journaled in batches
+        use(key, sizeof(storedKey) + buffer.size());
+        if (journalPending.size() >= journal_batch) {
+            InterprocessLock::Guard guard(lock, true);
+            sync();
+            flushJournal();
+        }
+        janus_feature_cache_hit_count++;
+        return true;
+    }
+
+    // Augment via a single image template so the result can be cached
+    janus_error augment(uint64_t key, const janus_image image, const janus_attribute_list attributes, janus_template template_)
+    {
+        janus_template scratch;
+        JANUS_CHECK(janus_allocate_template(&scratch))
+        const janus_error error = janus_augment(image, attributes, scratch);
+
+        size_t flatBytes;
+        janus_error flatten_error = _janus_flatten_template(scratch, flatBuffer, &flatBytes);
+        JANUS_CHECK(janus_free_template(scratch))
+        if (flatten_error == JANUS_SUCCESS)
+            flatten_error = janus_merge_flat_template(_janus_buffer(flatBuffer), flatBytes, template_);
+        if (flatten_error != JANUS_SUCCESS)
+            return flatten_error;
+
+        if (error == JANUS_SUCCESS) {
+            store(key, _janus_buffer(flatBuffer), flatBytes);
+            janus_feature_cache_miss_count++;
+        }
+        return error;
+    }
+
+    // Entries are written under a name private to this process and renamed
+    // into place, so other processes never read a partial entry
+    void store(uint64_t key, const janus_data *data, size_t size)
+    {
+        stringstream partial;
+        partial << entryFile(key) << '.' << _janus_process_id() << ".tmp";
+        {
+            ofstream file(partial.str().c_str(), ios::out | ios::binary | ios::trunc);
+            file.write((const char*)&key, sizeof(key));
+            file.write((const char*)data, size);
+            file.close();
+            if (!file || (std::rename(partial.str().c_str(), entryFile(key).c_str()) != 0)) {
+                std::remove(partial.str().c_str());
+                return;
+            }
+        }
+
+        InterprocessLock::Guard guard(lock, true);
+        sync();
+        use(key, sizeof(key) + size);
+        evict();
+        flushJournal();
+    }
+
+    void evict()
+    {
+        while ((bytes > maxBytes) && !lru.empty()) {
+            erase(lru.begin()->second);
+            janus_feature_cache_eviction_count++;
+        }
+    }
+
+    void erase(uint64_t key)
+    {
+        std::remove(entryFile(key).c_str());
+        use(key, 0);
+    }
+
+    // Record a use (or eviction when entryBytes is zero) in memory and for the journal
+    void use(uint64_t key, size_t entryBytes)
+    {
+        touch(key, entryBytes);
+        journalPending.push_back(make_pair(key, entryBytes));
+    }
+
+    void touch(uint64_t key, size_t entryBytes)
+    {
+        map<uint64_t, pair<size_t, uint64_t> >::iterator it = entries.find(key);
+        if (it != entries.end()) {
+            lru.erase(it->second.second);
+            bytes -= it->second.first;
+            entries.erase(it);
+        }
+
+        if (entryBytes > 0) {
+            entries[key] = pair<size_t, uint64_t>(entryBytes, ++tick);
+            lru[tick] = key;
+            bytes += entryBytes;
+        }
+    }
+
+    // Requires the lock. Replays the journal lines appended since the last
+    // sync, or the whole journal once another process has compacted it.
+    // Later lines take precedence and a size of zero marks an eviction.
+    void sync()
+    {
+        ifstream journal(indexFile().c_str(), ios::in | ios::binary);
+        string line;
+        uint64_t journalGeneration = 0;
+        size_t start = 0;
+        if (getline(journal, line) && (line.compare(0, 11, "generation ") == 0)) {
+            journalGeneration = strtoull(line.c_str() + 11, NULL, 10);
+            start = line.size() + 1;
+        }
+        if ((journalGeneration != generation) || (journalOffset < start)) {
+            entries.clear();
+            lru.clear();
+            bytes = 0;
+            generation = journalGeneration;
+            journalOffset = start;
+            journalLines = 0;
+        }
+
+        journal.clear();
+        journal.seekg(journalOffset);
+        while (getline(journal, line)) {
+            journalOffset += line.size() + 1;
+            istringstream record(line);
+            uint64_t key;
+            size_t entryBytes;
+            if (record >> hex >> key >> dec >> entryBytes) {
+                touch(key, entryBytes);
+                journalLines++;
+            }
+        }
+    }
+
+    // Requires the exclusive lock and a sync, appends the pending records and
+    // compacts the journal once it is mostly superseded lines
+    janus_error flushJournal()
+    {
+        if (!journalPending.empty()) {
+            stringstream lines;
+            for (size_t i=0; i<journalPending.size(); i++)
+                lines << hex << journalPending[i].first << ' ' << dec << journalPending[i].second << '\n';
+            const string text = lines.str();
+            ofstream journal(indexFile().c_str(), ios::out | ios::binary | ios::app);
+            journal.write(text.data(), text.size());
+            journal.close();
+            if (!journal)
+                return JANUS_WRITE_ERROR;
+            journalOffset += text.size();
+            journalLines += journalPending.size();
+            journalPending.clear();
+        }
+
+        if (journalLines > 2 * entries.size() + 1024)
+            return compact();
+        return JANUS_SUCCESS;
+    }
+
+    // Requires the exclusive lock. Rewrites the journal in least recently used
+    // order under a new generation, renamed into place so processes that read
+    // it later replay it from the start.
+    janus_error compact()
+    {
+        stringstream compacted;
+        compacted << indexFile() << '.' << _janus_process_id() << ".tmp";
+        stringstream lines;
+        lines << "generation " << (generation + 1) << '\n';
+        for (map<uint64_t, uint64_t>::const_iterator it = lru.begin(); it != lru.end(); it++)
+            lines << hex << it->second << ' ' << dec << entries[it->second].first << '\n';
+        const string text = lines.str();
+
+        ofstream index(compacted.str().c_str(), ios::out | ios::binary | ios::trunc);
+        index.write(text.data(), text.size());
+        index.close();
+        if (!index || (std::rename(compacted.str().c_str(), indexFile().c_str()) != 0)) {
+            std::remove(compacted.str().c_str());
+            return JANUS_WRITE_ERROR;
+        }
+        generation++;
+        journalOffset = text.size();
+        journalLines = entries.size();
+        return JANUS_SUCCESS;
+    }
+};
+
+static FeatureCache janus_feature_cache;
+
+janus_error janus_set_feature_cache(const char *cache_path, const char *algorithm, size_t max_bytes)
+{
+    if (!cache_path) {
+        janus_feature_cache.close();
+        return JANUS_SUCCESS;
+    }
+
+    // Probe for janus_merge_flat_template support with an empty flat template
+    janus_template template_;
+    JANUS_CHECK(janus_allocate_template(&template_))
+    const janus_error merge_error = janus_merge_flat_template(NULL, 0, template_);
+    JANUS_CHECK(janus_free_template(template_))
+    if (merge_error == JANUS_NOT_IMPLEMENTED) {
+        janus_feature_cache.close();
+        return JANUS_SUCCESS;
+    } else if (merge_error != JANUS_SUCCESS) {
+        return merge_error;
+    }
+
+    return janus_feature_cache.open(cache_path, algorithm ? algorithm : "", max_bytes);
+}
+
+// Persistent pairwise score cache, see janus_set_score_cache
+struct ScoreCache
+{
+    // An open addressing hash table of slots following a header, probed
+    // linearly in place through a shared mapping of the file. Slots hold the
+    // full key so that a hash collision is never mistaken for a hit.
+    struct Slot
+    {
+        uint64_t a, b;      // Content hashes of the templates in order
+        uint64_t algorithm; // Hash of the algorithm, 0 for an empty slot
+        float score;
+        uint32_t reserved;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint64_t capacity, count;
+        atomic<uint64_t> generation; // Odd while slots are being written
+        atomic<uint64_t> retired;    // Set once a grown table replaces this one
+    };
+
+    // Processes sharing the cache hold an exclusive lock on
+    // janus_scores.jsc.lock to write or replace the table, and a shared lock
+    // to map it. Lookups take no lock, they are validated by the generation.
+    // Inserts are buffered and written in batches.
+    static const size_t flush_threshold = 1024;
+    string path, algorithm;
+    uint64_t algorithmHash;
+    InterprocessLock lock;
+    MappedFile table;
+    typedef map<pair<uint64_t,uint64_t>, float> Scores;
+    Scores pending;
+
+    ScoreCache()
+        : algorithmHash(0) {}
+
+    ~ScoreCache()
+    {
+        close();
+    }
+
+    bool enabled() const
+    {
+        return table.data != NULL;
+    }
+
+    string tableFile() const
+    {
+        return path + "/janus_scores.jsc";
+    }
+
+    // New tables are built under a name private to this process
+    string temporaryFile() const
+    {
+        stringstream name;
+        name << tableFile() << '.' << _janus_process_id() << ".tmp";
+        return name.str();
+    }
+
+    static Header &header(const MappedFile &mapping)
+    {
+        return *(Header*)mapping.data;
+    }
+
+    static Slot *slots(const MappedFile &mapping)
+    {
+        return (Slot*)(mapping.data + sizeof(Header));
+    }
+
+    static janus_error create(const string &fileName, uint64_t tableCapacity)
+    {
+        ofstream file(fileName.c_str(), ios::out | ios::binary | ios::trunc);
+        const uint64_t fields[4] = { tableCapacity, 0, 0, 0 };
+        file.write("JANUSSC2", 8);
+        file.write((const char*)fields, sizeof(fields));
+        const vector<Slot> empty(4096, Slot());
+        for (uint64_t i=0; i<tableCapacity; i+=empty.size())
+            file.write((const char*)&empty[0], min(uint64_t(empty.size()), tableCapacity - i) * sizeof(Slot));
+        return file ? JANUS_SUCCESS : JANUS_WRITE_ERROR;
+    }
+
+    static bool mapTable(MappedFile &mapping, const string &fileName)
+    {
+        if (!mapping.map(fileName))
+            return false;
+        if (mapping.size >= sizeof(Header)) {
+            const Header &tableHeader = header(mapping);
+            const uint64_t capacity = tableHeader.capacity;
+            if (!memcmp(tableHeader.magic, "JANUSSC2", 8) && (capacity > 0) && !(capacity & (capacity - 1)) &&
+                (mapping.size == sizeof(Header) + capacity * sizeof(Slot)))
+                return true;
+        }
+        mapping.unmap();
+        return false;
+    }
+
+    // Requires the lock
+    bool openTable()
+    {
+        return mapTable(table, tableFile());
+    }
+
+    // Requires the exclusive lock
+    janus_error replace(const string &fileName)
+    {
+        if (std::rename(fileName.c_str(), tableFile().c_str()) != 0) {
+            std::remove(fileName.c_str());
+            return JANUS_WRITE_ERROR;
+        }
+        if (enabled())
+            header(table).retired.store(1, memory_order_release);
+        return openTable() ? JANUS_SUCCESS : JANUS_OPEN_ERROR;
+    }
+
+    janus_error open(const string &cachePath, const string &cacheAlgorithm)
+    {
+        close();
+        path = cachePath;
+        algorithm = cacheAlgorithm;
+        algorithmHash = FeatureCache::hash(algorithm.data(), algorithm.size());
+        algorithmHash = algorithmHash ? algorithmHash : 1;
+
+        if (!lock.open(tableFile() + ".lock"))
+            return JANUS_OPEN_ERROR;
+
+        janus_error open_error = JANUS_SUCCESS;
+        {
+            InterprocessLock::Guard guard(lock, true);
+            // Missing or unreadable tables are started afresh
+            if (!openTable()) {
+                const string created = temporaryFile();
+                open_error = create(created, uint64_t(1) << 16);
+                if (open_error == JANUS_SUCCESS)
+                    open_error = replace(created);
+                else
+                    std::remove(created.c_str());
+            }
+        }
+        if (open_error != JANUS_SUCCESS) {
+            close();
+            return JANUS_OPEN_ERROR;
+        }
+        return JANUS_SUCCESS;
+    }
+
+    void close()
+    {
+        if (enabled())
+            flush();
+        table.unmap();
+        lock.close();
+        pending.clear();
+    }
+
+    // Finds the slot holding the key or the empty slot where it belongs
+    Slot *probe(const MappedFile &mapping, uint64_t a, uint64_t b) const
+    {
+        const uint64_t mask = header(mapping).capacity - 1;
+        uint64_t digest = FeatureCache::hash(&a, sizeof(a));
+        digest = FeatureCache::hash(&b, sizeof(b), digest);
+        digest = FeatureCache::hash(&algorithmHash, sizeof(algorithmHash), digest);
+        for (uint64_t index = digest & mask; true; index = (index + 1) & mask) {
+            Slot *slot = &slots(mapping)[index];
+            if ((slot->algorithm == 0) || ((slot->a == a) && (slot->b == b) && (slot->algorithm == algorithmHash)))
+                return slot;
+        }
+    }
+
+    bool lookup(uint64_t a, uint64_t b, float *score)
+    {
+        Scores::const_iterator buffered = pending.find(make_pair(a, b));
+        if (buffered != pending.end()) {
+            *score = buffered->second;
+            return true;
+        }
+
+        if (header(table).retired.load(memory_order_acquire)) {
+            InterprocessLock::Guard guard(lock, false);
+            if (!openTable())
+                return false;
+        }
+
+        // Slots are only ever filled, so probing terminates even while
+        // another process writes. A read that overlapped a write is a miss.
+        Header &tableHeader = header(table);
+        const uint64_t generation = tableHeader.generation.load(memory_order_acquire);
+        if (generation & 1)
+            return false;
+        const Slot slot = *probe(table, a, b);
+        atomic_thread_fence(memory_order_acquire);
+        if ((tableHeader.generation.load(memory_order_relaxed) != generation) || (slot.algorithm == 0))
+            return false;
+        *score = slot.score;
+        return true;
+    }
+
+    janus_error insert(uint64_t a, uint64_t b, float score)
+    {
+        pending[make_pair(a, b)] = score;
+        return (pending.size() >= flush_threshold) ? flush() : JANUS_SUCCESS;
+    }
+
+    // Writes the buffered inserts under the exclusive lock
+    janus_error flush()
+    {
+        if (pending.empty())
+            return JANUS_SUCCESS;
+
+        InterprocessLock::Guard guard(lock, true);
+        if (header(table).retired.load(memory_order_acquire) && !openTable())
+            return JANUS_OPEN_ERROR;
+
+        // Keep the load factor below 0.7
+        while (10 * (header(table).count + pending.size()) > 7 * header(table).capacity)
+            JANUS_CHECK(grow())
+
+        Header &tableHeader = header(table);
+        const uint64_t generation = tableHeader.generation.load(memory_order_relaxed);
+        tableHeader.generation.store(generation + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (Scores::const_iterator it = pending.begin(); it != pending.end(); ++it) {
+            Slot *slot = probe(table, it->first.first, it->first.second);
+            if (slot->algorithm == 0)
+                tableHeader.count++;
+            slot->a = it->first.first;
+            slot->b = it->first.second;
+            slot->score = it->second;
+            slot->algorithm = algorithmHash;
+        }
+        tableHeader.generation.store(generation + 2, memory_order_release);
+        pending.clear();
+        return table.flush() ? JANUS_SUCCESS : JANUS_WRITE_ERROR;
+    }
+
+    // Requires the exclusive lock. Rehash into a table of twice the capacity,
+    // renamed into place once complete.
+    janus_error grow()
+    {
+        const string grown = temporaryFile();
+        const janus_error grow_error = rehash(grown, 2 * header(table).capacity);
+        if (grow_error != JANUS_SUCCESS) {
+            std::remove(grown.c_str());
+            return grow_error;
+        }
+        return replace(grown);
+    }
+
+    janus_error rehash(const string &grown, uint64_t grownCapacity)
+    {
+        JANUS_CHECK(create(grown, grownCapacity))
+        MappedFile grownTable;
+        if (!mapTable(grownTable, grown))
+            return JANUS_OPEN_ERROR;
+        const uint64_t capacity = header(table).capacity;
+        for (uint64_t i=0; i<capacity; i++) {
+            const Slot &slot = slots(table)[i];
+            if (slot.algorithm != 0)
+                *probe(grownTable, slot.a, slot.b) = slot;
+        }
+        header(grownTable).count = header(table).count;
+        return grownTable.flush() ? JANUS_SUCCESS : JANUS_WRITE_ERROR;
+    }
+};
+
+static ScoreCache janus_score_cache;
+
+janus_error janus_set_score_cache(const char *cache_path, const char *algorithm)
+{
+    if (!cache_path) {
+        janus_score_cache.close();
+        return JANUS_SUCCESS;
+    }
+    return janus_score_cache.open(cache_path, algorithm ? algorithm : "");
+}
+
+static mutex janus_score_cache_lock;
+
+// janus_verify with flat templates identified by content hash, consulting the score cache
+static janus_error _janus_verify(const janus_flat_template a, size_t a_bytes, uint64_t a_hash, const janus_flat_template b, size_t b_bytes, uint64_t b_hash, float *similarity)
+{
+    // The outcome of comparing against a template without faces is known in advance
+    janus_template_summary summary;
+    if ((janus::FlatTemplateView(a, a_bytes).summary(&summary) && (summary.num_faces == 0)) ||
+        (janus::FlatTemplateView(b, b_bytes).summary(&summary) && (summary.num_faces == 0))) {
+        *similarity = summary.empty_score;
+        janus_skipped_verify_count++;
+        return JANUS_SUCCESS;
+    }
+
+    if (janus_score_cache.enabled()) {
+        lock_guard<mutex> guard(janus_score_cache_lock);
+        if (janus_score_cache.lookup(a_hash, b_hash, similarity)) {
+            janus_score_cache_hit_count++;
+            return JANUS_SUCCESS;
+        }
+    }
+
+    const Instrumentation::Timestamp start = Instrumentation::now();
+    JANUS_CHECK(janus_verify(a, a_bytes, b, b_bytes, similarity))
+    Instrumentation::record(janus_verify_samples, start);
+
+    if (janus_score_cache.enabled()) {
+        lock_guard<mutex> guard(janus_score_cache_lock);
+        janus_score_cache_miss_count++;
+        JANUS_CHECK(janus_score_cache.insert(a_hash, b_hash, *similarity))
+    }
+    return JANUS_SUCCESS;
+}
+
+// Writes scores buffered by _janus_verify to the score cache
+static janus_error _janus_flush_score_cache()
+{
+    if (!janus_score_cache.enabled())
+        return JANUS_SUCCESS;
+    lock_guard<mutex> guard(janus_score_cache_lock);
+    return janus_score_cache.flush();
+}
+
+static size_t _janus_image_bytes(const janus_image &image)
+{
+    return image.width * image.height * (image.color_space == JANUS_GRAY8 ? 1 : 3);
+}
+
+static void _janus_free_image(janus_image image)
+{
+    Instrumentation::release(janus_image_memory, _janus_image_bytes(image));
+    const Instrumentation::Timestamp start = Instrumentation::now();
+    janus_free_image(image);
+    Instrumentation::record(janus_free_image_samples, start);
+}
+
+// Redundant video frame suppression, see janus_set_frame_selection
+static double janus_frame_similarity_threshold = 0;
+static int janus_max_frames_per_video = 0;
+
+janus_error janus_set_frame_selection(double similarity_threshold, int max_frames)
+{
+    if ((similarity_threshold < 0) || (max_frames < 0))
+        return JANUS_UNKNOWN_ERROR;
+    janus_frame_similarity_threshold = similarity_threshold;
+    janus_max_frames_per_video = max_frames;
+    return JANUS_SUCCESS;
+}
+
+// Template compaction at enrollment, see janus_set_template_compaction
+static bool janus_compaction_enabled = false;
+static size_t janus_compaction_max_faces = 0;
+static size_t janus_compaction_max_bytes = 0;
+
+janus_error janus_set_template_compaction(size_t max_faces, size_t max_bytes)
+{
+    janus_compaction_enabled = false;
+    if ((max_faces == 0) && (max_bytes == 0))
+        return JANUS_SUCCESS;
+
+    // Probe for janus_compact_template support with an empty template
+    janus_template template_;
+    JANUS_CHECK(janus_allocate_template(&template_))
+    const janus_error compact_error = janus_compact_template(template_, max_faces, max_bytes);
+    JANUS_CHECK(janus_free_template(template_))
+    if (compact_error == JANUS_NOT_IMPLEMENTED)
+        return JANUS_SUCCESS;
+    else if (compact_error != JANUS_SUCCESS)
+        return compact_error;
+
+    janus_compaction_enabled = true;
+    janus_compaction_max_faces = max_faces;
+    janus_compaction_max_bytes = max_bytes;
+    return JANUS_SUCCESS;
+}
+
+static janus_error _janus_flattened_size(janus_template template_, size_t *bytes)
+{
+    const janus_error size_error = janus_flattened_size(template_, bytes);
+    if (size_error != JANUS_NOT_IMPLEMENTED)
+        return size_error;
+
+    vector<janus_data> buffer;
+    return _janus_flatten_template(template_, buffer, bytes);
+}
+
+static janus_error _janus_compact_template(janus_template template_)
+{
+    // Flattening only to measure is skipped unless sizes are recorded
+    size_t bytes = 0;
+    if (Instrumentation::measures)
+        JANUS_CHECK(_janus_flattened_size(template_, &bytes))
+    Instrumentation::measure(janus_uncompacted_template_size_samples, bytes / 1024.0);
+
+    const Instrumentation::Timestamp start = Instrumentation::now();
+    JANUS_CHECK(janus_compact_template(template_, janus_compaction_max_faces, janus_compaction_max_bytes))
+    Instrumentation::record(janus_compact_template_samples, start);
+
+    if (Instrumentation::measures)
+        JANUS_CHECK(_janus_flattened_size(template_, &bytes))
+    Instrumentation::measure(janus_compacted_template_size_samples, bytes / 1024.0);
+    return JANUS_SUCCESS;
+}
+
+struct FrameRequest
+{
+    int frame;
+    size_t row;
+    uint64_t cacheKey;
+
+    bool operator<(const FrameRequest &other) const
+    {
+        return (frame < other.frame) || ((frame == other.frame) && (row < other.row));
+    }
+};
+
+// A decoded video frame and the metadata rows that reference it
+struct VideoFrame
+{
+    janus_image image;
+    vector<FrameRequest> requests;
+    vector<double> thumbnail;
+    double quality;
+    size_t slot; // Budget slot of the most recent frame merged into this one
+};
+
+// Groups consecutive near-duplicate frames (and frames sharing a budget slot)
+// into runs, of which only the sharpest frame is augmented.
+struct FrameSelector
+{
+    size_t total;
+    bool hasPending;
+    VideoFrame pending;
+
+    FrameSelector(size_t total)
+        : total(total), hasPending(false) {}
+
+    static bool enabled()
+    {
+        return (janus_frame_similarity_threshold > 0) || (janus_max_frames_per_video > 0);
+    }
+
+    // 16x16 grayscale thumbnail and mean gradient magnitude from a sparse pixel grid
+    static void describe(VideoFrame &frame)
+    {
+        static const size_t thumbnailSize = 16, samplesPerCell = 4, gridSize = thumbnailSize * samplesPerCell;
+        const janus_image &image = frame.image;
+        const size_t channels = (image.color_space == JANUS_BGR24 ? 3 : 1);
+        const size_t rowStep = image.width * channels;
+
+        frame.thumbnail.assign(thumbnailSize * thumbnailSize, 0);
+        frame.quality = 0;
+        if ((image.width == 0) || (image.height == 0))
+            return;
+
+        size_t gradients = 0;
+        for (size_t gy=0; gy<gridSize; gy++) {
+            const size_t y = (2 * gy + 1) * image.height / (2 * gridSize);
+            for (size_t gx=0; gx<gridSize; gx++) {
+                const size_t x = (2 * gx + 1) * image.width / (2 * gridSize);
+                const janus_data *pixel = image.data + y * rowStep + x * channels;
+                const double intensity = pixel[channels / 2];
+                frame.thumbnail[(gy / samplesPerCell) * thumbnailSize + gx / samplesPerCell] += intensity / (samplesPerCell * samplesPerCell);
+
+                if ((x + 1 < image.width) && (y + 1 < image.height)) {
+                    frame.quality += fabs(pixel[channels + channels / 2] - intensity) + fabs(pixel[rowStep + channels / 2] - intensity);
+                    gradients++;
+                }
+            }
+        }
+        if (gradients > 0)
+            frame.quality /= gradients;
+    }
+
+    static double distance(const vector<double> &a, const vector<double> &b)
+    {
+        double sum = 0;
+        for (size_t i=0; i<a.size(); i++)
+            sum += fabs(a[i] - b[i]);
+        return sum / a.size();
+    }
+
+    // Offer the next decoded frame (in increasing frame order) at the given
+    // index among the frames requested from the video. Returns true when the
+    // previous run is complete and its representative is stored in ready.
+    bool offer(VideoFrame &frame, size_t position, VideoFrame *ready)
+    {
+        describe(frame);
+        frame.slot = (janus_max_frames_per_video > 0) ? janus_max_frames_per_video * position / total : position;
+
+        if (hasPending && (((janus_frame_similarity_threshold > 0) && (distance(pending.thumbnail, frame.thumbnail) < janus_frame_similarity_threshold)) ||
+                           ((janus_max_frames_per_video > 0) && (frame.slot == pending.slot)))) {
+            const size_t slot = frame.slot;
+            if (frame.quality > pending.quality)
+                swap(pending, frame);
+            _janus_free_image(frame.image);
+            pending.slot = slot;
+            return false;
+        }
+
+        const bool flushed = hasPending;
+        if (flushed)
+            *ready = pending;
+        pending = frame;
+        hasPending = true;
+        return flushed;
+    }
+
+    bool finish(VideoFrame *ready)
+    {
+        const bool flushed = hasPending;
+        if (flushed)
+            *ready = pending;
+        hasPending = false;
+        return flushed;
+    }
+};
+
+// Streaming parser shared by TemplateIterator and janus_parse_metadata
+struct MetadataParser
+{
+    ifstream file;
+    string header, line;
+    vector<janus_attribute> attributes;
+    janus_template_id templateID;
+    int subjectID;
+    string fileName;
+    janus::AttributeList attributeList;
+
+    MetadataParser(janus_metadata metadata)
+        : file(metadata), templateID(0), subjectID(0)
+    {
+        // Parse header
+        getline(file, header);
+        istringstream attributeNames(header);
+        string attributeName;
+        getline(attributeNames, attributeName, ','); // TEMPLATE_ID
+        getline(attributeNames, attributeName, ','); // SUBJECT_ID
+        getline(attributeNames, attributeName, ','); // FILE_NAME
+        while (getline(attributeNames, attributeName, ',')) {
+            attributeName.erase(remove_if(attributeName.begin(), attributeName.end(), ::isspace), attributeName.end());
+            attributes.push_back(janus_attribute_from_string(attributeName.c_str()));
+        }
+    }
+
+    bool next()
+    {
+        if (!getline(file, line))
+            return false;
+
+        istringstream attributeValues(line);
+        string templateIDValue, subjectIDValue, attributeValue;
+        getline(attributeValues, templateIDValue, ',');
+        getline(attributeValues, subjectIDValue, ',');
+        fileName.clear();
+        getline(attributeValues, fileName, ',');
+        templateID = atoi(templateIDValue.c_str());
+        subjectID = atoi(subjectIDValue.c_str());
+
+        // Construct attribute list, removing missing fields
+        attributeList = janus::AttributeList();
+        for (int j=0; getline(attributeValues, attributeValue, ','); j++)
+            if (!attributeValue.empty())
+                attributeList.push_back(attributes[j], atof(attributeValue.c_str()));
+        return true;
+    }
+};
+
+janus_error janus_parse_metadata(janus_metadata metadata, janus_metadata_callback callback, void *user_data)
+{
+    MetadataParser parser(metadata);
+    if (!parser.file.is_open())
+        return JANUS_OPEN_ERROR;
+
+    while (parser.next()) {
+        janus_metadata_row row;
+        row.template_id = parser.templateID;
+        row.subject_id = parser.subjectID;
+        row.file_name = parser.fileName.c_str();
+        row.attributes = parser.attributeList.view();
+        row.header = parser.header.c_str();
+        row.line = parser.line.c_str();
+        JANUS_CHECK(callback(&row, user_data))
+    }
+    return parser.file.eof() ? JANUS_SUCCESS : JANUS_READ_ERROR;
+}
+
+struct TemplateData
+{
+    vector<string> fileNames;
+    vector<janus_template_id> templateIDs;
+    map<janus_template_id, int> subjectIDLUT;
+    vector<janus::AttributeList> attributeLists;
+    MemoryCharge memory; // Approximate, only charged for whole metadata files
+
+    TemplateData()
+        : memory(janus_metadata_memory) {}
+};
+
+struct TemplateIterator : public TemplateData
+{
+    size_t i;
+    bool verbose;
+
+    TemplateIterator(janus_metadata metadata, bool verbose)
+        : i(0), verbose(verbose)
+    {
+        MetadataParser parser(metadata);
+        size_t metadataBytes = 0;
+        while (parser.next()) {
+            templateIDs.push_back(parser.templateID);
+            subjectIDLUT.insert(pair<janus_template_id,int>(parser.templateID, parser.subjectID));
+            fileNames.push_back(parser.fileName);
+            attributeLists.push_back(parser.attributeList);
+            metadataBytes += sizeof(janus_template_id) + sizeof(string) + parser.fileName.size() + sizeof(janus::AttributeList) +
+                             parser.attributeList.size() * (sizeof(janus_attribute) + sizeof(double));
+        }
+        metadataBytes += subjectIDLUT.size() * (sizeof(pair<janus_template_id,int>) + 4 * sizeof(void*));
+        memory.resize(metadataBytes);
+
+        if (verbose)
+            fprintf(stderr, "\rEnrolling %zu/%zu", i, attributeLists.size());
+    }
+
+    TemplateData next()
+    {
+        TemplateData templateData;
+        if (i >= attributeLists.size()) {
+            fprintf(stderr, "\n");
+        } else {
+            const janus_template_id templateID = templateIDs[i];
+            while ((i < attributeLists.size()) && (templateIDs[i] == templateID)) {
+                templateData.templateIDs.push_back(templateIDs[i]);
+                templateData.fileNames.push_back(fileNames[i]);
+                templateData.attributeLists.push_back(attributeLists[i]);
+                i++;
+            }
+            if (verbose)
+                fprintf(stderr, "\rEnrolling %zu/%zu", i, attributeLists.size());
+        }
+        return templateData;
+    }
+
+    static bool isVideo(const string &fileName)
+    {
+        static const char *extensions[] = { "avi", "flv", "m4v", "mkv", "mov", "mp4", "mpeg", "mpg", "webm", "wmv", "3gp" };
+        const size_t dot = fileName.find_last_of('.');
+        if (dot == string::npos)
+            return false;
+        string extension = fileName.substr(dot + 1);
+        transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        for (size_t i=0; i<sizeof(extensions)/sizeof(extensions[0]); i++)
+            if (extension == extensions[i])
+                return true;
+        return false;
+    }
+
+    // Returns -1 for still images
+    static int frameNumber(const janus_attribute_list &attributes)
+    {
+        for (size_t i=0; i<attributes.size; i++)
+            if (attributes.attributes[i] == JANUS_FRAME)
+                return int(attributes.values[i]);
+        return -1;
+    }
+
+    static void augment(const janus_image image, const janus_attribute_list attributes, uint64_t cacheKey, const string &fileName, janus_template template_, bool verbose)
+    {
+        const Instrumentation::Timestamp start = Instrumentation::now();
+        const janus_error error = janus_feature_cache.enabled() ? janus_feature_cache.augment(cacheKey, image, attributes, template_)
+                                                                : janus_augment(image, attributes, template_);
+        if (error == JANUS_MISSING_ATTRIBUTES) {
+            janus_missing_attributes_count++;
+            if (verbose)
+                printf("Missing attributes for: %s\n", fileName.c_str());
+        } else if (error == JANUS_FAILURE_TO_ENROLL) {
+            janus_failure_to_enroll_count++;
+            if (verbose)
+                printf("Failure to enroll: %s\n", fileName.c_str());
+        } else if (error != JANUS_SUCCESS) {
+            janus_other_errors_count++;
+            printf("Warning: %s on: %s\n", janus_error_to_string(error), fileName.c_str());
+        }
+        Instrumentation::record(janus_augment_samples, start);
+    }
+
+    // Media that can not be read fails the whole template
+    static janus_error augmentImage(const string &fileName, const janus_attribute_list &attributes, janus_template template_, bool verbose)
+    {
+        uint64_t cacheKey = 0;
+        uint64_t mediaHash;
+        if (janus_feature_cache.enabled() && FeatureCache::hashFile(fileName, &mediaHash)) {
+            cacheKey = janus_feature_cache.key(mediaHash, attributes);
+            if (janus_feature_cache.merge(cacheKey, template_))
+                return JANUS_SUCCESS;
+        }
+
+        janus_image image;
+        const Instrumentation::Timestamp start = Instrumentation::now();
+        const janus_error read_error = janus_read_image(fileName.c_str(), &image);
+        Instrumentation::record(janus_read_image_samples, start);
+        if (read_error != JANUS_SUCCESS) {
+            fprintf(stderr, "Failed to read: %s\n", fileName.c_str());
+            return read_error;
+        }
+        Instrumentation::allocate(janus_image_memory, _janus_image_bytes(image));
+
+        augment(image, attributes, cacheKey, fileName, template_, verbose);
+        _janus_free_image(image);
+        return JANUS_SUCCESS;
+    }
+
+    static void augmentFrame(const VideoFrame &frame, const string &fileName, const TemplateData &templateData, bool consultCache, janus_template template_, bool verbose)
+    {
+        for (size_t i=0; i<frame.requests.size(); i++) {
+            if (consultCache && janus_feature_cache.enabled() && janus_feature_cache.merge(frame.requests[i].cacheKey, template_))
+                continue;
+            augment(frame.image, templateData.attributeLists[frame.requests[i].row].view(), frame.requests[i].cacheKey, fileName, template_, verbose);
+        }
+        janus_frames_augmented_count++;
+        _janus_free_image(frame.image);
+    }
+
+    // Decode rows [begin, end) which all reference the same video file
+    static janus_error augmentVideo(const string &fileName, const TemplateData &templateData, size_t begin, size_t end, janus_template template_, bool verbose)
+    {
+        uint64_t mediaHash;
+        const bool cached = janus_feature_cache.enabled() && FeatureCache::hashFile(fileName, &mediaHash);
+
+        vector<FrameRequest> requests;
+        for (size_t i=begin; i<end; i++) {
+            FrameRequest request;
+            request.frame = frameNumber(templateData.attributeLists[i].view());
+            request.row = i;
+            request.cacheKey = cached ? janus_feature_cache.key(mediaHash, templateData.attributeLists[i].view()) : 0;
+            requests.push_back(request);
+        }
+
+        // Visit frames in increasing order so the decoder only ever seeks forward
+        sort(requests.begin(), requests.end());
+
+        // Frame selection needs every frame's pixels, so it consults the cache
+        // only for the frames it selects to keep templates identical either way
+        const bool selecting = FrameSelector::enabled();
+        size_t numFrames = 0;
+        for (size_t i=0; i<requests.size(); i++)
+            if ((i == 0) || (requests[i].frame != requests[i-1].frame))
+                numFrames++;
+        FrameSelector selector(numFrames);
+
+        janus_video video = NULL;
+        size_t position = 0;
+        for (size_t i=0; i<requests.size(); position++) {
+            VideoFrame frame;
+            const int frameIndex = requests[i].frame;
+            for (; (i < requests.size()) && (requests[i].frame == frameIndex); i++)
+                if (selecting || !cached || !janus_feature_cache.merge(requests[i].cacheKey, template_))
+                    frame.requests.push_back(requests[i]);
+            if (frame.requests.empty())
+                continue;
+
+            // Only open the video once a frame actually needs decoding
+            if (!video) {
+                const janus_error open_error = janus_open_video(fileName.c_str(), &video);
+                if (open_error != JANUS_SUCCESS) {
+                    fprintf(stderr, "Failed to open: %s\n", fileName.c_str());
+                    return open_error;
+                }
+            }
+
+            const Instrumentation::Timestamp start = Instrumentation::now();
+            janus_error error = janus_seek_frame(video, frameIndex);
+            if (error == JANUS_SUCCESS)
+                error = janus_read_frame(video, &frame.image);
+            Instrumentation::record(janus_read_frame_samples, start);
+
+            // An undecodable frame is dropped, the rest of the video still enrolls
+            if (error != JANUS_SUCCESS) {
+                janus_other_errors_count++;
+                printf("Warning: %s on: %s frame %d\n", janus_error_to_string(error), fileName.c_str(), frameIndex);
+                continue;
+            }
+            janus_frames_considered_count++;
+            Instrumentation::allocate(janus_image_memory, _janus_image_bytes(frame.image));
+
+            VideoFrame ready;
+            if (!selecting)
+                augmentFrame(frame, fileName, templateData, false, template_, verbose);
+            else if (selector.offer(frame, position, &ready))
+                augmentFrame(ready, fileName, templateData, true, template_, verbose);
+        }
+
+        VideoFrame ready;
+        if (selector.finish(&ready))
+            augmentFrame(ready, fileName, templateData, true, template_, verbose);
+
+        if (video)
+            janus_close_video(video);
+        return JANUS_SUCCESS;
+    }
+
+    // The template is only returned if every row was read
+    static janus_error create(const char *data_path, const TemplateData &templateData, janus_template *template_, janus_template_id *templateID, bool verbose)
+    {
+        janus::Template created;
+        const Instrumentation::Timestamp start = Instrumentation::now();
+        JANUS_CHECK(janus_allocate_template(created.put()))
+        Instrumentation::record(janus_initialize_template_samples, start);
+
+        size_t i = 0;
+        while (i < templateData.templateIDs.size()) {
+            const string fileName = data_path + templateData.fileNames[i];
+
+            if (isVideo(fileName) && (frameNumber(templateData.attributeLists[i].view()) >= 0)) {
+                // Open the video once for all of its consecutive frame rows
+                size_t end = i + 1;
+                while ((end < templateData.templateIDs.size()) &&
+                       (templateData.fileNames[end] == templateData.fileNames[i]) &&
+                       (frameNumber(templateData.attributeLists[end].view()) >= 0))
+                    end++;
+                JANUS_CHECK(augmentVideo(fileName, templateData, i, end, created.get(), verbose))
+                i = end;
+            } else {
+                JANUS_CHECK(augmentImage(fileName, templateData.attributeLists[i].view(), created.get(), verbose))
+                i++;
+            }
+        }
+
+        if (janus_compaction_enabled)
+            JANUS_CHECK(_janus_compact_template(created.get()))
+
+        *template_ = created.release();
+        *templateID = templateData.templateIDs[0];
+        return JANUS_SUCCESS;
+    }
+};
+
+janus_error janus_create_template(const char *data_path, janus_metadata metadata, janus_template *template_, janus_template_id *template_id)
+{
+    TemplateIterator ti(metadata, false);
+    return TemplateIterator::create(data_path, ti.next(), template_, template_id, false);
+}
+
+#ifndef JANUS_CUSTOM_CREATE_TEMPLATES
+
+// Seconds between checkpoints of janus_create_templates progress
+static const time_t janus_checkpoint_interval = 60;
+
+// Progress of janus_create_templates, recorded alongside the templates file
+struct Checkpoint
+{
+    size_t templates; // Metadata templates consumed, including skipped ones
+    size_t offset; // Bytes of complete records in the templates file
+    janus_template_id templateID; // Last template written
+    bool complete;
+
+    Checkpoint()
+        : templates(0), offset(0), templateID(-1), complete(false)
+    {}
+
+    static string fileName(const char *gallery_file)
+    {
+        return string(gallery_file) + ".checkpoint";
+    }
+
+    bool read(const char *gallery_file)
+    {
+        ifstream file(fileName(gallery_file).c_str());
+        string status;
+        file >> templates >> offset >> templateID >> status;
+        complete = (status == "complete");
+        return !file.fail();
+    }
+
+    // Written under a temporary name and renamed so a crash never leaves a torn checkpoint
+    janus_error write(const char *gallery_file) const
+    {
+        const string checkpoint = fileName(gallery_file);
+        const string partial = checkpoint + ".tmp";
+        {
+            ofstream file(partial.c_str());
+            file << templates << ' ' << offset << ' ' << templateID << ' ' << (complete ? "complete" : "partial") << '\n';
+            if (!file)
+                return JANUS_WRITE_ERROR;
+        }
+        if (std::rename(partial.c_str(), checkpoint.c_str()) != 0)
+            return JANUS_WRITE_ERROR;
+        return JANUS_SUCCESS;
+    }
+};
+
+// Restores the last consistent state of an interrupted janus_create_templates,
+// truncating any partially written record and advancing the iterator past
+// every template already accounted for
+static janus_error _janus_recover_templates(const char *gallery_file, TemplateIterator &ti, Checkpoint &checkpoint)
+{
+    ifstream file(gallery_file, ios::in | ios::binary | ios::ate);
+    if (!file.is_open()) {
+        checkpoint = Checkpoint();
+        return JANUS_SUCCESS;
+    }
+    const size_t size = file.tellg();
+
+    if (!checkpoint.read(gallery_file) || (checkpoint.offset > size))
+        checkpoint = Checkpoint();
+
+    // Records completed after the last checkpoint are kept
+    vector<janus_template_id> recovered;
+    while (true) {
+        janus_template_id templateID;
+        size_t bytes;
+        file.seekg(checkpoint.offset);
+        file.read((char*)&templateID, sizeof(templateID));
+        file.read((char*)&bytes, sizeof(bytes));
+        if (!file || (checkpoint.offset + sizeof(templateID) + sizeof(bytes) + bytes > size))
+            break;
+        checkpoint.offset += sizeof(templateID) + sizeof(bytes) + bytes;
+        recovered.push_back(templateID);
+    }
+    file.close();
+
+    if (!_janus_truncate_file(gallery_file, checkpoint.offset))
+        return JANUS_WRITE_ERROR;
+
+    for (size_t i=0; i<checkpoint.templates; i++)
+        if (ti.next().templateIDs.empty())
+            return JANUS_PARSE_ERROR; // Metadata does not match the checkpoint
+
+    for (size_t i=0; i<recovered.size(); i++) {
+        janus_template_id templateID;
+        do {
+            const TemplateData templateData = ti.next();
+            if (templateData.templateIDs.empty())
+                return JANUS_PARSE_ERROR; // Metadata does not match the templates file
+            templateID = templateData.templateIDs[0];
+            checkpoint.templates++;
+        } while (templateID != recovered[i]);
+        checkpoint.templateID = templateID;
+    }
+    return JANUS_SUCCESS;
+}
+
+// Templates that fail to enroll with a hard error are left out and enrollment goes on
+static void _janus_skip_template(janus_template_id templateID, janus_error error)
+{
+    fprintf(stderr, "Skipping template %d: %s\n", templateID, janus_error_to_string(error));
+    janus_skipped_template_count++;
+}
+
+static janus_error _janus_create_templates(const char *data_path, janus_metadata metadata, const char *gallery_file, int verbose, bool resume)
+{
+    StageMemory stage(janus_enrollment_peak_rss);
+    TemplateIterator ti(metadata, true);
+    Checkpoint checkpoint;
+    if (resume)
+        JANUS_CHECK(_janus_recover_templates(gallery_file, ti, checkpoint))
+
+    janus_template_id templateID;
+    TemplateData templateData = ti.next();
+    vector<janus_data> flat_template_;
+    MemoryCharge flat_template_memory(janus_flat_template_memory);
+    std::ofstream file;
+    file.open(gallery_file, std::ios::out | std::ios::binary | (resume ? std::ios::app : std::ios::trunc));
+    if (!file.is_open())
+        return JANUS_OPEN_ERROR;
+
+    time_t last_checkpoint = time(NULL);
+    while (!templateData.templateIDs.empty()) {
+        // Hard failures are confined to the template that caused them
+        janus::Template template_;
+        size_t bytes;
+        janus_error enroll_error = TemplateIterator::create(data_path, templateData, template_.put(), &templateID, verbose);
+        if (enroll_error == JANUS_SUCCESS)
+            enroll_error = _janus_flatten_template(template_.get(), flat_template_, &bytes);
+        flat_template_memory.resize(flat_template_.capacity());
+
+        if (enroll_error == JANUS_SUCCESS) {
+            file.write((char*)&templateID, sizeof(templateID));
+            file.write((char*)&bytes, sizeof(bytes));
+            file.write((char*)_janus_buffer(flat_template_), bytes);
+            checkpoint.offset += sizeof(templateID) + sizeof(bytes) + bytes;
+            checkpoint.templateID = templateID;
+        } else {
+            _janus_skip_template(templateData.templateIDs[0], enroll_error);
+        }
+        checkpoint.templates++;
+
+        if (time(NULL) - last_checkpoint >= janus_checkpoint_interval) {
+            if (!file.flush())
+                return JANUS_WRITE_ERROR;
+            JANUS_CHECK(checkpoint.write(gallery_file))
+            last_checkpoint = time(NULL);
+        }
+
+        templateData = ti.next();
+    }
+    file.close();
+    if (file.fail())
+        return JANUS_WRITE_ERROR;
+
+    checkpoint.complete = true;
+    return checkpoint.write(gallery_file);
+}
+
+janus_error janus_create_templates(const char *data_path, janus_metadata metadata, const char *gallery_file, int verbose)
+{
+    return _janus_create_templates(data_path, metadata, gallery_file, verbose, false);
+}
+
+janus_error janus_resume_create_templates(const char *data_path, janus_metadata metadata, const char *gallery_file, int verbose)
+{
+    return _janus_create_templates(data_path, metadata, gallery_file, verbose, true);
+}
+
+#endif // JANUS_CUSTOM_CREATE_TEMPLATES
+
+// Create each template of metadata and pass it to enroll, skipping templates
+// that fail to be created
+static janus_error _janus_enroll_templates(const char *data_path, janus_metadata metadata, int verbose, const function<janus_error(janus_template, janus_template_id)> &enroll)
+{
+    TemplateIterator ti(metadata, true);
+    janus_template_id templateID;
+    TemplateData templateData = ti.next();
+    while (!templateData.templateIDs.empty()) {
+        janus::Template template_;
+        const janus_error enroll_error = TemplateIterator::create(data_path, templateData, template_.put(), &templateID, verbose);
+        if (enroll_error == JANUS_SUCCESS)
+            JANUS_CHECK(enroll(template_.get(), templateID))
+        else
+            _janus_skip_template(templateData.templateIDs[0], enroll_error);
+        templateData = ti.next();
+    }
+    return JANUS_SUCCESS;
+}
+
+#ifndef JANUS_CUSTOM_CREATE_GALLERY
+
+janus_error janus_create_gallery(const char *data_path, janus_metadata metadata, janus_gallery gallery, int verbose)
+{
+    StageMemory stage(janus_enrollment_peak_rss);
+    return _janus_enroll_templates(data_path, metadata, verbose, [gallery](janus_template template_, janus_template_id templateID) {
+        return janus_enroll(template_, templateID, gallery);
+    });
+}
+
+#endif // JANUS_CUSTOM_CREATE_GALLERY
+
+// Matrix encoding, see janus_set_matrix_encoding
+static janus_score_encoding janus_score_encoding_ = JANUS_SCORES_FLOAT32;
+static janus_mask_encoding janus_mask_encoding_ = JANUS_MASK_BYTE;
+
+janus_error janus_set_matrix_encoding(janus_score_encoding scores, janus_mask_encoding mask)
+{
+    janus_score_encoding_ = scores;
+    janus_mask_encoding_ = mask;
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_parse_encoding(const char *option, const char *value, janus_score_encoding *scores, janus_mask_encoding *mask)
+{
+    if (strcmp(option, "-score_encoding") == 0) {
+        if      (strcmp(value, "float32") == 0)    *scores = JANUS_SCORES_FLOAT32;
+        else if (strcmp(value, "float16") == 0)    *scores = JANUS_SCORES_FLOAT16;
+        else if (strcmp(value, "quantized8") == 0) *scores = JANUS_SCORES_QUANTIZED8;
+        else {
+            fprintf(stderr, "Unrecognized score encoding: %s\n", value);
+            return JANUS_PARSE_ERROR;
+        }
+    } else if (strcmp(option, "-mask_encoding") == 0) {
+        if      (strcmp(value, "byte") == 0)    *mask = JANUS_MASK_BYTE;
+        else if (strcmp(value, "packed2") == 0) *mask = JANUS_MASK_PACKED2;
+        else {
+            fprintf(stderr, "Unrecognized mask encoding: %s\n", value);
+            return JANUS_PARSE_ERROR;
+        }
+    } else {
+        return JANUS_PARSE_ERROR;
+    }
+    return JANUS_SUCCESS;
+}
+
+// IEEE 754 binary16 conversions, rounding to nearest even
+static unsigned short _janus_float_to_half(float value)
+{
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const unsigned short sign = (bits >> 16) & 0x8000;
+    const int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+    unsigned int mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7c00;
+
+    int shift = 13;
+    unsigned int half = (unsigned int)(exponent << 10);
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        half = 0;
+    }
+    half |= mantissa >> shift;
+    const unsigned int remainder = mantissa & ((1u << shift) - 1);
+    const unsigned int halfway = 1u << (shift - 1);
+    if ((remainder > halfway) || ((remainder == halfway) && (half & 1)))
+        half++; // May carry into the exponent, which is still correct
+    return sign | (unsigned short)half;
+}
+
+// Infinities are decoded as +/-FLT_MAX, the convention for scores that were not computed
+static float _janus_half_to_float(unsigned short half)
+{
+    const float sign = (half & 0x8000) ? -1.f : 1.f;
+    const int exponent = (half >> 10) & 0x1f;
+    const int mantissa = half & 0x3ff;
+    if (exponent == 0)
+        return sign * ldexp(float(mantissa), -24);
+    if (exponent == 31)
+        return mantissa ? numeric_limits<float>::quiet_NaN() : sign * numeric_limits<float>::max();
+    return sign * ldexp(float(mantissa | 0x400), exponent - 25);
+}
+
+// Encodes count elements, returning the matrix type and any header parameters
+static void _janus_encode_matrix(const void *data, size_t count, int is_mask, string &type, vector<char> &payload)
+{
+    if (is_mask) {
+        const unsigned char *mask = (const unsigned char*)data;
+        if (janus_mask_encoding_ == JANUS_MASK_PACKED2) {
+            type = "P";
+            payload.assign((count + 3) / 4, 0);
+            for (size_t i=0; i<count; i++) {
+                const unsigned char code = (mask[i] == 0xff) ? 2 : ((mask[i] == 0x7f) ? 1 : 0);
+                payload[i / 4] |= code << (2 * (i % 4));
+            }
+        } else {
+            type = "B";
+            payload.assign((const char*)mask, (const char*)mask + count);
+        }
+        return;
+    }
+
+    const float *scores = (const float*)data;
+    if (janus_score_encoding_ == JANUS_SCORES_FLOAT16) {
+        type = "H";
+        payload.resize(count * 2);
+        for (size_t i=0; i<count; i++) {
+            const unsigned short half = _janus_float_to_half(scores[i]);
+            memcpy(&payload[i * 2], &half, 2);
+        }
+    } else if (janus_score_encoding_ == JANUS_SCORES_QUANTIZED8) {
+        // Scores that were not computed are excluded from the range
+        float lower = numeric_limits<float>::max(), upper = -numeric_limits<float>::max();
+        for (size_t i=0; i<count; i++)
+            if ((scores[i] > -numeric_limits<float>::max()) && (scores[i] < numeric_limits<float>::max())) {
+                lower = min(lower, scores[i]);
+                upper = max(upper, scores[i]);
+            }
+        if (lower > upper)
+            lower = upper = 0;
+        const float scale = (upper > lower) ? (upper - lower) / 254 : 1;
+
+        ostringstream parameters;
+        parameters.precision(numeric_limits<float>::digits10 + 3);
+        parameters << "Q " << lower << ' ' << scale;
+        type = parameters.str();
+
+        payload.resize(count);
+        for (size_t i=0; i<count; i++) {
+            if (!(scores[i] > -numeric_limits<float>::max())) {
+                payload[i] = 0;
+                continue;
+            }
+            const double code = floor((min(scores[i], upper) - lower) / scale + 0.5);
+            payload[i] = (char)(unsigned char)(1 + min(max(code, 0.0), 254.0));
+        }
+    } else {
+        type = "F";
+        payload.assign((const char*)scores, (const char*)(scores + count));
+    }
+}
+
+// Writes the matrix, or its strictly upper triangle packed row-major
+static janus_error _janus_write_matrix(const void *data, int rows, int columns, int is_mask, bool triangular, bool encode, janus_metadata target, janus_metadata query, janus_matrix matrix)
+{
+    const size_t element = is_mask ? 1 : 4;
+    const char *elements = (const char*)data;
+    size_t count = size_t(rows) * columns;
+
+    vector<char> upper;
+    MemoryCharge memory(janus_matrix_memory);
+    if (triangular) {
+        for (int i=0; i+1<rows; i++)
+            upper.insert(upper.end(), elements + (size_t(i) * columns + i + 1) * element, elements + (size_t(i) * columns + columns) * element);
+        count = upper.size() / element;
+        elements = upper.empty() ? NULL : &upper[0];
+    }
+
+    string type = is_mask ? "B" : "F";
+    vector<char> payload;
+    const bool encoded = encode && ((is_mask && (janus_mask_encoding_ != JANUS_MASK_BYTE)) || (!is_mask && (janus_score_encoding_ != JANUS_SCORES_FLOAT32)));
+    if (encoded) {
+        _janus_encode_matrix(elements, count, is_mask, type, payload);
+        elements = payload.empty() ? NULL : &payload[0];
+    }
+    memory.resize(upper.size() + payload.size());
+
+    // Encoding parameters follow the dimensions
+    const size_t space = type.find(' ');
+    ofstream stream(matrix, ios::out | ios::binary);
+    stream << "S2\n"
+           << target << '\n'
+           << query << '\n'
+           << 'M' << type.substr(0, space) << (triangular ? "T" : "") << ' '
+           << rows << ' ' << columns << ' ';
+    if (space != string::npos)
+        stream << type.substr(space + 1) << ' ';
+    int endian = 0x12345678;
+    stream.write((const char*)&endian, 4);
+    stream << '\n';
+    stream.write(elements, encoded ? payload.size() : count * element);
+    if (!stream)
+        return JANUS_WRITE_ERROR;
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_write_matrix(void *data, int rows, int columns, int is_mask, janus_metadata target, janus_metadata query, janus_matrix matrix)
+{
+    return _janus_write_matrix(data, rows, columns, is_mask, false, true, target, query, matrix);
+}
+
+static janus_error _janus_read_matrix(janus_matrix matrix, string &target, string &query, vector<char> &data, int *rows, int *columns, int *is_mask)
+{
+    ifstream stream(matrix, ios::in | ios::binary);
+    if (!stream.is_open())
+        return JANUS_OPEN_ERROR;
+
+    string magic, type;
+    getline(stream, magic);
+    getline(stream, target);
+    getline(stream, query);
+    stream >> type >> *rows >> *columns;
+    if (!stream || (magic != "S2") || (type.size() < 2) || (type[0] != 'M') || (*rows < 0) || (*columns < 0))
+        return JANUS_PARSE_ERROR;
+
+    const char encoding = type[1];
+    const bool triangular = (type.size() == 3) && (type[2] == 'T');
+    if ((type.size() > 3) || ((type.size() == 3) && !triangular) || (triangular && (*rows != *columns)))
+        return JANUS_PARSE_ERROR;
+    float offset = 0, scale = 1;
+    if (encoding == 'Q')
+        stream >> offset >> scale;
+    stream.get();
+    int endian;
+    stream.read((char*)&endian, 4);
+    stream.get();
+    if (!stream || (endian != 0x12345678))
+        return JANUS_PARSE_ERROR;
+
+    // Elements present in the file
+    const size_t count = triangular ? size_t(*rows) * (*rows - 1) / 2 : size_t(*rows) * (*columns);
+    size_t bytes;
+    switch (encoding) {
+      case 'F': bytes = count * 4; break;
+      case 'H': bytes = count * 2; break;
+      case 'Q': case 'B': bytes = count; break;
+      case 'P': bytes = (count + 3) / 4; break;
+      default: return JANUS_PARSE_ERROR;
+    }
+    vector<char> payload(bytes);
+    if (bytes > 0)
+        stream.read(&payload[0], bytes);
+    if (!stream)
+        return JANUS_READ_ERROR;
+
+    *is_mask = (encoding == 'B') || (encoding == 'P');
+    const size_t element = *is_mask ? 1 : 4;
+    const MemoryCharge memory(janus_matrix_memory, bytes + (count + (triangular ? size_t(*rows) * *rows : 0)) * element);
+    vector<char> decoded(count * element);
+    for (size_t i=0; i<count; i++) {
+        if (encoding == 'F') {
+            memcpy(&decoded[i * 4], &payload[i * 4], 4);
+        } else if (encoding == 'H') {
+            unsigned short half;
+            memcpy(&half, &payload[i * 2], 2);
+            const float value = _janus_half_to_float(half);
+            memcpy(&decoded[i * 4], &value, 4);
+        } else if (encoding == 'Q') {
+            const unsigned char code = payload[i];
+            const float value = code ? offset + (code - 1) * scale : -numeric_limits<float>::max();
+            memcpy(&decoded[i * 4], &value, 4);
+        } else if (encoding == 'B') {
+            decoded[i] = payload[i];
+        } else {
+            static const unsigned char codes[4] = { 0x00, 0x7f, 0xff, 0x00 };
+            decoded[i] = codes[(payload[i / 4] >> (2 * (i % 4))) & 3];
+        }
+    }
+
+    if (!triangular) {
+        data.swap(decoded);
+        return JANUS_SUCCESS;
+    }
+
+    // Mirror the upper triangle, excluding the diagonal as in symmetric verification
+    const int size = *rows;
+    data.resize(size_t(size) * size * element);
+    const float excluded = -numeric_limits<float>::max();
+    size_t k = 0;
+    for (int i=0; i<size; i++) {
+        if (*is_mask) data[size_t(i) * size + i] = 0;
+        else          memcpy(&data[(size_t(i) * size + i) * 4], &excluded, 4);
+        for (int j=i+1; j<size; j++, k++) {
+            memcpy(&data[(size_t(i) * size + j) * element], &decoded[k * element], element);
+            memcpy(&data[(size_t(j) * size + i) * element], &decoded[k * element], element);
+        }
+    }
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_read_matrix(janus_matrix matrix, void **data, int *rows, int *columns, int *is_mask)
+{
+    string target, query;
+    vector<char> buffer;
+    JANUS_CHECK(_janus_read_matrix(matrix, target, query, buffer, rows, columns, is_mask))
+    char *result = new char[max(buffer.size(), size_t(1))];
+    if (!buffer.empty())
+        memcpy(result, &buffer[0], buffer.size());
+    *data = result;
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_free_matrix(void *data)
+{
+    delete[] (char*)data;
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_decode_matrix(janus_matrix encoded, janus_matrix decoded)
+{
+    string target, query;
+    vector<char> data;
+    int rows, columns, is_mask;
+    JANUS_CHECK(_janus_read_matrix(encoded, target, query, data, &rows, &columns, &is_mask))
+    return _janus_write_matrix(data.empty() ? NULL : &data[0], rows, columns, is_mask, false, false, target.c_str(), query.c_str(), decoded);
+}
+
+janus_data* janus_read_templates(const char *template_file, size_t *bytes)
+{
+    janus::Buffer templates;
+    if (templates.read(template_file) != JANUS_SUCCESS) {
+        *bytes = 0;
+        return NULL;
+    }
+    *bytes = templates.size();
+    return templates.release();
+}
+
+// Random access to the records of a file written by janus_create_templates
+struct TemplateFile
+{
+    ifstream file;
+    map<janus_template_id, pair<size_t, size_t> > records; // Template -> (data offset, bytes)
+
+    janus_error open(const char *template_file)
+    {
+        file.open(template_file, ios::in | ios::binary | ios::ate);
+        if (!file.is_open())
+            return JANUS_OPEN_ERROR;
+        const size_t size = file.tellg();
+
+        size_t offset = 0;
+        while (offset < size) {
+            janus_template_id templateID;
+            size_t bytes;
+            file.seekg(offset);
+            file.read((char*)&templateID, sizeof(templateID));
+            file.read((char*)&bytes, sizeof(bytes));
+            offset += sizeof(templateID) + sizeof(bytes);
+            if (!file || (offset + bytes > size))
+                return JANUS_READ_ERROR;
+            records[templateID] = make_pair(offset, bytes);
+            offset += bytes;
+        }
+        return JANUS_SUCCESS;
+    }
+
+    // Returns false if the template is not in the file
+    bool read(janus_template_id templateID, vector<janus_data> &buffer, size_t *bytes)
+    {
+        map<janus_template_id, pair<size_t, size_t> >::const_iterator record = records.find(templateID);
+        if (record == records.end())
+            return false;
+        *bytes = record->second.second;
+        buffer.resize(max(*bytes, size_t(1)));
+        file.clear();
+        file.seekg(record->second.first);
+        file.read((char*)_janus_buffer(buffer), *bytes);
+        return !file.fail();
+    }
+};
+
+// Incremental galleries, see janus_gallery_index
+struct GalleryIndex
+{
+    string path;
+    vector<string> segments; // Oldest first
+    map<janus_template_id, size_t> tombstones; // Template -> number of preceding segments it applies to
+    vector<int> segmentTombstones; // Segment -> tombstones which may hide its templates
+    int nextSegmentID;
+
+    GalleryIndex()
+        : nextSegmentID(0) {}
+
+    janus_error read(janus_gallery_index index)
+    {
+        path = index;
+        segments.clear();
+        tombstones.clear();
+        segmentTombstones.clear();
+        nextSegmentID = 0;
+
+        ifstream file(index);
+        string line;
+        while (getline(file, line)) {
+            istringstream entry(line);
+            string type, value, segment;
+            if (!(entry >> type >> value))
+                continue;
+            if (type == "segment") {
+                segments.push_back(value);
+                segmentTombstones.push_back(0);
+                nextSegmentID = max(nextSegmentID, atoi(value.substr(value.find_last_of('.') + 1).c_str()) + 1);
+            } else if (type == "tombstone") {
+                tombstones[atoi(value.c_str())] = segments.size();
+                // Tombstones without the segment holding the template may hide it in any preceding segment
+                if (entry >> segment) {
+                    const vector<string>::const_iterator holder = find(segments.begin(), segments.end(), segment);
+                    if (holder != segments.end())
+                        segmentTombstones[holder - segments.begin()]++;
+                } else {
+                    for (size_t i=0; i<segments.size(); i++)
+                        segmentTombstones[i]++;
+                }
+            } else {
+                return JANUS_PARSE_ERROR;
+            }
+        }
+        return JANUS_SUCCESS;
+    }
+
+    // Segment names are stored relative to the index file
+    string file(const string &segment, const char *extension) const
+    {
+        const size_t slash = path.find_last_of("/\\");
+        const string directory = (slash == string::npos) ? string() : path.substr(0, slash + 1);
+        return directory + segment + extension;
+    }
+
+    string newSegment() const
+    {
+        const size_t slash = path.find_last_of("/\\");
+        const string name = (slash == string::npos) ? path : path.substr(slash + 1);
+        stringstream segment;
+        segment << name.substr(0, name.find_last_of('.')) << '.' << nextSegmentID;
+        return segment.str();
+    }
+
+    bool isLive(janus_template_id templateID, size_t segment) const
+    {
+        map<janus_template_id, size_t>::const_iterator tombstone = tombstones.find(templateID);
+        return (tombstone == tombstones.end()) || (tombstone->second <= segment);
+    }
+
+    // Finds the segment holding each live template in templateIDs, templates
+    // not in the gallery are left out. Only the record headers are read.
+    janus_error locate(const vector<janus_template_id> &templateIDs, vector<pair<janus_template_id, string> > &located) const
+    {
+        const set<janus_template_id> wanted(templateIDs.begin(), templateIDs.end());
+        for (size_t i=0; i<segments.size(); i++) {
+            TemplateFile templates;
+            JANUS_CHECK(templates.open(file(segments[i], ".templates").c_str()))
+            for (map<janus_template_id, pair<size_t, size_t> >::const_iterator record = templates.records.begin(); record != templates.records.end(); record++)
+                if ((wanted.find(record->first) != wanted.end()) && isLive(record->first, i))
+                    located.push_back(make_pair(record->first, segments[i]));
+        }
+        return JANUS_SUCCESS;
+    }
+
+    // Journal entries are appended only after the files they refer to are complete
+    janus_error append(const vector<pair<janus_template_id, string> > &removed, const string &segment) const
+    {
+        ofstream file(path.c_str(), ios::out | ios::app);
+        for (size_t i=0; i<removed.size(); i++)
+            file << "tombstone " << removed[i].first << ' ' << removed[i].second << '\n';
+        if (!segment.empty())
+            file << "segment " << segment << '\n';
+        return file.good() ? JANUS_SUCCESS : JANUS_WRITE_ERROR;
+    }
+};
+
+static janus_error _janus_write_flat_gallery(const string &flat_gallery_file, janus_gallery gallery, size_t gallery_size)
+{
+    const janus_error write_error = janus_write_flat_gallery(flat_gallery_file.c_str(), gallery);
+    if (write_error != JANUS_NOT_IMPLEMENTED)
+        return write_error;
+
+    vector<janus_data> flat_gallery(gallery_size * janus_max_template_size());
+    const MemoryCharge memory(janus_gallery_memory, flat_gallery.size());
+    size_t bytes;
+    JANUS_CHECK(janus_flatten_gallery(gallery, _janus_buffer(flat_gallery), &bytes))
+    ofstream file(flat_gallery_file.c_str(), ios::out | ios::binary | ios::trunc);
+    file.write((const char*)_janus_buffer(flat_gallery), bytes);
+    return file.good() ? JANUS_SUCCESS : JANUS_WRITE_ERROR;
+}
+
+static void _janus_write_template(ofstream &file, janus_template_id templateID, const janus_data *flat_template, size_t bytes)
+{
+    file.write((const char*)&templateID, sizeof(templateID));
+    file.write((const char*)&bytes, sizeof(bytes));
+    file.write((const char*)flat_template, bytes);
+}
+
+// Enroll the templates of metadata into the files of a new segment
+static janus_error _janus_write_segment(const char *data_path, janus_metadata metadata, const GalleryIndex &galleryIndex, const string &segment, int verbose, vector<janus_template_id> &templateIDs)
+{
+    janus::Gallery gallery;
+    JANUS_CHECK(janus_allocate_gallery(gallery.put()))
+    ofstream templates(galleryIndex.file(segment, ".templates").c_str(), ios::out | ios::binary | ios::trunc);
+    vector<janus_data> flat_template_;
+    MemoryCharge flat_template_memory(janus_flat_template_memory);
+
+    TemplateIterator ti(metadata, true);
+    TemplateData templateData = ti.next();
+    while (!templateData.templateIDs.empty()) {
+        janus::Template template_;
+        janus_template_id templateID;
+        size_t bytes;
+        janus_error enroll_error = TemplateIterator::create(data_path, templateData, template_.put(), &templateID, verbose);
+        if (enroll_error == JANUS_SUCCESS)
+            enroll_error = _janus_flatten_template(template_.get(), flat_template_, &bytes);
+        flat_template_memory.resize(flat_template_.capacity());
+
+        if (enroll_error == JANUS_SUCCESS) {
+            JANUS_CHECK(janus_enroll(template_.get(), templateID, gallery.get()))
+            _janus_write_template(templates, templateID, _janus_buffer(flat_template_), bytes);
+            templateIDs.push_back(templateID);
+        } else {
+            _janus_skip_template(templateData.templateIDs[0], enroll_error);
+        }
+        templateData = ti.next();
+    }
+    templates.close();
+    if (!templates)
+        return JANUS_WRITE_ERROR;
+
+    return _janus_write_flat_gallery(galleryIndex.file(segment, ".gal"), gallery.get(), templateIDs.size());
+}
+
+janus_error janus_append_gallery(const char *data_path, janus_metadata metadata, janus_gallery_index index, int verbose)
+{
+    StageMemory stage(janus_enrollment_peak_rss);
+    GalleryIndex galleryIndex;
+    JANUS_CHECK(galleryIndex.read(index))
+    const string segment = galleryIndex.newSegment();
+
+    // A segment that is not journaled is never read, remove its files
+    vector<janus_template_id> templateIDs;
+    const janus_error segment_error = _janus_write_segment(data_path, metadata, galleryIndex, segment, verbose, templateIDs);
+    if (segment_error != JANUS_SUCCESS) {
+        std::remove(galleryIndex.file(segment, ".gal").c_str());
+        std::remove(galleryIndex.file(segment, ".templates").c_str());
+        return segment_error;
+    }
+
+    // Re-enrolled templates replace their versions in earlier segments
+    vector<pair<janus_template_id, string> > replaced;
+    JANUS_CHECK(galleryIndex.locate(templateIDs, replaced))
+    return galleryIndex.append(replaced, segment);
+}
+
+janus_error janus_remove_from_gallery(janus_metadata metadata, janus_gallery_index index)
+{
+    GalleryIndex galleryIndex;
+    JANUS_CHECK(galleryIndex.read(index))
+
+    TemplateData templateData = TemplateIterator(metadata, false);
+    vector<pair<janus_template_id, string> > removed;
+    JANUS_CHECK(galleryIndex.locate(templateData.templateIDs, removed))
+    return galleryIndex.append(removed, string());
+}
+
+janus_error janus_compact_gallery(janus_gallery_index index)
+{
+    StageMemory stage(janus_enrollment_peak_rss);
+    GalleryIndex galleryIndex;
+    JANUS_CHECK(galleryIndex.read(index))
+    const string segment = galleryIndex.newSegment();
+
+    janus::Gallery gallery;
+    JANUS_CHECK(janus_allocate_gallery(gallery.put()))
+    ofstream templates(galleryIndex.file(segment, ".templates").c_str(), ios::out | ios::binary | ios::trunc);
+    size_t gallery_size = 0;
+
+    for (size_t i=0; i<galleryIndex.segments.size(); i++) {
+        janus::Buffer segment_templates;
+        JANUS_CHECK(segment_templates.read(galleryIndex.file(galleryIndex.segments[i], ".templates").c_str()))
+        const MemoryCharge flat_template_memory(janus_flat_template_memory, segment_templates.size());
+        for (const janus::TemplateRecord &record : janus::TemplateRecords(segment_templates)) {
+            if (!galleryIndex.isLive(record.template_id, i))
+                continue;
+
+            // Rebuild the template from its flat representation for enrollment
+            janus::Template template_;
+            JANUS_CHECK(janus_allocate_template(template_.put()))
+            JANUS_CHECK(janus_merge_flat_template(record.flat_template.data, record.flat_template.bytes, template_.get()))
+            JANUS_CHECK(janus_enroll(template_.get(), record.template_id, gallery.get()))
+            _janus_write_template(templates, record.template_id, record.flat_template.data, record.flat_template.bytes);
+            gallery_size++;
+        }
+    }
+    templates.close();
+    if (!templates)
+        return JANUS_WRITE_ERROR;
+
+    JANUS_CHECK(_janus_write_flat_gallery(galleryIndex.file(segment, ".gal"), gallery.get(), gallery_size))
+    gallery.reset();
+
+    // Atomically replace the index, then remove the superseded segments
+    const string compacted = galleryIndex.path + ".tmp";
+    {
+        ofstream file(compacted.c_str(), ios::out | ios::trunc);
+        file << "segment " << segment << '\n';
+        if (!file)
+            return JANUS_WRITE_ERROR;
+    }
+    if (std::rename(compacted.c_str(), index) != 0)
+        return JANUS_WRITE_ERROR;
+
+    for (size_t i=0; i<galleryIndex.segments.size(); i++) {
+        std::remove(galleryIndex.file(galleryIndex.segments[i], ".gal").c_str());
+        std::remove(galleryIndex.file(galleryIndex.segments[i], ".templates").c_str());
+    }
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_create_cascade_gallery(const char *data_path, janus_metadata metadata, const char *gallery_file, size_t summary_faces, int verbose)
+{
+    StageMemory stage(janus_enrollment_peak_rss);
+    janus::Gallery gallery, summaries;
+    JANUS_CHECK(janus_allocate_gallery(gallery.put()))
+    JANUS_CHECK(janus_allocate_gallery(summaries.put()))
+    ofstream templates((string(gallery_file) + ".templates").c_str(), ios::out | ios::binary | ios::trunc);
+    vector<janus_data> flat_template_;
+    MemoryCharge flat_template_memory(janus_flat_template_memory);
+    size_t gallery_size = 0;
+
+    JANUS_CHECK(_janus_enroll_templates(data_path, metadata, verbose, [&](janus_template template_, janus_template_id templateID) -> janus_error {
+        JANUS_CHECK(janus_enroll(template_, templateID, gallery.get()))
+        size_t bytes;
+        JANUS_CHECK(_janus_flatten_template(template_, flat_template_, &bytes))
+        flat_template_memory.resize(flat_template_.capacity());
+        _janus_write_template(templates, templateID, _janus_buffer(flat_template_), bytes);
+
+        // The summary is the same template reduced by janus_compact_template
+        const janus_error compact_error = janus_compact_template(template_, summary_faces, 0);
+        if ((compact_error != JANUS_SUCCESS) && (compact_error != JANUS_NOT_IMPLEMENTED))
+            return compact_error;
+        JANUS_CHECK(janus_enroll(template_, templateID, summaries.get()))
+        gallery_size++;
+        return JANUS_SUCCESS;
+    }))
+    templates.close();
+    if (!templates)
+        return JANUS_WRITE_ERROR;
+
+    JANUS_CHECK(_janus_write_flat_gallery(gallery_file, gallery.get(), gallery_size))
+    return _janus_write_flat_gallery(string(gallery_file) + ".summary", summaries.get(), gallery_size);
+}
+
+static bool _janus_greater_score(const pair<float,janus_template_id> &left, const pair<float,janus_template_id> &right)
+{
+    return left.first > right.first;
+}
+
+// Merged search over one or more flat gallery segments
+struct SearchTarget
+{
+    vector<janus::FlatGalleryView> segments;
+    vector<janus::Buffer> ownedSegments;
+    vector<int> segmentTombstones;
+    GalleryIndex index;
+    MemoryCharge memory;
+
+    SearchTarget(janus_flat_gallery target, size_t target_bytes)
+        : memory(janus_gallery_memory, target_bytes)
+    {
+        segments.push_back(janus::FlatGalleryView(target, target_bytes));
+        segmentTombstones.push_back(0);
+    }
+
+    SearchTarget()
+        : memory(janus_gallery_memory) {}
+
+    janus_error open(janus_gallery_index gallery_index)
+    {
+        JANUS_CHECK(index.read(gallery_index))
+        for (size_t i=0; i<index.segments.size(); i++) {
+            janus::Buffer segment;
+            JANUS_CHECK(segment.read(index.file(index.segments[i], ".gal").c_str()))
+            segments.push_back(janus::FlatGalleryView(segment));
+            memory.resize(memory.bytes + segment.size());
+            ownedSegments.push_back(std::move(segment));
+            segmentTombstones.push_back(index.segmentTombstones[i]);
+        }
+        return JANUS_SUCCESS;
+    }
+
+    janus_error search(const janus_flat_template query, size_t query_bytes, int num_requested_returns, janus_template_id *template_ids, float *similarities, int *num_actual_returns) const
+    {
+        if ((segments.size() == 1) && (segmentTombstones[0] == 0))
+            return janus_search(query, query_bytes, segments[0].data, segments[0].bytes, num_requested_returns, template_ids, similarities, num_actual_returns);
+
+        // Over-request from each segment so tombstoned results can be dropped
+        vector<pair<float,janus_template_id> > results;
+        for (size_t i=0; i<segments.size(); i++) {
+            const int requested = num_requested_returns + segmentTombstones[i];
+            vector<janus_template_id> ids(requested);
+            vector<float> scores(requested);
+            int actual;
+            JANUS_CHECK(janus_search(query, query_bytes, segments[i].data, segments[i].bytes, requested, &ids[0], &scores[0], &actual))
+            for (int j=0; j<min(actual, requested); j++)
+                if (index.isLive(ids[j], i))
+                    results.push_back(make_pair(scores[j], ids[j]));
+        }
+
+        stable_sort(results.begin(), results.end(), _janus_greater_score);
+        *num_actual_returns = min(int(results.size()), num_requested_returns);
+        for (int i=0; i<*num_actual_returns; i++) {
+            similarities[i] = results[i].first;
+            template_ids[i] = results[i].second;
+        }
+        return JANUS_SUCCESS;
+    }
+};
+
+// Two-stage search over a gallery written by janus_create_cascade_gallery
+struct CascadeTarget
+{
+    janus::Buffer gallery, summaries, templates;
+    map<janus_template_id, janus::FlatTemplateView> exact;
+    int survivors;
+    bool agreement;
+    MemoryCharge galleryMemory, templateMemory;
+
+    CascadeTarget()
+        : survivors(0), agreement(false), galleryMemory(janus_gallery_memory), templateMemory(janus_flat_template_memory) {}
+
+    janus_error open(const char *gallery_file, int num_survivors, bool measure_agreement)
+    {
+        survivors = num_survivors;
+        agreement = measure_agreement;
+        JANUS_CHECK(summaries.read((string(gallery_file) + ".summary").c_str()))
+        JANUS_CHECK(templates.read((string(gallery_file) + ".templates").c_str()))
+        if (agreement)
+            JANUS_CHECK(gallery.read(gallery_file))
+        galleryMemory.resize(summaries.size() + gallery.size());
+        templateMemory.resize(templates.size());
+
+        for (const janus::TemplateRecord &record : janus::TemplateRecords(templates))
+            exact[record.template_id] = record.flat_template;
+        return JANUS_SUCCESS;
+    }
+
+    janus_error search(const janus_flat_template query, size_t query_bytes, int num_requested_returns, janus_template_id *template_ids, float *similarities, int *num_actual_returns) const
+    {
+        // Screen every template by its summary
+        const int requested = max(survivors, num_requested_returns);
+        vector<janus_template_id> candidates(requested);
+        vector<float> scores(requested);
+        int num_candidates;
+        const Instrumentation::Timestamp screen_start = Instrumentation::now();
+        JANUS_CHECK(janus_search(query, query_bytes, summaries.data(), summaries.size(), requested, &candidates[0], &scores[0], &num_candidates))
+        Instrumentation::record(janus_cascade_screen_samples, screen_start);
+
+        // Rescore the survivors exactly
+        const Instrumentation::Timestamp rescore_start = Instrumentation::now();
+        num_candidates = min(num_candidates, requested);
+        vector<janus::FlatTemplateView> survivingTemplates;
+        for (int i=0; i<num_candidates; i++) {
+            map<janus_template_id, janus::FlatTemplateView>::const_iterator candidate = exact.find(candidates[i]);
+            if (candidate == exact.end())
+                return JANUS_MISSING_TEMPLATE_ID;
+            survivingTemplates.push_back(candidate->second);
+        }
+        JANUS_CHECK(rescore(query, query_bytes, candidates, survivingTemplates, num_requested_returns, template_ids, similarities, num_actual_returns))
+        Instrumentation::record(janus_cascade_rescore_samples, rescore_start);
+        janus_cascade_rescored_count += num_candidates;
+
+        if (agreement)
+            JANUS_CHECK(compare(query, query_bytes, num_requested_returns, template_ids, *num_actual_returns))
+        return JANUS_SUCCESS;
+    }
+
+    // Searches a gallery of just the survivors, so the query is unflattened
+    // once rather than by a janus_verify per survivor. Implementations that
+    // can't merge flat templates are rescored with janus_verify instead.
+    static janus_error rescore(const janus_flat_template query, size_t query_bytes, const vector<janus_template_id> &candidates, const vector<janus::FlatTemplateView> &survivingTemplates, int num_requested_returns, janus_template_id *template_ids, float *similarities, int *num_actual_returns)
+    {
+        *num_actual_returns = 0;
+        if (survivingTemplates.empty())
+            return JANUS_SUCCESS;
+
+        janus::Gallery gallery;
+        JANUS_CHECK(janus_allocate_gallery(gallery.put()))
+        janus_error merge_error = JANUS_SUCCESS;
+        for (size_t i=0; (i<survivingTemplates.size()) && (merge_error == JANUS_SUCCESS); i++) {
+            janus::Template template_;
+            JANUS_CHECK(janus_allocate_template(template_.put()))
+            merge_error = janus_merge_flat_template(survivingTemplates[i].data, survivingTemplates[i].bytes, template_.get());
+            if (merge_error == JANUS_SUCCESS)
+                merge_error = janus_enroll(template_.get(), candidates[i], gallery.get());
+        }
+
+        if (merge_error == JANUS_SUCCESS) {
+            janus::Buffer flat_gallery(survivingTemplates.size() * janus_max_template_size());
+            size_t bytes;
+            JANUS_CHECK(janus_flatten_gallery(gallery.get(), flat_gallery.data(), &bytes))
+            return janus_search(query, query_bytes, flat_gallery.data(), bytes, num_requested_returns, template_ids, similarities, num_actual_returns);
+        } else if (merge_error != JANUS_NOT_IMPLEMENTED) {
+            return merge_error;
+        }
+
+        vector<pair<float,janus_template_id> > results;
+        for (size_t i=0; i<survivingTemplates.size(); i++) {
+            float similarity;
+            JANUS_CHECK(janus_verify(query, query_bytes, survivingTemplates[i].data, survivingTemplates[i].bytes, &similarity))
+            results.push_back(make_pair(similarity, candidates[i]));
+        }
+
+        stable_sort(results.begin(), results.end(), _janus_greater_score);
+        *num_actual_returns = min(int(results.size()), num_requested_returns);
+        for (int i=0; i<*num_actual_returns; i++) {
+            similarities[i] = results[i].first;
+            template_ids[i] = results[i].second;
+        }
+        return JANUS_SUCCESS;
+    }
+
+    // Counts the results shared with exhaustive search
+    janus_error compare(const janus_flat_template query, size_t query_bytes, int num_requested_returns, const janus_template_id *template_ids, int num_actual_returns) const
+    {
+        vector<janus_template_id> expected(num_requested_returns);
+        vector<float> scores(num_requested_returns);
+        int num_expected;
+        JANUS_CHECK(janus_search(query, query_bytes, gallery.data(), gallery.size(), num_requested_returns, &expected[0], &scores[0], &num_expected))
+        num_expected = min(num_expected, num_requested_returns);
+
+        janus_cascade_compared_count++;
+        if ((num_expected == 0) || ((num_actual_returns > 0) && (template_ids[0] == expected[0])))
+            janus_cascade_rank1_agreement_count++;
+        const set<janus_template_id> returned(template_ids, template_ids + num_actual_returns);
+        for (int i=0; i<num_expected; i++)
+            if (returned.find(expected[i]) != returned.end())
+                janus_cascade_rankk_agreement_count++;
+        janus_cascade_rankk_expected_count += num_expected;
+        return JANUS_SUCCESS;
+    }
+};
+
+// Online evaluation results file, see janus_set_online_evaluation
+static string janus_online_evaluation;
+
+janus_error janus_set_online_evaluation(const char *results)
+{
+    janus_online_evaluation = results ? results : "";
+    return JANUS_SUCCESS;
+}
+
+// Accumulates ROC, DET and CMC statistics as scores are computed
+struct Evaluation
+{
+    // Scores are binned by the leading bits of their order-preserving integer
+    // representation, a fixed size histogram with a relative resolution of
+    // 2^-11 over the whole float range
+    static const int bin_shift = 12;
+    vector<size_t> genuine, impostor;
+    vector<size_t> ranks; // Searches by rank of their first genuine match, 0 for not found
+    size_t searches; // Searches with a genuine match in the target
+
+    Evaluation()
+        : genuine(size_t(1) << (32 - bin_shift)), impostor(size_t(1) << (32 - bin_shift)), searches(0) {}
+
+    static size_t bin(float score)
+    {
+        unsigned int bits;
+        memcpy(&bits, &score, sizeof(bits));
+        bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+        return bits >> bin_shift;
+    }
+
+    void addScore(float score, unsigned char truth)
+    {
+        if      (truth == 0xff) genuine[bin(score)]++;
+        else if (truth == 0x7f) impostor[bin(score)]++;
+    }
+
+    void addRank(size_t rank)
+    {
+        if (rank >= ranks.size())
+            ranks.resize(rank + 1, 0);
+        ranks[rank]++;
+        searches++;
+    }
+
+    // Scores in columns before roc_begin are only used for the CMC
+    void addRow(const float *scores, const unsigned char *truth, int columns, int roc_begin)
+    {
+        bool mated = false;
+        float best = 0;
+        for (int j=0; j<columns; j++) {
+            if (j >= roc_begin)
+                addScore(scores[j], truth[j]);
+            if ((truth[j] == 0xff) && (!mated || (scores[j] > best))) {
+                best = scores[j];
+                mated = true;
+            }
+        }
+        if (!mated)
+            return;
+
+        size_t rank = 1;
+        for (int j=0; j<columns; j++)
+            if ((truth[j] == 0x7f) && (scores[j] > best))
+                rank++;
+        addRank(rank);
+    }
+
+    // Genuine accept rate at the lowest threshold admitting at most the given false accept rate
+    double acceptRate(double false_accept_rate, size_t num_genuine, size_t num_impostor) const
+    {
+        size_t genuine_above = 0, impostor_above = 0, accepted = 0;
+        for (size_t b=genuine.size(); b-- > 0;) {
+            genuine_above += genuine[b];
+            impostor_above += impostor[b];
+            if (impostor_above > false_accept_rate * num_impostor)
+                break;
+            accepted = genuine_above;
+        }
+        return num_genuine ? double(accepted) / num_genuine : 0;
+    }
+
+    janus_error write(const string &results) const
+    {
+        size_t num_genuine = 0, num_impostor = 0;
+        for (size_t b=0; b<genuine.size(); b++) {
+            num_genuine += genuine[b];
+            num_impostor += impostor[b];
+        }
+
+        ofstream file(results.c_str());
+        if (!file.is_open())
+            return JANUS_OPEN_ERROR;
+        file << "Plot,X,Y\n"
+             << "Metadata," << num_genuine << ",Genuine\n"
+             << "Metadata," << num_impostor << ",Impostor\n"
+             << "Metadata," << searches << ",Searches\n";
+
+        if ((num_genuine > 0) && (num_impostor > 0)) {
+            // Equal error rate where the false accept rate first reaches the false reject rate
+            size_t genuine_above = 0, impostor_above = 0;
+            for (size_t b=genuine.size(); b-- > 0;) {
+                genuine_above += genuine[b];
+                impostor_above += impostor[b];
+                const double far = double(impostor_above) / num_impostor;
+                const double frr = 1 - double(genuine_above) / num_genuine;
+                if (far >= frr) {
+                    file << "EER,," << (far + frr) / 2 << '\n';
+                    break;
+                }
+            }
+
+            for (int e=-6; e<=-1; e++)
+                file << "TAR@FAR," << pow(10.0, e) << ',' << acceptRate(pow(10.0, e), num_genuine, num_impostor) << '\n';
+            for (int e=-24; e<=0; e++)
+                file << "DET," << pow(10.0, e / 4.0) << ',' << 1 - acceptRate(pow(10.0, e / 4.0), num_genuine, num_impostor) << '\n';
+        }
+
+        size_t retrieved = 0;
+        for (size_t rank=1; rank<ranks.size(); rank++) {
+            retrieved += ranks[rank];
+            file << "CMC," << rank << ',' << double(retrieved) / searches << '\n';
+        }
+
+        if (!file)
+            return JANUS_WRITE_ERROR;
+        return JANUS_SUCCESS;
+    }
+};
+
+template <typename Target>
+static janus_error _janus_evaluate_search(const Target &target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int num_requested_returns)
+{
+    StageMemory stage(janus_search_peak_rss);
+    TemplateData targetMetadata = TemplateIterator(target_metadata, false);
+    TemplateData queryMetadata = TemplateIterator(query_metadata, false);
+    size_t query_size = queryMetadata.templateIDs.size();
+    const bool online = !janus_online_evaluation.empty();
+    Evaluation evaluation;
+    set<int> targetSubjects;
+    if (online)
+        for (map<janus_template_id,int>::const_iterator it = targetMetadata.subjectIDLUT.begin(); it != targetMetadata.subjectIDLUT.end(); ++it)
+            targetSubjects.insert(it->second);
+    vector<float> similarity_matrix;
+    vector<unsigned char> truth;
+    similarity_matrix.reserve(query_size * num_requested_returns);
+    truth.reserve(query_size * num_requested_returns);
+    MemoryCharge matrix_memory(janus_matrix_memory, similarity_matrix.capacity() * sizeof(float) + truth.capacity());
+
+    // Read in query template file
+    janus::Buffer query_templates;
+    JANUS_CHECK(query_templates.read(query))
+    const MemoryCharge flat_template_memory(janus_flat_template_memory, query_templates.size());
+
+    vector<janus_template_id> template_ids(num_requested_returns);
+    vector<float> similarities(num_requested_returns);
+    int num_queries = 0;
+    for (const janus::TemplateRecord &record : janus::TemplateRecords(query_templates)) {
+        const janus_template_id query_template_id = record.template_id;
+        int num_actual_returns;
+
+        // A query without faces has no candidates
+        janus_template_summary summary;
+        if (record.flat_template.summary(&summary) && (summary.num_faces == 0)) {
+            num_actual_returns = 0;
+            janus_skipped_search_count++;
+        } else {
+            const Instrumentation::Timestamp start = Instrumentation::now();
+            JANUS_CHECK(target.search(record.flat_template.data, record.flat_template.bytes, num_requested_returns, &template_ids[0], &similarities[0], &num_actual_returns))
+            Instrumentation::record(janus_search_samples, start);
+        }
+        Instrumentation::measure(janus_template_size_samples, record.flat_template.bytes / 1024.0);
+
+        // Write matrix of size num_queries*num_requested returns
+        if (num_actual_returns > num_requested_returns) {
+            std::cerr << "Error: Number of search results returned (" << num_actual_returns << ") is greater than number requested ("
+                      << num_requested_returns << "). Likely memory error triggering undefined behavior. Exiting early with error." << std::endl;
+            return JANUS_UNKNOWN_ERROR;
+        }
+        similarity_matrix.insert(similarity_matrix.end(), similarities.begin(), similarities.begin() + num_actual_returns);
+        similarity_matrix.resize(similarity_matrix.size() + (num_requested_returns - num_actual_returns), -std::numeric_limits<float>::max());
+
+        const int query_subject = queryMetadata.subjectIDLUT[query_template_id];
+        for (int j=0; j<num_requested_returns; j++) {
+            if (j<num_actual_returns) {
+                truth.push_back(query_subject == targetMetadata.subjectIDLUT[template_ids[j]] ? 0xff : 0x7f);
+            } else {
+                truth.push_back(0x00);
+            }
+        }
+
+        // Searches are ranked against every target, so a mate that is not
+        // returned is a miss
+        if (online) {
+            const unsigned char *row_truth = &truth[size_t(num_queries) * num_requested_returns];
+            size_t rank = 0;
+            for (int j=0; j<num_actual_returns; j++) {
+                evaluation.addScore(similarities[j], row_truth[j]);
+                if ((rank == 0) && (row_truth[j] == 0xff))
+                    rank = j + 1;
+            }
+            if (targetSubjects.find(query_subject) != targetSubjects.end())
+                evaluation.addRank(rank);
+        }
+        num_queries++;
+    }
+    matrix_memory.resize(similarity_matrix.capacity() * sizeof(float) + truth.capacity());
+    if (simmat != NULL)
+        JANUS_CHECK(janus_write_matrix(similarity_matrix.empty() ? NULL : &similarity_matrix[0], num_queries, num_requested_returns, false, target_metadata, query_metadata, simmat))
+    if (mask != NULL)
+        JANUS_CHECK(janus_write_matrix(truth.empty() ? NULL : &truth[0], num_queries, num_requested_returns, true, target_metadata, query_metadata, mask))
+    if (online)
+        JANUS_CHECK(evaluation.write(janus_online_evaluation))
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_evaluate_search(janus_flat_gallery target, size_t target_bytes, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int num_requested_returns)
+{
+    return _janus_evaluate_search(SearchTarget(target, target_bytes), query, target_metadata, query_metadata, simmat, mask, num_requested_returns);
+}
+
+janus_error janus_evaluate_incremental_search(janus_gallery_index target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int num_requested_returns)
+{
+    SearchTarget searchTarget;
+    JANUS_CHECK(searchTarget.open(target))
+    return _janus_evaluate_search(searchTarget, query, target_metadata, query_metadata, simmat, mask, num_requested_returns);
+}
+
+janus_error janus_evaluate_cascade_search(const char *target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int num_requested_returns, int num_survivors, int measure_agreement)
+{
+    CascadeTarget cascadeTarget;
+    JANUS_CHECK(cascadeTarget.open(target, num_survivors, measure_agreement != 0))
+    return _janus_evaluate_search(cascadeTarget, query, target_metadata, query_metadata, simmat, mask, num_requested_returns);
+}
+
+// Flat templates within a file written by janus_create_templates
+static vector<janus::TemplateRecord> _janus_index_templates(const janus::Buffer &templates)
+{
+    const janus::TemplateRecords records(templates);
+    return vector<janus::TemplateRecord>(records.begin(), records.end());
+}
+
+// Relative cost of comparisons involving each flat template of the target and
+// query files, in faces. Templates without a summary are estimated from their
+// size at the average bytes per face of the summarized templates in both files.
+// Costs are in bytes when no summarized template has faces, the summarized
+// templates then cost nothing in either unit.
+static void _janus_expected_costs(const vector<janus::TemplateRecord> &targets, const vector<janus::TemplateRecord> &queries, vector<double> &targetCosts, vector<double> &queryCosts)
+{
+    const vector<janus::TemplateRecord> *records[2] = { &targets, &queries };
+    vector<double> *costs[2] = { &targetCosts, &queryCosts };
+    vector<bool> summarized[2];
+    double faces = 0, summarizedBytes = 0;
+    for (int f=0; f<2; f++) {
+        costs[f]->clear();
+        for (size_t i=0; i<records[f]->size(); i++) {
+            const janus::FlatTemplateView &flat_template = (*records[f])[i].flat_template;
+            janus_template_summary summary;
+            summarized[f].push_back(flat_template.summary(&summary));
+            if (summarized[f].back()) {
+                costs[f]->push_back(summary.num_faces);
+                faces += summary.num_faces;
+                summarizedBytes += flat_template.bytes;
+            } else {
+                costs[f]->push_back(double(flat_template.bytes));
+            }
+        }
+    }
+
+    const double bytesPerFace = (faces > 0) ? summarizedBytes / faces : 1;
+    for (int f=0; f<2; f++)
+        for (size_t i=0; i<costs[f]->size(); i++)
+            if (!summarized[f][i])
+                (*costs[f])[i] /= bytesPerFace;
+}
+
+// Content hashes of flat templates, only needed by the score cache
+static vector<uint64_t> _janus_hash_templates(const vector<janus::TemplateRecord> &records)
+{
+    vector<uint64_t> hashes;
+    if (janus_score_cache.enabled())
+        for (size_t i=0; i<records.size(); i++)
+            hashes.push_back(FeatureCache::hash(records[i].flat_template.data, records[i].flat_template.bytes));
+    return hashes;
+}
+
+// Partial matrices are written under a temporary name and renamed into place,
+// so an existing block file is always complete
+static janus_error _janus_write_matrix_block(void *data, int rows, int columns, int row_begin, int row_end, int column_begin, int column_end, int is_mask, bool triangular, janus_metadata target, janus_metadata query, janus_matrix matrix)
+{
+    const string partial = string(matrix) + ".tmp";
+    {
+        ofstream stream(partial.c_str(), ios::out | ios::binary);
+        stream << "S2B\n"
+               << target << '\n'
+               << query << '\n'
+               << 'M' << (is_mask ? 'B' : 'F') << (triangular ? "T " : " ")
+               << rows << ' ' << columns << ' '
+               << row_begin << ' ' << row_end << ' '
+               << column_begin << ' ' << column_end << ' ';
+        int endian = 0x12345678;
+        stream.write((const char*)&endian, 4);
+        stream << '\n';
+        stream.write((const char*)data, size_t(row_end - row_begin) * (column_end - column_begin) * (is_mask ? 1 : 4));
+        if (!stream)
+            return JANUS_WRITE_ERROR;
+    }
+    if (std::rename(partial.c_str(), matrix) != 0)
+        return JANUS_WRITE_ERROR;
+    return JANUS_SUCCESS;
+}
+
+// Defined with the asynchronous API below
+static bool _janus_async_running();
+static janus_error _janus_run_async(const vector<function<janus_error()> > &calls);
+
+// Symmetric verification, see janus_set_symmetric_verify
+static int janus_symmetric_verify = 0;
+static bool janus_symmetric_verify_packed = false;
+
+janus_error janus_set_symmetric_verify(int symmetric, int packed)
+{
+    janus_symmetric_verify = symmetric;
+    janus_symmetric_verify_packed = (packed != 0);
+    return JANUS_SUCCESS;
+}
+
+static janus_error _janus_evaluate_verify(const char *target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int row_begin, int row_end, int column_begin, int column_end, bool block)
+{
+    StageMemory stage(janus_verify_peak_rss);
+    TemplateData targetMetadata = TemplateIterator(target_metadata, false);
+    TemplateData queryMetadata = TemplateIterator(query_metadata, false);
+
+    // Read in query and target template files, once if they are the same file
+    const bool same_templates = (strcmp(target, query) == 0);
+    janus::Buffer target_templates, query_templates;
+    JANUS_CHECK(target_templates.read(target))
+    if (!same_templates)
+        JANUS_CHECK(query_templates.read(query))
+    const MemoryCharge flat_template_memory(janus_flat_template_memory, target_templates.size() + query_templates.size());
+    const vector<janus::TemplateRecord> targets = _janus_index_templates(target_templates);
+    const vector<janus::TemplateRecord> queries = same_templates ? targets : _janus_index_templates(query_templates);
+
+    // Negative or out of range bounds are clamped to the matrix
+    const int num_queries = int(queries.size());
+    const int num_targets = int(targets.size());
+    row_begin = min(max(row_begin, 0), num_queries);
+    row_end = (row_end < 0) ? num_queries : min(max(row_end, row_begin), num_queries);
+    column_begin = min(max(column_begin, 0), num_targets);
+    column_end = (column_end < 0) ? num_targets : min(max(column_end, column_begin), num_targets);
+
+    // In symmetric mode the diagonal is excluded and each unordered pair is compared once
+    const bool symmetric = (janus_symmetric_verify > 0) ||
+                           ((janus_symmetric_verify == 0) && same_templates && (strcmp(target_metadata, query_metadata) == 0));
+    if (symmetric && (num_queries != num_targets)) {
+        fprintf(stderr, "Symmetric verification requires the same templates as query and target\n");
+        return JANUS_PARSE_ERROR;
+    }
+
+    // Identical templates, within this run or previous ones, share cached comparisons
+    const vector<uint64_t> target_hashes = _janus_hash_templates(targets);
+    const vector<uint64_t> query_hashes = same_templates ? target_hashes : _janus_hash_templates(queries);
+
+    // Without matrix output, online evaluation only keeps one row in memory,
+    // or in symmetric mode streams the upper triangle
+    const bool online = !block && !janus_online_evaluation.empty();
+    const bool stream_triangle = symmetric && online && (simmat == NULL) && (mask == NULL);
+    const bool keep_matrix = block || (symmetric && !stream_triangle) || (simmat != NULL) || (mask != NULL);
+    Evaluation evaluation;
+
+    const int width = column_end - column_begin;
+    const size_t block_size = size_t(keep_matrix ? row_end - row_begin : 1) * width;
+    vector<float> scores(block_size);
+    vector<unsigned char> masks(block_size);
+    const MemoryCharge matrix_memory(janus_matrix_memory, block_size * (sizeof(float) + sizeof(unsigned char)));
+    float *similarity_matrix = block_size ? &scores[0] : NULL;
+    unsigned char *truth = block_size ? &masks[0] : NULL;
+
+    // Subjects are looked up in advance so that rows can be scored concurrently
+    vector<int> query_subjects(num_queries), target_subjects(num_targets);
+    for (int i=row_begin; i<row_end; i++) {
+        query_subjects[i] = queryMetadata.subjectIDLUT[queries[i].template_id];
+        Instrumentation::measure(janus_template_size_samples, queries[i].flat_template.bytes / 1024.0);
+    }
+    for (int j=column_begin; j<column_end; j++) {
+        target_subjects[j] = targetMetadata.subjectIDLUT[targets[j].template_id];
+        if (row_begin < row_end)
+            Instrumentation::measure(janus_template_size_samples, targets[j].flat_template.bytes / 1024.0);
+    }
+
+    // Cells mirrored below once the upper triangle of the block is complete.
+    // Blocks leave the rest of the lower triangle to janus_merge_matrix_blocks.
+    auto mirrored = [&](int i, int j) {
+        return symmetric && (i > j) && (block || ((j >= row_begin) && (j < row_end) && (i >= column_begin) && (i < column_end)));
+    };
+
+    auto verifyRow = [&](int i, float *row_scores, unsigned char *row_truth) -> janus_error {
+        const janus::FlatTemplateView &query_template = queries[i].flat_template;
+        for (int j=column_begin, k=0; j<column_end; j++, k++) {
+            const janus::FlatTemplateView &target_template = targets[j].flat_template;
+            if (symmetric && (i == j)) {
+                row_scores[k] = -numeric_limits<float>::max();
+                row_truth[k] = 0x00;
+                continue;
+            }
+
+            row_truth[k] = (query_subjects[i] == target_subjects[j] ? 0xff : 0x7f);
+            if (mirrored(i, j))
+                continue;
+
+            float similarity;
+            JANUS_CHECK(_janus_verify(query_template.data, query_template.bytes, query_hashes.empty() ? 0 : query_hashes[i],
+                                      target_template.data, target_template.bytes, target_hashes.empty() ? 0 : target_hashes[j], &similarity))
+            row_scores[k] = similarity;
+        }
+        return JANUS_SUCCESS;
+    };
+
+    // The CMC rank of a query counts impostors above its best genuine score,
+    // so genuine pairs are scored first. Each impostor pair then updates the
+    // ranks of both of its templates, holding only per-query state.
+    auto streamTriangle = [&]() -> janus_error {
+        vector<float> best(num_queries, 0);
+        vector<bool> mated(num_queries, false);
+        vector<size_t> ranks(num_queries, 1);
+        for (int pass=0; pass<2; pass++)
+            for (int i=row_begin; i<row_end; i++)
+                for (int j=i+1; j<column_end; j++) {
+                    const bool genuine = (query_subjects[i] == target_subjects[j]);
+                    if (genuine != (pass == 0))
+                        continue;
+
+                    float similarity;
+                    JANUS_CHECK(_janus_verify(queries[i].flat_template.data, queries[i].flat_template.bytes, query_hashes.empty() ? 0 : query_hashes[i],
+                                              targets[j].flat_template.data, targets[j].flat_template.bytes, target_hashes.empty() ? 0 : target_hashes[j], &similarity))
+                    evaluation.addScore(similarity, genuine ? 0xff : 0x7f);
+                    const int pair[2] = { i, j };
+                    for (int k=0; k<2; k++) {
+                        const int q = pair[k];
+                        if (genuine && (!mated[q] || (similarity > best[q]))) {
+                            best[q] = similarity;
+                            mated[q] = true;
+                        } else if (!genuine && mated[q] && (similarity > best[q])) {
+                            ranks[q]++;
+                        }
+                    }
+                }
+        for (int i=row_begin; i<row_end; i++)
+            if (mated[i])
+                evaluation.addRank(ranks[i]);
+        return JANUS_SUCCESS;
+    };
+
+    if (stream_triangle) {
+        JANUS_CHECK(streamTriangle())
+    } else if (keep_matrix && _janus_async_running()) {
+        // Rows are dispatched to the worker pool most expensive first, so that
+        // the workers finish together rather than waiting on a late large row
+        vector<double> targetCosts, queryCosts;
+        _janus_expected_costs(targets, queries, targetCosts, queryCosts);
+        vector<pair<double,int> > rows;
+        for (int i=row_begin; i<row_end; i++) {
+            double cost = 0;
+            for (int j=column_begin; j<column_end; j++)
+                if (!(symmetric && (i == j)) && !mirrored(i, j))
+                    cost += targetCosts[j];
+            rows.push_back(make_pair(cost * queryCosts[i], i));
+        }
+        stable_sort(rows.begin(), rows.end(), [](const pair<double,int> &a, const pair<double,int> &b) { return a.first > b.first; });
+
+        vector<function<janus_error()> > calls;
+        for (size_t r=0; r<rows.size(); r++) {
+            const int i = rows[r].second;
+            const size_t offset = size_t(i - row_begin) * width;
+            calls.push_back([=] { return verifyRow(i, similarity_matrix + offset, truth + offset); });
+        }
+        JANUS_CHECK(_janus_run_async(calls))
+    } else {
+        for (int i=row_begin; i<row_end; i++) {
+            const size_t offset = size_t(keep_matrix ? i - row_begin : 0) * width;
+            JANUS_CHECK(verifyRow(i, similarity_matrix + offset, truth + offset))
+            if (online && !keep_matrix)
+                evaluation.addRow(similarity_matrix, truth, width, 0);
+        }
+    }
+    JANUS_CHECK(_janus_flush_score_cache())
+
+    if (symmetric && keep_matrix)
+        for (int i=max(row_begin, column_begin); i<min(row_end, column_end); i++)
+            for (int j=max(row_begin, column_begin); j<i; j++)
+                similarity_matrix[size_t(i - row_begin) * width + (j - column_begin)] = similarity_matrix[size_t(j - row_begin) * width + (i - column_begin)];
+
+    // Each unordered pair contributes one score in symmetric mode
+    if (online && keep_matrix)
+        for (int i=row_begin; i<row_end; i++)
+            evaluation.addRow(similarity_matrix + size_t(i - row_begin) * width, truth + size_t(i - row_begin) * width, width, symmetric ? i + 1 - column_begin : 0);
+
+    if (block) {
+        JANUS_CHECK(_janus_write_matrix_block(similarity_matrix, num_queries, num_targets, row_begin, row_end, column_begin, column_end, false, symmetric, target_metadata, query_metadata, simmat))
+        JANUS_CHECK(_janus_write_matrix_block(truth, num_queries, num_targets, row_begin, row_end, column_begin, column_end, true, symmetric, target_metadata, query_metadata, mask))
+    } else if (symmetric && janus_symmetric_verify_packed) {
+        if (simmat != NULL)
+            JANUS_CHECK(_janus_write_matrix(similarity_matrix, num_queries, num_targets, false, true, true, target_metadata, query_metadata, simmat))
+        if (mask != NULL)
+            JANUS_CHECK(_janus_write_matrix(truth, num_queries, num_targets, true, true, true, target_metadata, query_metadata, mask))
+    } else {
+        if (simmat != NULL)
+            JANUS_CHECK(janus_write_matrix(similarity_matrix, num_queries, num_targets, false, target_metadata, query_metadata, simmat))
+        if (mask != NULL)
+            JANUS_CHECK(janus_write_matrix(truth, num_queries, num_targets, true, target_metadata, query_metadata, mask))
+    }
+    if (online)
+        JANUS_CHECK(evaluation.write(janus_online_evaluation))
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_evaluate_verify(const char *target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask)
+{
+    return _janus_evaluate_verify(target, query, target_metadata, query_metadata, simmat, mask, 0, -1, 0, -1, false);
+}
 
-        // Parse header
-        string line;
-        getline(file, line);
-        istringstream attributeNames(line);
-        string attributeName;
-        getline(attributeNames, attributeName, ','); // TEMPLATE_ID
-        getline(attributeNames, attributeName, ','); // SUBJECT_ID
-        getline(attributeNames, attributeName, ','); // FILE_NAME
-        vector<janus_attribute> attributes;
-        while (getline(attributeNames, attributeName, ',')) {
-            attributeName.erase(remove_if(attributeName.begin(), attributeName.end(), ::isspace), attributeName.end());
-            attributes.push_back(janus_attribute_from_string(attributeName.c_str()));
+janus_error janus_evaluate_verify_block(const char *target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int row_begin, int row_end, int column_begin, int column_end)
+{
+    return _janus_evaluate_verify(target, query, target_metadata, query_metadata, simmat, mask, row_begin, row_end, column_begin, column_end, true);
+}
+
+janus_error janus_merge_matrix_blocks(const janus_matrix *blocks, int num_blocks, janus_matrix matrix)
+{
+    string target, query;
+    char format = 0;
+    bool triangular = false;
+    int rows = -1, columns = -1;
+    vector<char> data;
+    vector<bool> covered;
+    size_t num_covered = 0;
+
+    for (int b=0; b<num_blocks; b++) {
+        ifstream stream(blocks[b], ios::in | ios::binary);
+        string magic, block_target, block_query, block_format;
+        getline(stream, magic);
+        getline(stream, block_target);
+        getline(stream, block_query);
+        int block_rows, block_columns, row_begin, row_end, column_begin, column_end, endian;
+        stream >> block_format >> block_rows >> block_columns >> row_begin >> row_end >> column_begin >> column_end;
+        stream.get();
+        stream.read((char*)&endian, 4);
+        stream.get();
+        if (!stream) {
+            fprintf(stderr, "Failed to read matrix block: %s\n", blocks[b]);
+            return JANUS_READ_ERROR;
         }
 
-        // Parse rows
-        while (getline(file, line)) {
-            istringstream attributeValues(line);
-            string templateID, subjectID, fileName, attributeValue;
-            getline(attributeValues, templateID, ',');
-            getline(attributeValues, subjectID, ',');
-            getline(attributeValues, fileName, ',');
-            templateIDs.push_back(atoi(templateID.c_str()));
-            subjectIDLUT.insert(pair<janus_template_id,int>(atoi(templateID.c_str()), atoi(subjectID.c_str())));
-            fileNames.push_back(fileName);
-
-            // Construct attribute list, removing missing fields
-            janus_attribute_list attributeList;
-            attributeList.size = 0;
-            attributeList.attributes = new janus_attribute[attributes.size()];
-            attributeList.values = new double[attributes.size()];
-            for (int j=0; getline(attributeValues, attributeValue, ','); j++) {
-                if (attributeValue.empty())
-                    continue;
-                attributeList.attributes[attributeList.size] = attributes[j];
-                attributeList.values[attributeList.size] = atof(attributeValue.c_str());
-                attributeList.size++;
-            }
-            attributeLists.push_back(attributeList);
+        if (b == 0) {
+            target = block_target;
+            query = block_query;
+            format = block_format[1];
+            triangular = (block_format.size() == 3);
+            rows = block_rows;
+            columns = block_columns;
+            data.resize(size_t(rows) * columns * (format == 'B' ? 1 : 4));
+            covered.resize(size_t(rows) * columns, false);
         }
 
-        if (verbose)
-            fprintf(stderr, "\rEnrolling %zu/%zu", i, attributeLists.size());
-    }
+        if ((magic != "S2B") || (block_format.size() != (triangular ? 3 : 2)) || (block_format[1] != format) ||
+            (triangular && ((block_format[2] != 'T') || (rows != columns))) ||
+            (block_rows != rows) || (block_columns != columns) || (block_target != target) || (block_query != query) ||
+            (endian != 0x12345678) || (row_begin < 0) || (row_end > rows) || (row_begin > row_end) ||
+            (column_begin < 0) || (column_end > columns) || (column_begin > column_end)) {
+            fprintf(stderr, "Inconsistent matrix block: %s\n", blocks[b]);
+            return JANUS_PARSE_ERROR;
+        }
 
-    TemplateData next()
-    {
-        TemplateData templateData;
-        if (i >= attributeLists.size()) {
-            fprintf(stderr, "\n");
-        } else {
-            const janus_template_id templateID = templateIDs[i];
-            while ((i < attributeLists.size()) && (templateIDs[i] == templateID)) {
-                templateData.templateIDs.push_back(templateIDs[i]);
-                templateData.fileNames.push_back(fileNames[i]);
-                templateData.attributeLists.push_back(attributeLists[i]);
-                i++;
+        const size_t element = (format == 'B') ? 1 : 4;
+        const size_t row_bytes = size_t(column_end - column_begin) * element;
+        // Symmetric blocks only cover elements on or above the diagonal
+        vector<char> row(row_bytes);
+        for (int i=row_begin; i<row_end; i++) {
+            stream.read(row.empty() ? NULL : &row[0], row_bytes);
+            for (int j=(triangular ? max(column_begin, i) : column_begin); j<column_end; j++) {
+                memcpy(&data[(size_t(i) * columns + j) * element], &row[size_t(j - column_begin) * element], element);
+                if (!covered[size_t(i) * columns + j]) {
+                    covered[size_t(i) * columns + j] = true;
+                    num_covered++;
+                }
             }
-            if (verbose)
-                fprintf(stderr, "\rEnrolling %zu/%zu", i, attributeLists.size());
         }
-        return templateData;
+        if (!stream) {
+            fprintf(stderr, "Truncated matrix block: %s\n", blocks[b]);
+            return JANUS_READ_ERROR;
+        }
     }
 
-    static janus_error create(const char *data_path, const TemplateData templateData, janus_template *template_, janus_template_id *templateID, bool verbose)
-    {
-        clock_t start = clock();
-        JANUS_CHECK(janus_allocate_template(template_))
-        _janus_add_sample(janus_initialize_template_samples, 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    if (triangular)
+        for (int i=0; i<rows; i++)
+            for (int j=0; j<i; j++)
+                if (covered[size_t(j) * columns + i]) {
+                    const size_t element = (format == 'B') ? 1 : 4;
+                    memcpy(&data[(size_t(i) * columns + j) * element], &data[(size_t(j) * columns + i) * element], element);
+                    covered[size_t(i) * columns + j] = true;
+                    num_covered++;
+                }
+
+    if ((rows < 0) || (num_covered != covered.size())) {
+        fprintf(stderr, "Matrix blocks cover %zu of %zu elements\n", num_covered, covered.size());
+        return JANUS_PARSE_ERROR;
+    }
 
-        for (size_t i=0; i<templateData.templateIDs.size(); i++) {
-            janus_image image;
+    return janus_write_matrix(data.empty() ? NULL : &data[0], rows, columns, format == 'B', target.c_str(), query.c_str(), matrix);
+}
 
-            start = clock();
-            JANUS_ASSERT(janus_read_image((data_path + templateData.fileNames[i]).c_str(), &image))
-            _janus_add_sample(janus_read_image_samples, 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+janus_error janus_evaluate_verify_pairs(const char *target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, const char *pairs, const char *scores, const char *mask)
+{
+    StageMemory stage(janus_verify_peak_rss);
+    TemplateData targetMetadata = TemplateIterator(target_metadata, false);
+    TemplateData queryMetadata = TemplateIterator(query_metadata, false);
 
-            start = clock();
-            const janus_error error = janus_augment(image, templateData.attributeLists[i], *template_);
-            if (error == JANUS_MISSING_ATTRIBUTES) {
-                janus_missing_attributes_count++;
-                if (verbose)
-                    printf("Missing attributes for: %s\n", templateData.fileNames[i].c_str());
-            } else if (error == JANUS_FAILURE_TO_ENROLL) {
-                janus_failure_to_enroll_count++;
-                if (verbose)
-                    printf("Failure to enroll: %s\n", templateData.fileNames[i].c_str());
-            } else if (error != JANUS_SUCCESS) {
-                janus_other_errors_count++;
-                printf("Warning: %s on: %s\n", janus_error_to_string(error),templateData.fileNames[i].c_str());
+    // Parse the (query, target) pairs
+    vector<pair<janus_template_id, janus_template_id> > templatePairs;
+    {
+        ifstream file(pairs);
+        if (!file.is_open())
+            return JANUS_OPEN_ERROR;
+        string line;
+        getline(file, line); // QUERY_TEMPLATE_ID,TARGET_TEMPLATE_ID
+        while (getline(file, line)) {
+            if (line.empty())
+                continue;
+            istringstream values(line);
+            string queryID, targetID;
+            getline(values, queryID, ',');
+            getline(values, targetID, ',');
+            if (queryID.empty() || targetID.empty())
+                return JANUS_PARSE_ERROR;
+            templatePairs.push_back(make_pair(atoi(queryID.c_str()), atoi(targetID.c_str())));
+            if ((queryMetadata.subjectIDLUT.find(templatePairs.back().first) == queryMetadata.subjectIDLUT.end()) ||
+                (targetMetadata.subjectIDLUT.find(templatePairs.back().second) == targetMetadata.subjectIDLUT.end())) {
+                fprintf(stderr, "Pair not found in metadata: %s\n", line.c_str());
+                return JANUS_MISSING_TEMPLATE_ID;
             }
-            _janus_add_sample(janus_augment_samples, 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
-
-            start = clock();
-            janus_free_image(image);
-            _janus_add_sample(janus_free_image_samples, 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
         }
-
-        *templateID = templateData.templateIDs[0];
-        return JANUS_SUCCESS;
     }
-};
 
-janus_error janus_create_template(const char *data_path, janus_metadata metadata, janus_template *template_, janus_template_id *template_id)
-{
-    TemplateIterator ti(metadata, false);
-    return TemplateIterator::create(data_path, ti.next(), template_, template_id, false);
-}
+    TemplateFile queryTemplates, targetTemplates;
+    JANUS_CHECK(queryTemplates.open(query))
+    JANUS_CHECK(targetTemplates.open(target))
+
+    // Load only the targets that are compared against
+    map<janus_template_id, vector<janus_data> > targetData;
+    MemoryCharge flat_template_memory(janus_flat_template_memory);
+    map<janus_template_id, size_t> targetBytes;
+    map<janus_template_id, uint64_t> targetHashes;
+    for (size_t i=0; i<templatePairs.size(); i++) {
+        const janus_template_id targetID = templatePairs[i].second;
+        if (targetData.find(targetID) != targetData.end())
+            continue;
+        vector<janus_data> &buffer = targetData[targetID];
+        size_t bytes;
+        const bool found = targetTemplates.read(targetID, buffer, &bytes);
+        flat_template_memory.resize(flat_template_memory.bytes + buffer.size());
+        if (found) {
+            targetBytes[targetID] = bytes;
+            targetHashes[targetID] = janus_score_cache.enabled() ? FeatureCache::hash(_janus_buffer(buffer), bytes) : 0;
+            Instrumentation::measure(janus_template_size_samples, bytes / 1024.0);
+        }
+    }
 
-#ifndef JANUS_CUSTOM_CREATE_TEMPLATES
+    // Visit pairs grouped by query so each query template is read once
+    vector<size_t> order(templatePairs.size());
+    for (size_t i=0; i<order.size(); i++)
+        order[i] = i;
+    stable_sort(order.begin(), order.end(), [&templatePairs](size_t a, size_t b) { return templatePairs[a] < templatePairs[b]; });
+
+    // Pairs with a template missing from either file, e.g. after a failure to
+    // enroll, are scored below any successful comparison
+    vector<float> similarities(templatePairs.size(), -numeric_limits<float>::max());
+    const MemoryCharge matrix_memory(janus_matrix_memory, similarities.size() * sizeof(float));
+    vector<janus_data> queryData;
+    MemoryCharge query_memory(janus_flat_template_memory);
+    size_t queryBytes = 0;
+    uint64_t queryHash = 0;
+    bool queryValid = false;
+    size_t missing = 0;
+    for (size_t k=0; k<order.size(); k++) {
+        const janus_template_id queryID = templatePairs[order[k]].first;
+        const janus_template_id targetID = templatePairs[order[k]].second;
+        if ((k == 0) || (queryID != templatePairs[order[k-1]].first)) {
+            queryValid = queryTemplates.read(queryID, queryData, &queryBytes);
+            query_memory.resize(queryData.size());
+            if (queryValid) {
+                Instrumentation::measure(janus_template_size_samples, queryBytes / 1024.0);
+                queryHash = janus_score_cache.enabled() ? FeatureCache::hash(_janus_buffer(queryData), queryBytes) : 0;
+            }
+        }
 
-janus_error janus_create_templates(const char *data_path, janus_metadata metadata, const char *gallery_file, int verbose)
-{
-    TemplateIterator ti(metadata, true);
-    janus_template template_;
-    janus_template_id templateID;
-    TemplateData templateData = ti.next();
-    std::ofstream file;
-    file.open(gallery_file, std::ios::out | std::ios::binary | std::ios::ate);
-    while (!templateData.templateIDs.empty()) {
-        JANUS_CHECK(TemplateIterator::create(data_path, templateData, &template_, &templateID, verbose))
-        janus_flat_template flat_template_ = new janus_data[janus_max_template_size()];
-        size_t bytes;
-        JANUS_CHECK(janus_flatten_template(template_, flat_template_, &bytes))
-        JANUS_CHECK(janus_free_template(template_))
-        file.write((char*)&templateID, sizeof(templateID));
-        file.write((char*)&bytes, sizeof(bytes));
-        file.write((char*)flat_template_, bytes);
+        map<janus_template_id, size_t>::const_iterator target_bytes = targetBytes.find(targetID);
+        if (!queryValid || (target_bytes == targetBytes.end())) {
+            missing++;
+            continue;
+        }
 
-        delete[] flat_template_;
-        templateData = ti.next();
+        float similarity;
+        vector<janus_data> &target_data = targetData[targetID];
+        JANUS_CHECK(_janus_verify(_janus_buffer(queryData), queryBytes, queryHash, _janus_buffer(target_data), target_bytes->second, targetHashes[targetID], &similarity))
+        similarities[order[k]] = similarity;
     }
-    file.close();
+    JANUS_CHECK(_janus_flush_score_cache())
+    if (missing > 0)
+        fprintf(stderr, "%zu of %zu pairs reference templates missing from %s or %s\n", missing, templatePairs.size(), query, target);
+
+    // Write the triplets in the order of the pair list
+    ofstream scoresFile(scores), maskFile(mask);
+    if (!scoresFile.is_open() || !maskFile.is_open())
+        return JANUS_OPEN_ERROR;
+    scoresFile.precision(numeric_limits<float>::digits10 + 2);
+    scoresFile << "QUERY_TEMPLATE_ID,TARGET_TEMPLATE_ID,SCORE\n";
+    maskFile << "QUERY_TEMPLATE_ID,TARGET_TEMPLATE_ID,GENUINE\n";
+    for (size_t i=0; i<templatePairs.size(); i++) {
+        const janus_template_id queryID = templatePairs[i].first;
+        const janus_template_id targetID = templatePairs[i].second;
+        scoresFile << queryID << ',' << targetID << ',' << similarities[i] << '\n';
+        maskFile << queryID << ',' << targetID << ',' << (queryMetadata.subjectIDLUT[queryID] == targetMetadata.subjectIDLUT[targetID] ? 1 : 0) << '\n';
+    }
+    if (!scoresFile || !maskFile)
+        return JANUS_WRITE_ERROR;
     return JANUS_SUCCESS;
 }
 
-#endif // JANUS_CUSTOM_CREATE_TEMPLATES
+struct janus_future_type
+{
+    mutex lock;
+    condition_variable completed;
+    bool done;
+    janus_error error;
 
-#ifndef JANUS_CUSTOM_CREATE_GALLERY
+    janus_future_type()
+        : done(false), error(JANUS_SUCCESS) {}
+};
 
-janus_error janus_create_gallery(const char *data_path, janus_metadata metadata, janus_gallery gallery, int verbose)
+// Worker pool backing the asynchronous API
+struct AsyncPool
 {
-    TemplateIterator ti(metadata, true);
-    janus_template template_;
-    janus_template_id templateID;
-    TemplateData templateData = ti.next();
-    while (!templateData.templateIDs.empty()) {
-        JANUS_CHECK(TemplateIterator::create(data_path, templateData, &template_, &templateID, verbose))
-        JANUS_CHECK(janus_enroll(template_, templateID, gallery))
-        JANUS_CHECK(janus_free_template(template_))
-        templateData = ti.next();
-    }
-    return JANUS_SUCCESS;
-}
+    struct Task
+    {
+        function<janus_error()> call;
+        janus_callback callback;
+        void *userData;
+        janus_future future;
+    };
 
-#endif // JANUS_CUSTOM_CREATE_GALLERY
+    mutex control; // Serializes start and stop
+    vector<thread> workers;
 
-struct FlatTemplate
-{
-    struct Data {
-        janus_flat_template flat_template;
-        size_t bytes, ref_count;
-        janus_error error;
-    } *data;
+    mutex lock; // Guards everything below
+    condition_variable available;
+    deque<Task> tasks;
+    bool stopping, running;
+
+    AsyncPool()
+        : stopping(false), running(false) {}
 
-    FlatTemplate()
+    ~AsyncPool()
     {
-        data = NULL;
+        stop();
     }
-    
-    FlatTemplate(janus_template template_)
-    {
-        data = new Data();
-        data->ref_count = 1;
-
-        janus_data *buffer = new janus_data[janus_max_template_size()];
 
-        const clock_t start = clock();
-        data->error = janus_flatten_template(template_, buffer, &data->bytes);
-        JANUS_ASSERT(janus_free_template(template_))
-        _janus_add_sample(janus_finalize_template_samples, 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
-        _janus_add_sample(janus_template_size_samples, data->bytes / 1024.0);
+    void start(int numWorkers)
+    {
+        lock_guard<mutex> guard(control);
+        join();
+        if (numWorkers <= 0)
+            numWorkers = max(1, int(thread::hardware_concurrency()));
+        {
+            lock_guard<mutex> state(lock);
+            stopping = false;
+            running = true;
+        }
+        for (int i=0; i<numWorkers; i++)
+            workers.push_back(thread(&AsyncPool::work, this));
+    }
 
-        data->flat_template = new janus_data[data->bytes];
-        memcpy(data->flat_template, buffer, data->bytes);
-        delete[] buffer;
+    // Outstanding tasks are completed before the workers exit
+    void stop()
+    {
+        lock_guard<mutex> guard(control);
+        join();
     }
 
-    FlatTemplate(const FlatTemplate& other)
+    void join()
     {
-        *this = other;
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+            running = false;
+        }
+        available.notify_all();
+        for (size_t i=0; i<workers.size(); i++)
+            workers[i].join();
+        workers.clear();
     }
 
-    FlatTemplate& operator=(const FlatTemplate& rhs)
+    bool isRunning()
     {
-        data = rhs.data;
-        if (data) data->ref_count++;
-        return *this;
+        lock_guard<mutex> guard(lock);
+        return running;
     }
 
-    ~FlatTemplate()
+    janus_error submit(const function<janus_error()> &call, janus_callback callback, void *userData, janus_future *future)
     {
-        if (data) {
-            data->ref_count--;
-            if (data->ref_count == 0) {
-                delete[] data->flat_template;
-                delete data;
-            }
+        Task task;
+        task.call = call;
+        task.callback = callback;
+        task.userData = userData;
+        {
+            lock_guard<mutex> guard(lock);
+            if (!running)
+                return JANUS_UNKNOWN_ERROR;
+            task.future = *future = new janus_future_type();
+            tasks.push_back(task);
         }
+        available.notify_one();
+        return JANUS_SUCCESS;
     }
 
-    janus_error compareTo(const FlatTemplate &other, float *similarity) const
+    void work()
     {
-        const clock_t start = clock();
-        janus_error error = janus_verify(data->flat_template, data->bytes, other.data->flat_template, other.data->bytes, similarity);
-        _janus_add_sample(janus_verify_samples, 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
-        return error;
+        while (true) {
+            Task task;
+            {
+                unique_lock<mutex> guard(lock);
+                available.wait(guard, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = tasks.front();
+                tasks.pop_front();
+            }
+
+            const janus_error error = task.call();
+            if (task.callback)
+                task.callback(error, task.userData);
+
+            // Notify under the lock, the future may be freed as soon as it is released
+            lock_guard<mutex> guard(task.future->lock);
+            task.future->error = error;
+            task.future->done = true;
+            task.future->completed.notify_all();
+        }
     }
 };
 
-janus_error janus_write_matrix(void *data, int rows, int columns, int is_mask, janus_metadata target, janus_metadata query, janus_matrix matrix)
+static AsyncPool janus_async_pool;
+
+janus_error janus_initialize_async(int num_workers)
 {
-    ofstream stream(matrix, ios::out | ios::binary);
-    stream << "S2\n"
-           << target << '\n'
-           << query << '\n'
-           << 'M' << (is_mask ? 'B' : 'F') << ' '
-           << rows << ' ' << columns << ' ';
-    int endian = 0x12345678;
-    stream.write((const char*)&endian, 4);
-    stream << '\n';
-    stream.write((const char*)data, rows * columns * (is_mask ? 1 : 4));
+    janus_async_pool.start(num_workers);
     return JANUS_SUCCESS;
 }
 
-janus_data* janus_read_templates(const char *template_file, size_t *bytes)
+janus_error janus_finalize_async()
 {
-    ifstream file;
-    file.open(template_file, ios::in | ios::binary | ios::ate);
-    *bytes = file.tellg();
-    file.seekg(0, ios::beg);
-    janus_data *templates = new janus_data[*bytes];
-    file.read((char*)templates, *bytes);
-    file.close();
-    return templates;
+    janus_async_pool.stop();
+    return JANUS_SUCCESS;
 }
 
-janus_error janus_evaluate_search(janus_flat_gallery target, size_t target_bytes, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask, int num_requested_returns)
+// True between janus_initialize_async and janus_finalize_async
+static bool _janus_async_running()
 {
-    TemplateData targetMetadata = TemplateIterator(target_metadata, false);
-    TemplateData queryMetadata = TemplateIterator(query_metadata, false);
-    size_t query_size = queryMetadata.templateIDs.size();
-    float *similarity_matrix = new float[query_size * num_requested_returns];
-    unsigned char *truth = new unsigned char[query_size * num_requested_returns];
-
-    // Read in query template file
-    size_t query_bytes;
-    janus_data *query_templates = janus_read_templates(query, &query_bytes);
-    janus_data *q_templates = query_templates;
-
-    int num_queries = 0;
-    while (q_templates < query_templates + query_bytes) {
-        janus_template_id *template_ids = new janus_template_id[num_requested_returns];
-        float *similarities = new float[num_requested_returns];
-        int num_actual_returns;
-
-        janus_template_id query_template_id = *reinterpret_cast<janus_template_id*>(q_templates);
-        q_templates += sizeof(query_template_id);
-        const size_t query_template_bytes = *reinterpret_cast<size_t*>(q_templates);
-        q_templates += sizeof(query_template_bytes);
-        janus_flat_template query_template_flat = new janus_data[janus_max_template_size()];
-        memcpy(query_template_flat, q_templates, query_template_bytes);
-        q_templates += query_template_bytes;
-
-        clock_t start = clock();
-        JANUS_CHECK(janus_search(query_template_flat, query_template_bytes, target, target_bytes, num_requested_returns, template_ids, similarities, &num_actual_returns))
-        _janus_add_sample(janus_search_samples, 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
-        _janus_add_sample(janus_template_size_samples, query_template_bytes / 1024.0);
+    return janus_async_pool.isRunning();
+}
 
-        // Write matrix of size num_queries*num_requested returns
-        if (num_actual_returns < num_requested_returns) {
-            memcpy(similarity_matrix, similarities, sizeof(float)*num_actual_returns);
+// Run the calls on the worker pool in order of submission, returning the first error
+static janus_error _janus_run_async(const vector<function<janus_error()> > &calls)
+{
+    janus_error result = JANUS_SUCCESS;
+    vector<janus_future> futures;
+    for (size_t i=0; (i<calls.size()) && (result == JANUS_SUCCESS); i++) {
+        janus_future future;
+        result = janus_async_pool.submit(calls[i], NULL, NULL, &future);
+        if (result == JANUS_SUCCESS)
+            futures.push_back(future);
+    }
 
-            for (int i=num_actual_returns; i<num_requested_returns; i++) {
-                similarity_matrix[i] = -std::numeric_limits<float>::max();
-            }
-            similarity_matrix += num_requested_returns;
-        } else if (num_actual_returns == num_requested_returns) {
-            memcpy(similarity_matrix, similarities, sizeof(float)*num_actual_returns);
-            similarity_matrix += num_actual_returns;
-        } else {
-            std::cerr << "Error: Number of search results returned (" << num_actual_returns << ") is greater than number requested ("
-                      << num_requested_returns << "). Likely memory error triggering undefined behavior. Exiting early with error." << std::endl;
-            return JANUS_UNKNOWN_ERROR;
-        }
+    // Submitted calls reference the caller's buffers, so always wait for them
+    for (size_t i=0; i<futures.size(); i++) {
+        const janus_error call_error = janus_wait(futures[i]);
+        if (result == JANUS_SUCCESS)
+            result = call_error;
+        janus_free_future(futures[i]);
+    }
+    return result;
+}
 
-        for (int j=0; j<num_requested_returns; j++) {
-            if (j<num_actual_returns) {
-                truth[num_queries*num_requested_returns+j] = (queryMetadata.subjectIDLUT[query_template_id] == targetMetadata.subjectIDLUT[template_ids[j]] ? 0xff : 0x7f);
-            } else {
-                truth[num_queries*num_requested_returns+j] = 0x00;
-            }
-        }
-        num_queries++;
-        delete[] query_template_flat;
-        delete[] template_ids;
-        delete[] similarities;
-    }
-    similarity_matrix -= num_queries*num_requested_returns;
-    JANUS_CHECK(janus_write_matrix(similarity_matrix, num_queries, num_requested_returns, false, target_metadata, query_metadata, simmat))
-    delete[] similarity_matrix;
-    JANUS_CHECK(janus_write_matrix(truth, num_queries, num_requested_returns, true, target_metadata, query_metadata, mask))
-    delete[] truth;
-    return JANUS_SUCCESS;
+janus_error janus_augment_async(const janus_image image, const janus_attribute_list attributes, janus_template template_, janus_callback callback, void *user_data, janus_future *future)
+{
+    return janus_async_pool.submit([=] { return janus_augment(image, attributes, template_); }, callback, user_data, future);
 }
 
-janus_error janus_evaluate_verify(const char *target, const char *query, janus_metadata target_metadata, janus_metadata query_metadata, janus_matrix simmat, janus_matrix mask)
+janus_error janus_verify_async(const janus_flat_template a, const size_t a_bytes, const janus_flat_template b, const size_t b_bytes, float *similarity, janus_callback callback, void *user_data, janus_future *future)
 {
-    TemplateData targetMetadata = TemplateIterator(target_metadata, false);
-    TemplateData queryMetadata = TemplateIterator(query_metadata, false);
-    size_t target_size = targetMetadata.templateIDs.size();
-    size_t query_size = queryMetadata.templateIDs.size();
-    float *similarity_matrix = new float[query_size * target_size];
-    unsigned char *truth = new unsigned char[query_size * target_size];
+    return janus_async_pool.submit([=] { return janus_verify(a, a_bytes, b, b_bytes, similarity); }, callback, user_data, future);
+}
 
-    // Read in query template file
-    size_t query_bytes;
-    janus_data *query_templates = janus_read_templates(query, &query_bytes);
-    janus_data *q_templates = query_templates;
+janus_error janus_search_async(const janus_flat_template probe, const size_t probe_bytes, const janus_flat_gallery gallery, const size_t gallery_bytes, const int num_requested_returns, janus_template_id *template_ids, float *similarities, int *num_actual_returns, janus_callback callback, void *user_data, janus_future *future)
+{
+    return janus_async_pool.submit([=] { return janus_search(probe, probe_bytes, gallery, gallery_bytes, num_requested_returns, template_ids, similarities, num_actual_returns); }, callback, user_data, future);
+}
 
-    // Read in target template file
-    size_t target_bytes;
-    janus_data *target_templates = janus_read_templates(target, &target_bytes);
-    janus_data *t_templates = target_templates;
+int janus_poll(const janus_future future)
+{
+    lock_guard<mutex> guard(future->lock);
+    return future->done ? 1 : 0;
+}
 
-    int num_queries = 0;
-    int num_targets = 0;
-    while (q_templates < query_templates + query_bytes) {
-        janus_template_id query_template_id = *reinterpret_cast<janus_template_id*>(q_templates);
-        q_templates += sizeof(query_template_id);
-        const size_t query_template_bytes = *reinterpret_cast<size_t*>(q_templates);
-        q_templates += sizeof(query_template_bytes);
-        janus_flat_template query_template_flat = new janus_data[janus_max_template_size()];
-        memcpy(query_template_flat, q_templates, query_template_bytes);
-        q_templates += query_template_bytes;
-        _janus_add_sample(janus_template_size_samples, query_template_bytes / 1024.0);
-
-        while (t_templates < target_templates + target_bytes) {
-            janus_template_id target_template_id = *reinterpret_cast<janus_template_id*>(t_templates);
-            t_templates += sizeof(target_template_id);
-            const size_t target_template_bytes = *reinterpret_cast<size_t*>(t_templates);
-            t_templates += sizeof(target_template_bytes);
-            janus_flat_template target_template_flat = new janus_data[janus_max_template_size()];
-            memcpy(target_template_flat, t_templates, target_template_bytes);
-            t_templates += target_template_bytes;
-            if (num_queries == 0)
-                _janus_add_sample(janus_template_size_samples, target_template_bytes / 1024.0);
+janus_error janus_wait(const janus_future future)
+{
+    unique_lock<mutex> guard(future->lock);
+    future->completed.wait(guard, [future] { return future->done; });
+    return future->error;
+}
 
-            float similarity;
-            clock_t start = clock();
-            JANUS_CHECK(janus_verify(query_template_flat, query_template_bytes, target_template_flat, target_template_bytes, &similarity))
-            _janus_add_sample(janus_verify_samples, 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
-            *similarity_matrix = similarity;
-            similarity_matrix += 1;
-            *truth = (queryMetadata.subjectIDLUT[query_template_id] == targetMetadata.subjectIDLUT[target_template_id] ? 0xff : 0x7f);
-            truth += 1;
-            if (num_queries == 0)
-                num_targets++;
-            delete[] target_template_flat;
-        }
-    t_templates -= target_bytes;
-    delete[] query_template_flat;
-    num_queries++;
-    }
-    similarity_matrix -= num_targets*num_queries;
-    truth -= num_targets*num_queries;
-    JANUS_CHECK(janus_write_matrix(similarity_matrix, num_queries, num_targets, false, target_metadata, query_metadata, simmat))
-    JANUS_CHECK(janus_write_matrix(truth, num_queries, num_targets, true, target_metadata, query_metadata, mask))
-    delete[] similarity_matrix;
-    delete[] truth;
-    delete[] query_templates;
-    delete[] target_templates;
-    return JANUS_SUCCESS;
+void janus_free_future(janus_future future)
+{
+    if (!future)
+        return;
+    janus_wait(future);
+    delete future;
 }
 
-static janus_metric calculateMetric(const vector<double> &samples)
+// Summarizes and resets the samples
+static janus_metric calculateMetric(Samples &samples)
 {
     janus_metric metric;
-    metric.count = samples.size();
-
-    if (metric.count > 0) {
-        metric.mean = 0;
-        for (size_t i=0; i<samples.size(); i++)
-            metric.mean += samples[i];
-        metric.mean /= samples.size();
-
-        metric.stddev = 0;
-        for (size_t i=0; i<samples.size(); i++)
-            metric.stddev += pow(samples[i] - metric.mean, 2.0);
-        metric.stddev = sqrt(metric.stddev / samples.size());
+    metric.count = samples.count.exchange(0);
+    const double sum = samples.sum.exchange(0);
+    const double sumOfSquares = samples.sumOfSquares.exchange(0);
+    for (int i=0; i<JANUS_HISTOGRAM_BINS; i++)
+        metric.histogram[i] = samples.histogram[i].exchange(0);
+
+    if ((metric.count > 0) && Instrumentation::measures) {
+        metric.mean = sum / metric.count;
+        metric.stddev = sqrt(max(sumOfSquares / metric.count - pow(metric.mean, 2.0), 0.0));
     } else {
         metric.mean = std::numeric_limits<double>::quiet_NaN();
         metric.stddev = std::numeric_limits<double>::quiet_NaN();
@@ -571,6 +3668,15 @@ static janus_metric calculateMetric(const vector<double> &samples)
     return metric;
 }
 
+// Summarizes the usage and restarts the peak from the bytes still held
+static janus_memory calculateMemory(MemoryUsage &usage)
+{
+    janus_memory memory;
+    memory.live_bytes = usage.live.load();
+    memory.peak_bytes = max(usage.peak.exchange(memory.live_bytes), memory.live_bytes);
+    return memory;
+}
+
 janus_metrics janus_get_metrics()
 {
     janus_metrics metrics;
@@ -578,40 +3684,406 @@ janus_metrics janus_get_metrics()
     metrics.janus_augment_speed             = calculateMetric(janus_augment_samples);
     metrics.janus_finalize_template_speed   = calculateMetric(janus_finalize_template_samples);
     metrics.janus_read_image_speed          = calculateMetric(janus_read_image_samples);
+    metrics.janus_read_frame_speed          = calculateMetric(janus_read_frame_samples);
     metrics.janus_free_image_speed          = calculateMetric(janus_free_image_samples);
     metrics.janus_verify_speed              = calculateMetric(janus_verify_samples);
     metrics.janus_gallery_size_speed        = calculateMetric(janus_gallery_size_samples);
     metrics.janus_finalize_gallery_speed    = calculateMetric(janus_finalize_gallery_samples);
     metrics.janus_search_speed              = calculateMetric(janus_search_samples);
     metrics.janus_template_size             = calculateMetric(janus_template_size_samples);
-    metrics.janus_missing_attributes_count  = janus_missing_attributes_count;
-    metrics.janus_failure_to_enroll_count   = janus_failure_to_enroll_count;
-    metrics.janus_other_errors_count        = janus_other_errors_count;
+    metrics.janus_compact_template_speed    = calculateMetric(janus_compact_template_samples);
+    metrics.janus_uncompacted_template_size = calculateMetric(janus_uncompacted_template_size_samples);
+    metrics.janus_compacted_template_size   = calculateMetric(janus_compacted_template_size_samples);
+    metrics.janus_cascade_screen_speed      = calculateMetric(janus_cascade_screen_samples);
+    metrics.janus_cascade_rescore_speed     = calculateMetric(janus_cascade_rescore_samples);
+    metrics.janus_missing_attributes_count  = janus_missing_attributes_count.exchange(0);
+    metrics.janus_failure_to_enroll_count   = janus_failure_to_enroll_count.exchange(0);
+    metrics.janus_other_errors_count        = janus_other_errors_count.exchange(0);
+    metrics.janus_skipped_template_count    = janus_skipped_template_count.exchange(0);
+    metrics.janus_feature_cache_hit_count   = janus_feature_cache_hit_count.exchange(0);
+    metrics.janus_feature_cache_miss_count  = janus_feature_cache_miss_count.exchange(0);
+    metrics.janus_feature_cache_eviction_count = janus_feature_cache_eviction_count.exchange(0);
+    metrics.janus_score_cache_hit_count     = janus_score_cache_hit_count.exchange(0);
+    metrics.janus_score_cache_miss_count    = janus_score_cache_miss_count.exchange(0);
+    metrics.janus_skipped_verify_count      = janus_skipped_verify_count.exchange(0);
+    metrics.janus_skipped_search_count      = janus_skipped_search_count.exchange(0);
+    metrics.janus_frames_considered_count   = janus_frames_considered_count.exchange(0);
+    metrics.janus_frames_augmented_count    = janus_frames_augmented_count.exchange(0);
+    metrics.janus_cascade_rescored_count    = janus_cascade_rescored_count.exchange(0);
+    metrics.janus_cascade_compared_count    = janus_cascade_compared_count.exchange(0);
+    metrics.janus_cascade_rank1_agreement_count = janus_cascade_rank1_agreement_count.exchange(0);
+    metrics.janus_cascade_rankk_expected_count  = janus_cascade_rankk_expected_count.exchange(0);
+    metrics.janus_cascade_rankk_agreement_count = janus_cascade_rankk_agreement_count.exchange(0);
+    metrics.janus_image_memory              = calculateMemory(janus_image_memory);
+    metrics.janus_flat_template_memory      = calculateMemory(janus_flat_template_memory);
+    metrics.janus_gallery_memory            = calculateMemory(janus_gallery_memory);
+    metrics.janus_matrix_memory             = calculateMemory(janus_matrix_memory);
+    metrics.janus_metadata_memory           = calculateMemory(janus_metadata_memory);
+    metrics.janus_enrollment_peak_rss       = janus_enrollment_peak_rss.exchange(0);
+    metrics.janus_search_peak_rss           = janus_search_peak_rss.exchange(0);
+    metrics.janus_verify_peak_rss           = janus_verify_peak_rss.exchange(0);
     return metrics;
 }
 
+double janus_metric_percentile(const janus_metric *metric, double percentile)
+{
+    size_t total = 0;
+    for (int i=0; i<JANUS_HISTOGRAM_BINS; i++)
+        total += metric->histogram[i];
+    if (total == 0)
+        return std::numeric_limits<double>::quiet_NaN();
+
+    // Geometric center of the bin containing the percentile
+    const double rank = min(max(percentile * total, 1.0), double(total));
+    size_t cumulative = 0;
+    int bin = 0;
+    while ((bin < JANUS_HISTOGRAM_BINS - 1) && (cumulative + metric->histogram[bin] < rank))
+        cumulative += metric->histogram[bin++];
+    return pow(2.0, (bin - 15.5) / 2);
+}
+
 static void printMetric(const char *name, janus_metric metric, bool speed = true)
 {
     if (metric.count > 0)
-        printf("%s\t%.2g\t%.2g\t%s\t%.2g\n", name, metric.mean, metric.stddev, speed ? "ms" : "KB", double(metric.count));
+        printf("%s\t%.2g\t%.2g\t%s\t%.2g\t%.2g\t%.2g\t%.2g\n", name, metric.mean, metric.stddev, speed ? "ms" : "KB", double(metric.count),
+               janus_metric_percentile(&metric, 0.5), janus_metric_percentile(&metric, 0.9), janus_metric_percentile(&metric, 0.99));
+}
+
+static void printMemory(const char *name, janus_memory memory)
+{
+    printf("%s\t%.3g\t%.3g\tMB\n", name, memory.live_bytes / (1024.0 * 1024.0), memory.peak_bytes / (1024.0 * 1024.0));
 }
 
 void janus_print_metrics(janus_metrics metrics)
 {
-    printf(     "API Symbol               \tMean\tStdDev\tUnits\tCount\n");
+    printf(     "API Symbol               \tMean\tStdDev\tUnits\tCount\tP50\tP90\tP99\n");
     printMetric("janus_initialize_template", metrics.janus_initialize_template_speed);
     printMetric("janus_augment            ", metrics.janus_augment_speed);
     printMetric("janus_finalize_template  ", metrics.janus_finalize_template_speed);
     printMetric("janus_read_image         ", metrics.janus_read_image_speed);
+    printMetric("janus_read_frame         ", metrics.janus_read_frame_speed);
     printMetric("janus_free_image         ", metrics.janus_free_image_speed);
     printMetric("janus_verify             ", metrics.janus_verify_speed);
     printMetric("janus_gallery_size       ", metrics.janus_gallery_size_speed);
     printMetric("janus_finalize_gallery   ", metrics.janus_finalize_gallery_speed);
     printMetric("janus_search             ", metrics.janus_search_speed);
+    printMetric("janus_compact_template   ", metrics.janus_compact_template_speed);
     printMetric("janus_flat_template      ", metrics.janus_template_size, false);
+    printMetric("uncompacted_template     ", metrics.janus_uncompacted_template_size, false);
+    printMetric("compacted_template       ", metrics.janus_compacted_template_size, false);
+    printMetric("janus_cascade_screen     ", metrics.janus_cascade_screen_speed);
+    printMetric("janus_cascade_rescore    ", metrics.janus_cascade_rescore_speed);
     printf("\n\n");
     printf("janus_error             \tCount\n");
     printf("JANUS_MISSING_ATTRIBUTES\t%d\n", metrics.janus_missing_attributes_count);
     printf("JANUS_FAILURE_TO_ENROLL \t%d\n", metrics.janus_failure_to_enroll_count);
     printf("All other errors        \t%d\n", metrics.janus_other_errors_count);
+    if (metrics.janus_skipped_template_count > 0)
+        printf("Skipped templates       \t%d\n", metrics.janus_skipped_template_count);
+
+    const int lookups = metrics.janus_feature_cache_hit_count + metrics.janus_feature_cache_miss_count;
+    if (lookups > 0) {
+        printf("\n\n");
+        printf("Feature cache           \tCount\n");
+        printf("Hits                    \t%d\n", metrics.janus_feature_cache_hit_count);
+        printf("Misses                  \t%d\n", metrics.janus_feature_cache_miss_count);
+        printf("Evictions               \t%d\n", metrics.janus_feature_cache_eviction_count);
+        printf("Hit rate                \t%.2g\n", double(metrics.janus_feature_cache_hit_count) / lookups);
+    }
+
+    const int comparisons = metrics.janus_score_cache_hit_count + metrics.janus_score_cache_miss_count;
+    if (comparisons > 0) {
+        printf("\n\n");
+        printf("Score cache             \tCount\n");
+        printf("Hits                    \t%d\n", metrics.janus_score_cache_hit_count);
+        printf("Misses                  \t%d\n", metrics.janus_score_cache_miss_count);
+        printf("Hit rate                \t%.2g\n", double(metrics.janus_score_cache_hit_count) / comparisons);
+    }
+
+    if (metrics.janus_skipped_verify_count + metrics.janus_skipped_search_count > 0) {
+        printf("\n\n");
+        printf("Empty template skips    \tCount\n");
+        printf("janus_verify            \t%d\n", metrics.janus_skipped_verify_count);
+        printf("janus_search            \t%d\n", metrics.janus_skipped_search_count);
+    }
+
+    if (metrics.janus_frames_considered_count > 0) {
+        printf("\n\n");
+        printf("Video frames            \tCount\n");
+        printf("Considered              \t%d\n", metrics.janus_frames_considered_count);
+        printf("Augmented               \t%d\n", metrics.janus_frames_augmented_count);
+    }
+
+    if (metrics.janus_cascade_rescored_count > 0) {
+        printf("\n\n");
+        printf("Cascade search          \tCount\n");
+        printf("Rescored                \t%d\n", metrics.janus_cascade_rescored_count);
+        if (metrics.janus_cascade_compared_count > 0) {
+            printf("Compared                \t%d\n", metrics.janus_cascade_compared_count);
+            printf("Rank-1 agreement        \t%.3g\n", double(metrics.janus_cascade_rank1_agreement_count) / metrics.janus_cascade_compared_count);
+            if (metrics.janus_cascade_rankk_expected_count > 0)
+                printf("Rank-k agreement        \t%.3g\n", double(metrics.janus_cascade_rankk_agreement_count) / metrics.janus_cascade_rankk_expected_count);
+        }
+    }
+
+    if (metrics.janus_image_memory.peak_bytes + metrics.janus_flat_template_memory.peak_bytes + metrics.janus_gallery_memory.peak_bytes +
+        metrics.janus_matrix_memory.peak_bytes + metrics.janus_metadata_memory.peak_bytes > 0) {
+        printf("\n\n");
+        printf("Memory                  \tLive\tPeak\tUnits\n");
+        printMemory("Images                  ", metrics.janus_image_memory);
+        printMemory("Flat templates          ", metrics.janus_flat_template_memory);
+        printMemory("Galleries               ", metrics.janus_gallery_memory);
+        printMemory("Matrices                ", metrics.janus_matrix_memory);
+        printMemory("Metadata                ", metrics.janus_metadata_memory);
+    }
+
+    if (metrics.janus_enrollment_peak_rss + metrics.janus_search_peak_rss + metrics.janus_verify_peak_rss > 0) {
+        printf("\n\n");
+        printf("Peak RSS                \tMB\n");
+        if (metrics.janus_enrollment_peak_rss > 0)
+            printf("Enrollment              \t%.2f\n", metrics.janus_enrollment_peak_rss / 1024.0);
+        if (metrics.janus_search_peak_rss > 0)
+            printf("Search                  \t%.2f\n", metrics.janus_search_peak_rss / 1024.0);
+        if (metrics.janus_verify_peak_rss > 0)
+            printf("Verify                  \t%.2f\n", metrics.janus_verify_peak_rss / 1024.0);
+    }
+}
+
+// Visits every field of janus_metrics by name, shared by the JSON writer and reader
+template <typename Visitor>
+static void _janus_visit_metrics(janus_metrics &metrics, Visitor &visitor)
+{
+#define VISIT_METRIC(FIELD, UNITS) visitor.metric(#FIELD, metrics.FIELD, UNITS);
+#define VISIT_COUNT(FIELD) visitor.count(#FIELD, metrics.FIELD);
+#define VISIT_MEMORY(FIELD) visitor.memory(#FIELD, metrics.FIELD);
+#define VISIT_SIZE(FIELD) visitor.size(#FIELD, metrics.FIELD);
+    VISIT_METRIC(janus_initialize_template_speed, "ms")
+    VISIT_METRIC(janus_augment_speed, "ms")
+    VISIT_METRIC(janus_finalize_template_speed, "ms")
+    VISIT_METRIC(janus_read_image_speed, "ms")
+    VISIT_METRIC(janus_read_frame_speed, "ms")
+    VISIT_METRIC(janus_free_image_speed, "ms")
+    VISIT_METRIC(janus_verify_speed, "ms")
+    VISIT_METRIC(janus_search_speed, "ms")
+    VISIT_METRIC(janus_gallery_size_speed, "ms")
+    VISIT_METRIC(janus_finalize_gallery_speed, "ms")
+    VISIT_METRIC(janus_template_size, "KB")
+    VISIT_METRIC(janus_compact_template_speed, "ms")
+    VISIT_METRIC(janus_uncompacted_template_size, "KB")
+    VISIT_METRIC(janus_compacted_template_size, "KB")
+    VISIT_METRIC(janus_cascade_screen_speed, "ms")
+    VISIT_METRIC(janus_cascade_rescore_speed, "ms")
+    VISIT_COUNT(janus_missing_attributes_count)
+    VISIT_COUNT(janus_failure_to_enroll_count)
+    VISIT_COUNT(janus_other_errors_count)
+    VISIT_COUNT(janus_skipped_template_count)
+    VISIT_COUNT(janus_feature_cache_hit_count)
+    VISIT_COUNT(janus_feature_cache_miss_count)
+    VISIT_COUNT(janus_feature_cache_eviction_count)
+    VISIT_COUNT(janus_score_cache_hit_count)
+    VISIT_COUNT(janus_score_cache_miss_count)
+    VISIT_COUNT(janus_skipped_verify_count)
+    VISIT_COUNT(janus_skipped_search_count)
+    VISIT_COUNT(janus_frames_considered_count)
+    VISIT_COUNT(janus_frames_augmented_count)
+    VISIT_COUNT(janus_cascade_rescored_count)
+    VISIT_COUNT(janus_cascade_compared_count)
+    VISIT_COUNT(janus_cascade_rank1_agreement_count)
+    VISIT_COUNT(janus_cascade_rankk_expected_count)
+    VISIT_COUNT(janus_cascade_rankk_agreement_count)
+    VISIT_MEMORY(janus_image_memory)
+    VISIT_MEMORY(janus_flat_template_memory)
+    VISIT_MEMORY(janus_gallery_memory)
+    VISIT_MEMORY(janus_matrix_memory)
+    VISIT_MEMORY(janus_metadata_memory)
+    VISIT_SIZE(janus_enrollment_peak_rss)
+    VISIT_SIZE(janus_search_peak_rss)
+    VISIT_SIZE(janus_verify_peak_rss)
+#undef VISIT_METRIC
+#undef VISIT_COUNT
+#undef VISIT_MEMORY
+#undef VISIT_SIZE
+}
+
+struct MetricsWriter
+{
+    ostream &stream;
+
+    MetricsWriter(ostream &stream)
+        : stream(stream) {}
+
+    // Every field follows the leading "janus_instrumentation"
+    void key(const char *name)
+    {
+        stream << ",\n  \"" << name << "\": ";
+    }
+
+    // JSON has no representation of NaN
+    void number(double value)
+    {
+        if (value == value) stream << value;
+        else                stream << "null";
+    }
+
+    void metric(const char *name, const janus_metric &metric, const char *units)
+    {
+        key(name);
+        stream << "{\"count\": " << metric.count << ", \"mean\": ";
+        number(metric.mean);
+        stream << ", \"stddev\": ";
+        number(metric.stddev);
+        stream << ", \"units\": \"" << units << "\", \"histogram\": [";
+        for (int i=0; i<JANUS_HISTOGRAM_BINS; i++)
+            stream << (i ? ", " : "") << metric.histogram[i];
+        stream << "]}";
+    }
+
+    void count(const char *name, int value)
+    {
+        key(name);
+        stream << value;
+    }
+
+    void memory(const char *name, const janus_memory &memory)
+    {
+        key(name);
+        stream << "{\"live_bytes\": " << memory.live_bytes << ", \"peak_bytes\": " << memory.peak_bytes << "}";
+    }
+
+    void size(const char *name, size_t value)
+    {
+        key(name);
+        stream << value;
+    }
+};
+
+janus_error janus_write_metrics(struct janus_metrics metrics, const char *file_name)
+{
+    ofstream file(file_name);
+    if (!file.is_open())
+        return JANUS_OPEN_ERROR;
+    file.precision(numeric_limits<double>::digits10 + 2);
+    file << "{\n  \"janus_instrumentation\": " << JANUS_INSTRUMENTATION;
+    MetricsWriter writer(file);
+    _janus_visit_metrics(metrics, writer);
+    file << "\n}\n";
+    file.close();
+    return file.fail() ? JANUS_WRITE_ERROR : JANUS_SUCCESS;
+}
+
+// Reads the subset of JSON written by MetricsWriter into numbers keyed by
+// their dotted path, for example "janus_augment_speed.mean"
+struct MetricsReader
+{
+    istream &stream;
+    map<string, vector<double> > values;
+
+    MetricsReader(istream &stream)
+        : stream(stream) {}
+
+    bool expect(char expected)
+    {
+        stream >> ws;
+        return stream.get() == expected;
+    }
+
+    bool readString(string &value)
+    {
+        if (!expect('"'))
+            return false;
+        return bool(getline(stream, value, '"'));
+    }
+
+    bool read(const string &path)
+    {
+        stream >> ws;
+        const int next = stream.peek();
+        if (next == '{') {
+            stream.get();
+            stream >> ws;
+            if (stream.peek() == '}')
+                return bool(stream.get());
+            while (true) {
+                string name;
+                if (!readString(name) || !expect(':') || !read(path.empty() ? name : path + "." + name))
+                    return false;
+                stream >> ws;
+                if (stream.peek() != ',')
+                    return expect('}');
+                stream.get();
+            }
+        } else if (next == '[') {
+            stream.get();
+            stream >> ws;
+            if (stream.peek() == ']')
+                return bool(stream.get());
+            while (true) {
+                if (!read(path))
+                    return false;
+                stream >> ws;
+                if (stream.peek() != ',')
+                    return expect(']');
+                stream.get();
+            }
+        } else if (next == '"') {
+            string ignored;
+            return readString(ignored);
+        } else if (next == 'n') {
+            char literal[4];
+            stream.read(literal, 4);
+            values[path].push_back(numeric_limits<double>::quiet_NaN());
+            return bool(stream) && (strncmp(literal, "null", 4) == 0);
+        } else {
+            double value;
+            stream >> value;
+            values[path].push_back(value);
+            return bool(stream);
+        }
+    }
+
+    double get(const string &path, double fallback) const
+    {
+        map<string, vector<double> >::const_iterator it = values.find(path);
+        return ((it == values.end()) || it->second.empty()) ? fallback : it->second[0];
+    }
+
+    // Visitor for _janus_visit_metrics, fields absent from the file are left empty
+    void metric(const char *name, janus_metric &metric, const char *)
+    {
+        const string prefix = string(name) + ".";
+        metric.count = size_t(get(prefix + "count", 0));
+        metric.mean = get(prefix + "mean", numeric_limits<double>::quiet_NaN());
+        metric.stddev = get(prefix + "stddev", numeric_limits<double>::quiet_NaN());
+        map<string, vector<double> >::const_iterator histogram = values.find(prefix + "histogram");
+        for (int i=0; i<JANUS_HISTOGRAM_BINS; i++)
+            metric.histogram[i] = ((histogram != values.end()) && (size_t(i) < histogram->second.size())) ? size_t(histogram->second[i]) : 0;
+    }
+
+    void count(const char *name, int &value)
+    {
+        value = int(get(name, 0));
+    }
+
+    void memory(const char *name, janus_memory &memory)
+    {
+        memory.live_bytes = size_t(get(string(name) + ".live_bytes", 0));
+        memory.peak_bytes = size_t(get(string(name) + ".peak_bytes", 0));
+    }
+
+    void size(const char *name, size_t &value)
+    {
+        value = size_t(get(name, 0));
+    }
+};
+
+janus_error janus_read_metrics(const char *file_name, struct janus_metrics *metrics)
+{
+    ifstream file(file_name);
+    if (!file.is_open())
+        return JANUS_OPEN_ERROR;
+    MetricsReader reader(file);
+    if (!reader.read(""))
+        return JANUS_PARSE_ERROR;
+    _janus_visit_metrics(*metrics, reader);
+    return JANUS_SUCCESS;
 }
@@ -0,0 +1,216 @@
+// Operating system services used by janus_io.cpp, which is otherwise limited to
+// the C++ Standard Library. POSIX systems get the native implementation, other
+// platforms a portable fallback that is correct for a single process.
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define JANUS_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+static int _janus_process_id()
+{
+#ifdef JANUS_POSIX
+    return int(getpid());
+#else
+    return 0;
+#endif
+}
+
+// Shorten a file to size bytes
+static bool _janus_truncate_file(const char *file_name, size_t size)
+{
+#ifdef JANUS_POSIX
+    return truncate(file_name, off_t(size)) == 0;
+#else
+    std::vector<char> buffer(size);
+    {
+        std::ifstream file(file_name, std::ios::in | std::ios::binary);
+        if (!file.read(buffer.empty() ? NULL : &buffer[0], size))
+            return false;
+    }
+    std::ofstream file(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(buffer.empty() ? NULL : &buffer[0], size);
+    file.close();
+    return !file.fail();
+#endif
+}
+
+// Current resident set size in KB, 0 where unknown
+static size_t _janus_current_rss()
+{
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t pages, residentPages;
+    if (!(statm >> pages >> residentPages))
+        return 0;
+    return residentPages * size_t(sysconf(_SC_PAGESIZE)) / 1024;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t infoCount = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &infoCount) != KERN_SUCCESS)
+        return 0;
+    return size_t(info.resident_size) / 1024;
+#else
+    return 0;
+#endif
+}
+
+// An advisory lock shared by the processes that open the same lock file, held
+// shared or exclusive. The lock file is never renamed or removed, so it can
+// guard files that are replaced while the lock is held.
+struct InterprocessLock
+{
+    int fd;
+
+    InterprocessLock()
+        : fd(-1) {}
+
+    ~InterprocessLock()
+    {
+        close();
+    }
+
+    bool open(const std::string &file_name)
+    {
+        close();
+#ifdef JANUS_POSIX
+        fd = ::open(file_name.c_str(), O_RDWR | O_CREAT, 0666);
+        return fd >= 0;
+#else
+        (void) file_name;
+        fd = 0;
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#ifdef JANUS_POSIX
+        if (fd >= 0)
+            ::close(fd);
+#endif
+        fd = -1;
+    }
+
+    void lock(bool exclusive)
+    {
+#ifdef JANUS_POSIX
+        while ((flock(fd, exclusive ? LOCK_EX : LOCK_SH) != 0) && (errno == EINTR));
+#else
+        (void) exclusive;
+#endif
+    }
+
+    void unlock()
+    {
+#ifdef JANUS_POSIX
+        flock(fd, LOCK_UN);
+#endif
+    }
+
+    // Holds the lock for the lifetime of the guard
+    struct Guard
+    {
+        InterprocessLock &lock;
+        Guard(InterprocessLock &lock, bool exclusive) : lock(lock) { lock.lock(exclusive); }
+        ~Guard() { lock.unlock(); }
+    };
+
+private:
+    InterprocessLock(const InterprocessLock &);
+    InterprocessLock &operator=(const InterprocessLock &);
+};
+
+// A file mapped read-write into memory. On POSIX systems the mapping is shared,
+// so changes are seen immediately by every process mapping the file. Elsewhere
+// the contents are read into memory and written back by flush().
+struct MappedFile
+{
+    char *data;
+    size_t size;
+#ifndef JANUS_POSIX
+    std::string name;
+    std::vector<char> contents;
+#endif
+
+    MappedFile()
+        : data(NULL), size(0) {}
+
+    ~MappedFile()
+    {
+        unmap();
+    }
+
+    bool map(const std::string &file_name)
+    {
+        unmap();
+#ifdef JANUS_POSIX
+        const int fd = ::open(file_name.c_str(), O_RDWR);
+        if (fd < 0)
+            return false;
+        struct stat status;
+        void *mapped = MAP_FAILED;
+        if ((fstat(fd, &status) == 0) && (status.st_size > 0))
+            mapped = mmap(NULL, size_t(status.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+            return false;
+        data = (char*)mapped;
+        size = size_t(status.st_size);
+#else
+        std::ifstream file(file_name.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            return false;
+        contents.resize(size_t(file.tellg()));
+        file.seekg(0);
+        if (contents.empty() || !file.read(&contents[0], contents.size())) {
+            contents.clear();
+            return false;
+        }
+        name = file_name;
+        data = &contents[0];
+        size = contents.size();
+#endif
+        return true;
+    }
+
+    bool flush()
+    {
+#ifdef JANUS_POSIX
+        return true;
+#else
+        std::ofstream file(name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        file.write(data, size);
+        file.close();
+        return !file.fail();
+#endif
+    }
+
+    void unmap()
+    {
+#ifdef JANUS_POSIX
+        if (data)
+            munmap(data, size);
+#else
+        contents.clear();
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
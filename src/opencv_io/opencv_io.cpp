@@ -36,7 +36,14 @@ void janus_free_image(janus_image image)
 
 janus_error janus_open_video(const char *file_name, janus_video *video)
 {
-    *video = reinterpret_cast<janus_video>(new VideoCapture(file_name));
+    VideoCapture *capture = new VideoCapture(file_name);
+    if (!capture->isOpened()) {
+        fprintf(stderr, "Fatal - Janus failed to open: %s\n", file_name);
+        delete capture;
+        *video = NULL;
+        return JANUS_INVALID_VIDEO;
+    }
+    *video = reinterpret_cast<janus_video>(capture);
     return JANUS_SUCCESS;
 }
 
@@ -46,10 +53,30 @@ janus_error janus_read_frame(janus_video video, janus_image *image)
     reinterpret_cast<VideoCapture*>(video)->read(mat);
     if (!mat.data)
         return JANUS_INVALID_VIDEO;
+    if (!mat.isContinuous())
+        mat = mat.clone();
     *image = janusFromOpenCV(mat);
     return JANUS_SUCCESS;
 }
 
+janus_error janus_seek_frame(janus_video video, int frame)
+{
+    // Grabbing skips color conversion and is cheaper than a keyframe seek for short gaps
+    static const int max_grab_distance = 16;
+
+    VideoCapture *capture = reinterpret_cast<VideoCapture*>(video);
+    const int current = int(capture->get(CV_CAP_PROP_POS_FRAMES));
+    if ((frame < current) || (frame - current > max_grab_distance)) {
+        if (!capture->set(CV_CAP_PROP_POS_FRAMES, frame))
+            return JANUS_INVALID_VIDEO;
+    } else {
+        for (int i=current; i<frame; i++)
+            if (!capture->grab())
+                return JANUS_INVALID_VIDEO;
+    }
+    return JANUS_SUCCESS;
+}
+
 void janus_close_video(janus_video video)
 {
     delete reinterpret_cast<VideoCapture*>(video);
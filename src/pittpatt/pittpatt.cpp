@@ -6,6 +6,8 @@
 #include <algorithm>
 #include <utility>
 #include <map>
+#include <atomic>
+#include <mutex>
 
 #include <pittpatt_errors.h>
 #include <pittpatt_license.h>
@@ -15,10 +17,9 @@
 
 using namespace std;
 
-ppr_context_type ppr_context;
-
 struct janus_template_type {
     vector<ppr_face_list_type> ppr_face_lists;
+    vector<size_t> flat_sizes; // Flattened size of each face list, 0 until known
 };
 
 struct janus_gallery_type {
@@ -49,18 +50,89 @@ static janus_error to_janus_error(ppr_error_type error)
         return to_janus_error(ppr_error);      \
 }
 
+// Speed/accuracy trade-offs selected by the janus_initialize algorithm string
+struct ppr_tuning
+{
+    const char *name;
+    int min_size;
+    int max_size;
+    float adaptive_min_size;
+    int search_pruning_aggressiveness;
+    int detection_threads;
+    int comparison_threads;
+};
+
+static const ppr_tuning ppr_tuning_presets[] = {
+    // name       min_size  max_size          adaptive_min_size  pruning  detection_threads  comparison_threads
+    { "fast",     8,        PPR_MAX_MAX_SIZE, 0.05f,             2,       1,                 1 },
+    { "balanced", 4,        PPR_MAX_MAX_SIZE, 0.01f,             0,       1,                 1 },
+    { "accurate", 4,        PPR_MAX_MAX_SIZE, 0.005f,            0,       1,                 1 }
+};
+
+static ppr_tuning ppr_tuning_profile = ppr_tuning_presets[1];
+
+// Parse "[preset][,key=value]...", an empty string selects "balanced"
+static janus_error parse_tuning_profile(const char *algorithm, ppr_tuning *tuning)
+{
+    *tuning = ppr_tuning_presets[1];
+
+    string remaining = algorithm ? algorithm : "";
+    bool first = true;
+    while (!remaining.empty() || first) {
+        const size_t comma = remaining.find(',');
+        const string token = remaining.substr(0, comma);
+        remaining = (comma == string::npos) ? string() : remaining.substr(comma + 1);
+
+        const size_t equals = token.find('=');
+        if (equals == string::npos) {
+            bool found = token.empty() && first;
+            for (size_t i=0; !found && (i<sizeof(ppr_tuning_presets)/sizeof(ppr_tuning_presets[0])); i++)
+                if (token == ppr_tuning_presets[i].name) {
+                    *tuning = ppr_tuning_presets[i];
+                    found = true;
+                }
+            if (!found || !first) {
+                printf("PittPatt 5: Unrecognized tuning profile \"%s\"\n", token.c_str());
+                return JANUS_PARSE_ERROR;
+            }
+        } else {
+            const string key = token.substr(0, equals);
+            const double value = atof(token.substr(equals + 1).c_str());
+            if      (key == "min_size")           tuning->min_size = int(value);
+            else if (key == "max_size")           tuning->max_size = int(value);
+            else if (key == "adaptive_min_size")  tuning->adaptive_min_size = float(value);
+            else if (key == "pruning")            tuning->search_pruning_aggressiveness = int(value);
+            else if (key == "detection_threads")  tuning->detection_threads = int(value);
+            else if (key == "comparison_threads") tuning->comparison_threads = int(value);
+            else {
+                printf("PittPatt 5: Unrecognized tuning parameter \"%s\"\n", key.c_str());
+                return JANUS_PARSE_ERROR;
+            }
+        }
+        first = false;
+    }
+
+    if ((tuning->min_size <= 0) || (tuning->max_size < tuning->min_size) ||
+        (tuning->detection_threads <= 0) || (tuning->comparison_threads <= 0)) {
+        printf("PittPatt 5: Invalid tuning profile \"%s\"\n", algorithm);
+        return JANUS_PARSE_ERROR;
+    }
+    return JANUS_SUCCESS;
+}
+
 static ppr_error_type initialize_ppr_context(ppr_context_type *context)
 {
+    const ppr_tuning &tuning = ppr_tuning_profile;
     ppr_settings_type settings = ppr_get_default_settings();
     settings.detection.enable = 1;
-    settings.detection.min_size = 4;
-    settings.detection.max_size = PPR_MAX_MAX_SIZE;
+    settings.detection.min_size = tuning.min_size;
+    settings.detection.max_size = tuning.max_size;
     settings.detection.adaptive_max_size = 1.f;
-    settings.detection.adaptive_min_size = 0.01f;
+    settings.detection.adaptive_min_size = tuning.adaptive_min_size;
     settings.detection.threshold = 0;
-    settings.detection.use_serial_face_detection = 1;
-    settings.detection.num_threads = 1;
-    settings.detection.search_pruning_aggressiveness = 0;
+    settings.detection.use_serial_face_detection = (tuning.detection_threads == 1) ? 1 : 0;
+    settings.detection.num_threads = tuning.detection_threads;
+    settings.detection.search_pruning_aggressiveness = tuning.search_pruning_aggressiveness;
     settings.detection.detect_best_face_only = 1;
     settings.landmarks.enable = 1;
     settings.landmarks.landmark_range = PPR_LANDMARK_RANGE_COMPREHENSIVE;
@@ -68,33 +140,101 @@ static ppr_error_type initialize_ppr_context(ppr_context_type *context)
     settings.recognition.enable_extraction = 1;
     settings.recognition.enable_comparison = 1;
     settings.recognition.recognizer = PPR_RECOGNIZER_MULTI_POSE;
-    settings.recognition.num_comparison_threads = 1;
+    settings.recognition.num_comparison_threads = tuning.comparison_threads;
     settings.recognition.automatically_extract_templates = 0;
     settings.recognition.extract_thumbnails = 0;
     return ppr_initialize_context(settings, context);
 }
 
-janus_error janus_initialize(const char *sdk_path, const char *temp_path, const char *model_file)
+// PittPatt contexts can not be shared between threads, so each thread leases
+// its own context from a pool on first use and returns it when the thread
+// exits. The generation invalidates outstanding leases after janus_finalize.
+static mutex ppr_contexts_mutex;
+static vector<ppr_context_type> ppr_contexts, ppr_idle_contexts;
+static atomic<int> ppr_contexts_generation(0);
+
+struct ppr_context_lease
+{
+    ppr_context_type context;
+    int generation;
+
+    ppr_context_lease()
+        : generation(-1) {}
+
+    ~ppr_context_lease()
+    {
+        lock_guard<mutex> lock(ppr_contexts_mutex);
+        if (generation == ppr_contexts_generation)
+            ppr_idle_contexts.push_back(context);
+    }
+};
+
+static thread_local ppr_context_lease ppr_lease;
+
+static ppr_error_type lease_ppr_context(ppr_context_type *context)
+{
+    if (ppr_lease.generation != ppr_contexts_generation) {
+        lock_guard<mutex> lock(ppr_contexts_mutex);
+        if (ppr_idle_contexts.empty()) {
+            ppr_context_type new_context;
+            const ppr_error_type ppr_error = initialize_ppr_context(&new_context);
+            if (ppr_error != PPR_SUCCESS)
+                return ppr_error;
+            ppr_contexts.push_back(new_context);
+            ppr_idle_contexts.push_back(new_context);
+        }
+        ppr_lease.context = ppr_idle_contexts.back();
+        ppr_idle_contexts.pop_back();
+        ppr_lease.generation = ppr_contexts_generation;
+    }
+
+    *context = ppr_lease.context;
+    return PPR_SUCCESS;
+}
+
+#define JANUS_LEASE_PPR_CONTEXT                    \
+    ppr_context_type ppr_context;                  \
+    JANUS_TRY_PPR(lease_ppr_context(&ppr_context))
+
+janus_error janus_initialize(const char *sdk_path, const char *temp_path, const char *algorithm, const int nist_dev)
 {
-    (void) model_file;
     (void) temp_path;
+    (void) nist_dev;
+
+    janus_error error = parse_tuning_profile(algorithm, &ppr_tuning_profile);
+    if (error != JANUS_SUCCESS)
+        return error;
+
     const char *models = "/models/";
-    const size_t models_path_len = strlen(sdk_path) + strlen(models);
+    const size_t models_path_len = strlen(sdk_path) + strlen(models) + 1;
     char *models_path = new char[models_path_len];
     snprintf(models_path, models_path_len, "%s%s", sdk_path, models);
 
-    janus_error error = to_janus_error(ppr_initialize_sdk(models_path, my_license_id, my_license_key));
-    free(models_path);
+    error = to_janus_error(ppr_initialize_sdk(models_path, my_license_id, my_license_key));
+    delete[] models_path;
 
     if (error != JANUS_SUCCESS)
         return error;
 
-    return to_janus_error(initialize_ppr_context(&ppr_context));
+    // Create the calling thread's context up front to report any errors
+    ppr_context_type ppr_context;
+    return to_janus_error(lease_ppr_context(&ppr_context));
 }
 
 janus_error janus_finalize()
 {
-    janus_error error = to_janus_error(ppr_finalize_context(ppr_context));
+    janus_error error = JANUS_SUCCESS;
+    {
+        lock_guard<mutex> lock(ppr_contexts_mutex);
+        for (size_t i=0; i<ppr_contexts.size(); i++) {
+            const janus_error context_error = to_janus_error(ppr_finalize_context(ppr_contexts[i]));
+            if (error == JANUS_SUCCESS)
+                error = context_error;
+        }
+        ppr_contexts.clear();
+        ppr_idle_contexts.clear();
+        ppr_contexts_generation++;
+    }
     ppr_finalize_sdk();
 
     return error;
@@ -108,6 +248,8 @@ janus_error janus_allocate_template(janus_template *template_)
 
 janus_error janus_allocate_gallery(janus_gallery *gallery)
 {
+    JANUS_LEASE_PPR_CONTEXT
+
     *gallery = new janus_gallery_type();
     return to_janus_error(ppr_create_gallery(ppr_context, &(*gallery)->ppr_gallery));
 }
@@ -125,6 +267,8 @@ static ppr_error_type to_ppr_image(const janus_image image, ppr_image_type *ppr_
 
 janus_error janus_augment(const janus_image image, const janus_attribute_list attributes, janus_template template_)
 {
+    JANUS_LEASE_PPR_CONTEXT
+
     (void) attributes;
 
     ppr_image_type ppr_image;
@@ -145,6 +289,7 @@ janus_error janus_augment(const janus_image image, const janus_attribute_list at
     }
 
     template_->ppr_face_lists.push_back(face_list);
+    template_->flat_sizes.push_back(0);
 
     ppr_free_image(ppr_image);
 
@@ -158,19 +303,61 @@ janus_error janus_track(janus_template template_, int enabled)
     return JANUS_NOT_IMPLEMENTED;
 }
 
+static const uint32_t pittpatt_template_format = 0x35525050; // "PPR5"
+
+// The janus_template_summary written by janus_flatten_template, zero-filled
+// for templates flattened before the summary was introduced
+static janus_template_summary read_template_summary(const janus_flat_template flat_template, const size_t bytes)
+{
+    janus_template_summary summary;
+    memset(&summary, 0, sizeof(summary));
+    if (bytes < sizeof(summary))
+        return summary;
+
+    memcpy(&summary, flat_template, sizeof(summary));
+    if ((summary.magic != JANUS_TEMPLATE_SUMMARY_MAGIC) || (summary.size < sizeof(summary)) || (summary.size > bytes))
+        memset(&summary, 0, sizeof(summary));
+    return summary;
+}
+
 janus_error janus_flatten_template(janus_template template_, janus_flat_template flat_template, size_t *bytes)
 {
+    JANUS_LEASE_PPR_CONTEXT
+
     ppr_flat_data_type flat_data;
 
-    *bytes = 0;
+    janus_template_summary summary;
+    memset(&summary, 0, sizeof(summary));
+    summary.magic = JANUS_TEMPLATE_SUMMARY_MAGIC;
+    summary.version = JANUS_TEMPLATE_SUMMARY_VERSION;
+    summary.size = sizeof(summary);
+    summary.backend = pittpatt_template_format;
+    summary.empty_score = -1.5;
+
+    janus_flat_template summary_data = flat_template;
+    flat_template += sizeof(summary);
+    *bytes = sizeof(summary);
 
     for (size_t i=0; i<template_->ppr_face_lists.size(); i++) {
         ppr_flatten_face_list(ppr_context, template_->ppr_face_lists[i], &flat_data);
 
         const size_t templateBytes = flat_data.length;
+        template_->flat_sizes[i] = templateBytes;
 
-        if (*bytes + sizeof(size_t) + templateBytes > janus_max_template_size())
+        if (*bytes + sizeof(size_t) + templateBytes > janus_max_template_size()) {
+            ppr_free_flat_data(flat_data);
+            summary.flags |= JANUS_TEMPLATE_TRUNCATED;
             break;
+        }
+
+        const ppr_face_list_type &face_list = template_->ppr_face_lists[i];
+        for (int j=0; j<face_list.length; j++) {
+            int has_template;
+            ppr_face_has_template(ppr_context, face_list.faces[j], &has_template);
+            if (has_template)
+                summary.num_faces++;
+        }
+        summary.num_media++;
 
         memcpy(flat_template, &templateBytes, sizeof(templateBytes));
         flat_template += sizeof(templateBytes);
@@ -183,6 +370,168 @@ janus_error janus_flatten_template(janus_template template_, janus_flat_template
         ppr_free_flat_data(flat_data);
     }
 
+    memcpy(summary_data, &summary, sizeof(summary));
+    return JANUS_SUCCESS;
+}
+
+// Face lists are only flattened the first time their size is needed, sizes of
+// face lists added by janus_merge_flat_template or already flattened are known
+janus_error janus_flattened_size(janus_template template_, size_t *bytes)
+{
+    JANUS_LEASE_PPR_CONTEXT
+
+    *bytes = sizeof(janus_template_summary);
+
+    for (size_t i=0; i<template_->ppr_face_lists.size(); i++) {
+        if (template_->flat_sizes[i] == 0) {
+            ppr_flat_data_type flat_data;
+            ppr_flatten_face_list(ppr_context, template_->ppr_face_lists[i], &flat_data);
+            template_->flat_sizes[i] = flat_data.length;
+            ppr_free_flat_data(flat_data);
+        }
+        const size_t templateBytes = template_->flat_sizes[i];
+
+        if (*bytes + sizeof(size_t) + templateBytes > janus_max_template_size())
+            break;
+
+        *bytes += sizeof(templateBytes) + templateBytes;
+    }
+
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_merge_flat_template(const janus_flat_template flat_template, const size_t bytes, janus_template template_)
+{
+    JANUS_LEASE_PPR_CONTEXT
+
+    janus_flat_template flat_face_list = flat_template + read_template_summary(flat_template, bytes).size;
+    while (flat_face_list < flat_template + bytes) {
+        const size_t flat_face_list_bytes = *reinterpret_cast<size_t*>(flat_face_list);
+        flat_face_list += sizeof(flat_face_list_bytes);
+
+        ppr_flat_data_type flat_data;
+        JANUS_TRY_PPR(ppr_create_flat_data(flat_face_list_bytes, &flat_data))
+        memcpy(flat_data.data, flat_face_list, flat_face_list_bytes);
+
+        ppr_face_list_type face_list;
+        const ppr_error_type ppr_error = ppr_unflatten_face_list(ppr_context, flat_data, &face_list);
+        ppr_free_flat_data(flat_data);
+        if (ppr_error != PPR_SUCCESS)
+            return to_janus_error(ppr_error);
+
+        template_->ppr_face_lists.push_back(face_list);
+        template_->flat_sizes.push_back(flat_face_list_bytes);
+        flat_face_list += flat_face_list_bytes;
+    }
+
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_compact_template(janus_template template_, const size_t max_faces, const size_t max_bytes)
+{
+    JANUS_LEASE_PPR_CONTEXT
+
+    vector<ppr_face_list_type> &face_lists = template_->ppr_face_lists;
+
+    // Candidates are face lists containing at least one extracted face, each
+    // is added to the gallery as its own subject for pairwise comparison
+    ppr_gallery_type gallery;
+    JANUS_TRY_PPR(ppr_create_gallery(ppr_context, &gallery))
+
+    vector<size_t> candidates, sizes;
+    vector<float> qualities;
+    size_t total_bytes = sizeof(janus_template_summary);
+    int face_id = 0;
+    for (size_t i=0; i<face_lists.size(); i++) {
+        float quality = -numeric_limits<float>::max();
+        bool has_templates = false;
+        for (int j=0; j<face_lists[i].length; j++) {
+            ppr_face_type face = face_lists[i].faces[j];
+            int has_template;
+            ppr_face_has_template(ppr_context, face, &has_template);
+            if (!has_template)
+                continue;
+
+            ppr_add_face(ppr_context, &gallery, face, candidates.size(), face_id++);
+            ppr_face_attributes_type face_attributes;
+            ppr_get_face_attributes(face, &face_attributes);
+            quality = max(quality, face_attributes.confidence);
+            has_templates = true;
+        }
+
+        if (!has_templates)
+            continue;
+
+        if (template_->flat_sizes[i] == 0) {
+            ppr_flat_data_type flat_data;
+            ppr_flatten_face_list(ppr_context, face_lists[i], &flat_data);
+            template_->flat_sizes[i] = flat_data.length;
+            ppr_free_flat_data(flat_data);
+        }
+        sizes.push_back(sizeof(size_t) + template_->flat_sizes[i]);
+
+        total_bytes += sizes.back();
+        candidates.push_back(i);
+        qualities.push_back(quality);
+    }
+
+    vector<bool> keep(candidates.size(), true);
+    if (((max_faces > 0) && (candidates.size() > max_faces)) || ((max_bytes > 0) && (total_bytes > max_bytes))) {
+        ppr_similarity_matrix_type simmat;
+        ppr_compare_galleries(ppr_context, gallery, gallery, &simmat);
+
+        // Greedy farthest-point selection seeded with the highest quality face,
+        // each step adds the candidate least similar to those already selected
+        vector<float> closest(candidates.size(), -numeric_limits<float>::max());
+        vector<bool> visited(candidates.size(), false);
+        keep.assign(candidates.size(), false);
+        size_t num_kept = 0, kept_bytes = sizeof(janus_template_summary);
+        for (size_t step=0; (step < candidates.size()) && ((max_faces == 0) || (num_kept < max_faces)); step++) {
+            size_t best = candidates.size();
+            for (size_t k=0; k<candidates.size(); k++) {
+                if (visited[k])
+                    continue;
+                if ((best == candidates.size()) || (closest[k] < closest[best]) ||
+                    ((closest[k] == closest[best]) && (qualities[k] > qualities[best])))
+                    best = k;
+            }
+            visited[best] = true;
+
+            if ((max_bytes > 0) && (kept_bytes + sizes[best] > max_bytes))
+                continue;
+
+            keep[best] = true;
+            num_kept++;
+            kept_bytes += sizes[best];
+            for (size_t k=0; k<candidates.size(); k++) {
+                float similarity;
+                ppr_get_subject_similarity_score(ppr_context, simmat, best, k, &similarity);
+                closest[k] = max(closest[k], similarity);
+            }
+        }
+
+        ppr_free_similarity_matrix(simmat);
+    }
+    ppr_free_gallery(gallery);
+
+    // Retain the selected face lists in their original order
+    vector<ppr_face_list_type> compacted;
+    vector<size_t> compacted_sizes;
+    size_t candidate = 0;
+    for (size_t i=0; i<face_lists.size(); i++) {
+        const bool is_candidate = (candidate < candidates.size()) && (candidates[candidate] == i);
+        if (is_candidate && keep[candidate]) {
+            compacted.push_back(face_lists[i]);
+            compacted_sizes.push_back(template_->flat_sizes[i]);
+        } else {
+            ppr_free_face_list(face_lists[i]);
+        }
+        if (is_candidate)
+            candidate++;
+    }
+    face_lists.swap(compacted);
+    template_->flat_sizes.swap(compacted_sizes);
+
     return JANUS_SUCCESS;
 }
 
@@ -206,11 +555,11 @@ size_t janus_max_template_size()
     return 33554432; // 32 MB
 }
 
-void ppr_unflatten(const janus_flat_template template_, const size_t template_bytes, ppr_gallery_type *gallery)
+static void ppr_unflatten(ppr_context_type ppr_context, const janus_flat_template template_, const size_t template_bytes, ppr_gallery_type *gallery)
 {
     int faceID = 0;
 
-    janus_flat_template flat_template = template_;
+    janus_flat_template flat_template = template_ + read_template_summary(template_, template_bytes).size;
     while (flat_template < template_ + template_bytes) {
         const size_t flat_template_bytes = *reinterpret_cast<size_t*>(flat_template);
         flat_template += sizeof(flat_template_bytes);
@@ -242,18 +591,26 @@ void ppr_unflatten(const janus_flat_template template_, const size_t template_by
 
 janus_error janus_verify(const janus_flat_template a, const size_t a_bytes, const janus_flat_template b, const size_t b_bytes, float *similarity)
 {
+    JANUS_LEASE_PPR_CONTEXT
+
     // Set the default similarity score to be a rejection score (for galleries that don't contain faces)
     *similarity = -1.5;
 
+    const janus_template_summary a_summary = read_template_summary(a, a_bytes);
+    const janus_template_summary b_summary = read_template_summary(b, b_bytes);
+    if (((a_summary.size > 0) && (a_summary.num_faces == 0)) ||
+        ((b_summary.size > 0) && (b_summary.num_faces == 0)))
+        return JANUS_SUCCESS;
+
     ppr_gallery_type query_gallery;
     ppr_create_gallery(ppr_context, &query_gallery);
 
-    ppr_unflatten(a, a_bytes, &query_gallery);
+    ppr_unflatten(ppr_context, a, a_bytes, &query_gallery);
 
     ppr_gallery_type target_gallery;
     ppr_create_gallery(ppr_context, &target_gallery);
 
-    ppr_unflatten(b, b_bytes, &target_gallery);
+    ppr_unflatten(ppr_context, b, b_bytes, &target_gallery);
 
     ppr_similarity_matrix_type simmat;
     ppr_compare_galleries(ppr_context, query_gallery, target_gallery, &simmat);
@@ -269,10 +626,12 @@ janus_error janus_verify(const janus_flat_template a, const size_t a_bytes, cons
     return JANUS_SUCCESS;
 }
 
-static int faceID = 0;
+static atomic<int> faceID(0);
 
 janus_error janus_enroll(const janus_template template_, const janus_template_id template_id, janus_gallery gallery)
 {
+    JANUS_LEASE_PPR_CONTEXT
+
     for (size_t i=0; i<template_->ppr_face_lists.size(); i++) {
         for (int j=0; j<template_->ppr_face_lists[i].length; j++) {
             ppr_face_type face = template_->ppr_face_lists[i].faces[j];
@@ -300,6 +659,8 @@ struct sort_first_greater {
 
 janus_error janus_flatten_gallery(const janus_gallery gallery, janus_flat_gallery flat_gallery, size_t *bytes)
 {
+    JANUS_LEASE_PPR_CONTEXT
+
     ppr_flat_data_type flat_data;
     ppr_flatten_gallery(ppr_context, gallery->ppr_gallery, &flat_data);
 
@@ -311,12 +672,35 @@ janus_error janus_flatten_gallery(const janus_gallery gallery, janus_flat_galler
     return JANUS_SUCCESS;
 }
 
+janus_error janus_write_flat_gallery(const char *flat_gallery_file, const janus_gallery gallery)
+{
+    JANUS_LEASE_PPR_CONTEXT
+
+    ppr_flat_data_type flat_data;
+    JANUS_TRY_PPR(ppr_flatten_gallery(ppr_context, gallery->ppr_gallery, &flat_data))
+
+    // Write straight from the SDK buffer in bounded chunks
+    const size_t flat_bytes = flat_data.length;
+    const size_t chunk_bytes = 1 << 20;
+    ofstream file(flat_gallery_file, ios::out | ios::binary | ios::trunc);
+    for (size_t offset=0; file && (offset < flat_bytes); offset += chunk_bytes)
+        file.write((const char*)flat_data.data + offset, min(chunk_bytes, flat_bytes - offset));
+    const bool success = file.good();
+    file.close();
+
+    ppr_free_flat_data(flat_data);
+
+    return success ? JANUS_SUCCESS : JANUS_WRITE_ERROR;
+}
+
 janus_error janus_search(const janus_flat_template probe, const size_t probe_bytes, janus_flat_gallery gallery, const size_t gallery_bytes, int num_requested_returns, janus_template_id *template_ids, float *similarities, int *num_actual_returns)
 {
+    JANUS_LEASE_PPR_CONTEXT
+
     ppr_gallery_type probe_gallery;
     ppr_create_gallery(ppr_context, &probe_gallery);
 
-    ppr_unflatten(probe, probe_bytes, &probe_gallery);
+    ppr_unflatten(ppr_context, probe, probe_bytes, &probe_gallery);
 
     ppr_flat_data_type flat_data;
     ppr_create_flat_data(gallery_bytes,&flat_data);
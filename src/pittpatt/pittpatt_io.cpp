@@ -10,8 +10,6 @@
 #include "../janus_io.cpp"
 #include "iarpa_janus_io.h"
 
-extern ppr_context_type ppr_context;
-
 static janus_image janusFromPittPatt(ppr_raw_image_type *ppr_image)
 {
     assert(ppr_image);
@@ -24,7 +22,7 @@ static janus_image janusFromPittPatt(ppr_raw_image_type *ppr_image)
     image.width = ppr_image->width;
     image.height = ppr_image->height;
     image.color_space = (ppr_image->color_space == PPR_RAW_IMAGE_GRAY8 ? JANUS_GRAY8 : JANUS_BGR24);
-    image.data = new janus_data[image.width * image.height * (image.color_space == JANUS_BGR24 ? 3 : 1)];
+    image.data = (janus_data*)malloc(image.width * image.height * (image.color_space == JANUS_BGR24 ? 3 : 1));
     const unsigned long elements_per_row = image.width * (image.color_space == JANUS_BGR24 ? 3 : 1);
     for (int i=0; i<ppr_image->height; i++)
         memcpy(image.data + i*elements_per_row, ppr_image->data + i*ppr_image->bytes_per_line, elements_per_row);
@@ -47,34 +45,61 @@ void janus_free_image(janus_image image)
     free(image.data);
 }
 
-janus_error janus_open_video(const char *file_name, janus_video *video)
+struct janus_video_type
 {
     ppr_video_io_type ppr_video;
-    ppr_video_io_error_type error = ppr_video_io_open(&ppr_video, file_name);
+    string file_name;
+    int frame; // Index of the frame returned by the next call to janus_read_frame
+};
+
+janus_error janus_open_video(const char *file_name, janus_video *video)
+{
+    *video = new janus_video_type();
+    (*video)->file_name = file_name;
+    (*video)->frame = 0;
+    ppr_video_io_error_type error = ppr_video_io_open(&(*video)->ppr_video, file_name);
     if (error != PPR_VIDEO_IO_SUCCESS) {
+        delete *video;
         *video = NULL;
         return JANUS_INVALID_VIDEO;
     }
-    *video = (janus_video)ppr_video;
     return JANUS_SUCCESS;
 }
 
 janus_error janus_read_frame(janus_video video, janus_image *image)
 {
-    (void) video;
-    (void) image;
-    /*
     ppr_raw_image_type ppr_frame;
-    ppr_video_io_error_type error = ppr_video_io_get_frame((ppr_video_io_type)video, &ppr_frame);
-    error = error || ppr_video_io_step_forward((ppr_video_io_type)video);
-    if (error != PPR_VIDEO_IO_SUCCESS)
+    if (ppr_video_io_get_frame(video->ppr_video, &ppr_frame) != PPR_VIDEO_IO_SUCCESS)
         return JANUS_INVALID_VIDEO;
-    *image = janus_from_pittpatt(&ppr_frame);
-    ppr_raw_image_free(ppr_frame);*/
+    *image = janusFromPittPatt(&ppr_frame);
+    ppr_raw_image_free(ppr_frame);
+
+    // Stepping past the last frame is reported by the next call to ppr_video_io_get_frame
+    ppr_video_io_step_forward(video->ppr_video);
+    video->frame++;
+    return JANUS_SUCCESS;
+}
+
+janus_error janus_seek_frame(janus_video video, int frame)
+{
+    // PittPatt video I/O only steps forward, so seeking backwards reopens the video
+    if (frame < video->frame) {
+        ppr_video_io_close(video->ppr_video);
+        video->frame = 0;
+        if (ppr_video_io_open(&video->ppr_video, video->file_name.c_str()) != PPR_VIDEO_IO_SUCCESS)
+            return JANUS_INVALID_VIDEO;
+    }
+
+    while (video->frame < frame) {
+        if (ppr_video_io_step_forward(video->ppr_video) != PPR_VIDEO_IO_SUCCESS)
+            return JANUS_INVALID_VIDEO;
+        video->frame++;
+    }
     return JANUS_SUCCESS;
 }
 
 void janus_close_video(janus_video video)
 {
-    ppr_video_io_close((ppr_video_io_type)video);
+    ppr_video_io_close(video->ppr_video);
+    delete video;
 }
@@ -4,6 +4,7 @@
 
 #include "iarpa_janus.h"
 #include "iarpa_janus_io.h"
+#include "iarpa_janus.hpp"
 
 const char *get_ext(const char *filename) {
     const char *dot = strrchr(filename, '.');
@@ -13,14 +14,14 @@ const char *get_ext(const char *filename) {
 
 void printUsage()
 {
-    printf("Usage: janus_create_gallery sdk_path temp_path data_path metadata_file gallery_file [-algorithm <algorithm>] [-verbose]\n");
+    printf("Usage: janus_create_gallery sdk_path temp_path data_path metadata_file gallery_file [-algorithm <algorithm>] [-cache <MB>] [-dedup <threshold>] [-max_frames <count>] [-max_faces <count>] [-max_template_kb <KB>] [-summary_faces <count>] [-verbose] [-metrics <metrics.json>]\n");
 }
 
 int main(int argc, char *argv[])
 {
     int requiredArgs = 6;
 
-    if ((argc < requiredArgs) || (argc > 9)) {
+    if ((argc < requiredArgs) || (argc > 23)) {
         printUsage();
         return 1;
     }
@@ -36,36 +37,81 @@ int main(int argc, char *argv[])
     }
 
     char *algorithm = NULL;
+    const char *metrics_file = NULL;
     int verbose = 0;
+    size_t cache_mb = 0;
+    double dedup = 0;
+    int max_frames = 0;
+    size_t max_faces = 0;
+    size_t max_template_kb = 0;
+    size_t summary_faces = 0;
 
     for (int i=0; i<argc-requiredArgs; i++)
         if (strcmp(argv[requiredArgs+i],"-algorithm") == 0)
             algorithm = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-cache") == 0)
+            cache_mb = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-dedup") == 0)
+            dedup = atof(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-max_frames") == 0)
+            max_frames = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-max_faces") == 0)
+            max_faces = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-max_template_kb") == 0)
+            max_template_kb = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-summary_faces") == 0)
+            summary_faces = atoi(argv[requiredArgs+(++i)]);
         else if (strcmp(argv[requiredArgs+i],"-verbose") == 0)
             verbose = 1;
+        else if (strcmp(argv[requiredArgs+i],"-metrics") == 0)
+            metrics_file = argv[requiredArgs+(++i)];
         else {
             fprintf(stderr, "Unrecognized flag: %s\n", argv[requiredArgs+i]);
             return 1;
         }
 
-    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm))
+    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm, 0))
+    if (cache_mb > 0)
+        JANUS_ASSERT(janus_set_feature_cache(argv[2], algorithm, cache_mb * 1024 * 1024))
+    JANUS_ASSERT(janus_set_frame_selection(dedup, max_frames))
+    JANUS_ASSERT(janus_set_template_compaction(max_faces, max_template_kb * 1024))
 
-    janus_gallery gallery;
-    JANUS_ASSERT(janus_allocate_gallery(&gallery))
+    // Cascade galleries are written by the harness alongside their summaries
+    if (summary_faces > 0) {
+        JANUS_ASSERT(janus_create_cascade_gallery(argv[3], argv[4], argv[5], summary_faces, verbose))
+        JANUS_ASSERT(janus_finalize())
 
-    JANUS_ASSERT(janus_create_gallery(argv[3], argv[4], gallery, verbose))
+        const janus_metrics metrics = janus_get_metrics();
+        janus_print_metrics(metrics);
+        if (metrics_file)
+            JANUS_ASSERT(janus_write_metrics(metrics, metrics_file))
+        return EXIT_SUCCESS;
+    }
+
+    janus::Gallery gallery;
+    JANUS_ASSERT(janus_allocate_gallery(gallery.put()))
+
+    JANUS_ASSERT(janus_create_gallery(argv[3], argv[4], gallery.get(), verbose))
 
     janus_metrics metrics = janus_get_metrics();
-    size_t size = metrics.janus_initialize_template_speed.count;
-    janus_flat_gallery flat_gallery = new janus_data[size*janus_max_template_size()];
-    size_t bytes;
-    JANUS_ASSERT(janus_flatten_gallery(gallery, flat_gallery, &bytes))
-    std::ofstream file;
-    file.open(argv[5], std::ios::out | std::ios::binary);
-    file.write((char*)flat_gallery, bytes);
-    file.close();
+    const janus_error write_error = janus_write_flat_gallery(argv[5], gallery.get());
+    if (write_error == JANUS_NOT_IMPLEMENTED) {
+        size_t size = metrics.janus_initialize_template_speed.count;
+        janus::Buffer flat_gallery(size*janus_max_template_size());
+        size_t bytes;
+        JANUS_ASSERT(janus_flatten_gallery(gallery.get(), flat_gallery.data(), &bytes))
+        std::ofstream file;
+        file.open(argv[5], std::ios::out | std::ios::binary);
+        file.write((char*)flat_gallery.data(), bytes);
+        file.close();
+    } else {
+        JANUS_ASSERT(write_error)
+    }
+    gallery.reset();
     JANUS_ASSERT(janus_finalize())
 
     janus_print_metrics(metrics);
+    if (metrics_file)
+        JANUS_ASSERT(janus_write_metrics(metrics, metrics_file))
     return EXIT_SUCCESS;
 }
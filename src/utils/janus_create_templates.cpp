@@ -12,14 +12,14 @@ const char *get_ext(const char *filename) {
 
 void printUsage()
 {
-    printf("Usage: janus_create_templates sdk_path temp_path data_path metadata_file gallery_file [-algorithm <algorithm>] [-verbose]\n");
+    printf("Usage: janus_create_templates sdk_path temp_path data_path metadata_file gallery_file [-algorithm <algorithm>] [-cache <MB>] [-dedup <threshold>] [-max_frames <count>] [-max_faces <count>] [-max_template_kb <KB>] [-resume] [-trace <trace.json>] [-verbose] [-metrics <metrics.json>]\n");
 }
 
 int main(int argc, char *argv[])
 {
     int requiredArgs = 6;
 
-    if ((argc < requiredArgs) || (argc > 9)) {
+    if ((argc < requiredArgs) || (argc > 24)) {
         printUsage();
         return 1;
     }
@@ -35,23 +35,60 @@ int main(int argc, char *argv[])
     }
 
     char *algorithm = NULL;
+    const char *metrics_file = NULL;
     int verbose = 0;
+    bool resume = false;
+    size_t cache_mb = 0;
+    double dedup = 0;
+    int max_frames = 0;
+    size_t max_faces = 0;
+    size_t max_template_kb = 0;
+    const char *trace = NULL;
 
     for (int i=0; i<argc-requiredArgs; i++)
         if (strcmp(argv[requiredArgs+i],"-algorithm") == 0)
             algorithm = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-cache") == 0)
+            cache_mb = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-dedup") == 0)
+            dedup = atof(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-max_frames") == 0)
+            max_frames = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-max_faces") == 0)
+            max_faces = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-max_template_kb") == 0)
+            max_template_kb = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-resume") == 0)
+            resume = true;
+        else if (strcmp(argv[requiredArgs+i],"-trace") == 0)
+            trace = argv[requiredArgs+(++i)];
         else if (strcmp(argv[requiredArgs+i],"-verbose") == 0)
             verbose = 1;
+        else if (strcmp(argv[requiredArgs+i],"-metrics") == 0)
+            metrics_file = argv[requiredArgs+(++i)];
         else {
             fprintf(stderr, "Unrecognized flag: %s\n", argv[requiredArgs+i]);
             return 1;
         }
 
-    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm))
-    JANUS_ASSERT(janus_create_templates(argv[3], argv[4], argv[5], verbose))
+    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm, 0))
+    if (cache_mb > 0)
+        JANUS_ASSERT(janus_set_feature_cache(argv[2], algorithm, cache_mb * 1024 * 1024))
+    JANUS_ASSERT(janus_set_frame_selection(dedup, max_frames))
+    JANUS_ASSERT(janus_set_template_compaction(max_faces, max_template_kb * 1024))
+    if (trace)
+        JANUS_ASSERT(janus_set_trace_file(trace))
+    if (resume)
+        JANUS_ASSERT(janus_resume_create_templates(argv[3], argv[4], argv[5], verbose))
+    else
+        JANUS_ASSERT(janus_create_templates(argv[3], argv[4], argv[5], verbose))
+    JANUS_ASSERT(janus_set_trace_file(NULL))
     JANUS_ASSERT(janus_finalize())
 
-    janus_print_metrics(janus_get_metrics());
+    const janus_metrics metrics = janus_get_metrics();
+    janus_print_metrics(metrics);
+    if (metrics_file)
+        JANUS_ASSERT(janus_write_metrics(metrics, metrics_file))
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,37 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "iarpa_janus.h"
+#include "iarpa_janus_io.h"
+using namespace std;
+
+const char *get_ext(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    if (!dot || dot == filename) return "";
+    return dot + 1;
+}
+
+void printUsage()
+{
+    printf("Usage: janus_decode_matrix encoded_matrix decoded_matrix\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int requiredArgs = 3;
+
+    if (argc != requiredArgs) {
+        printUsage();
+        return 1;
+    }
+
+    const char *ext1 = get_ext(argv[1]);
+    const char *ext2 = get_ext(argv[2]);
+    if ((strcmp(ext1, "mtx") != 0 && strcmp(ext1, "mask") != 0) || strcmp(ext1, ext2) != 0) {
+        printf("Matrix files should both be \".mtx\" or \".mask\" format.\n");
+        return 1;
+    }
+
+    JANUS_ASSERT(janus_decode_matrix(argv[1], argv[2]))
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "iarpa_janus.h"
+#include "iarpa_janus_io.h"
+using namespace std;
+
+const char *get_ext(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    if (!dot || dot == filename) return "";
+    return dot + 1;
+}
+
+void printUsage()
+{
+    printf("Usage: janus_evaluate_pairs sdk_path temp_path target_gallery query_gallery target_metadata query_metadata pairs scores mask [-algorithm <algorithm>] [-score_cache] [-metrics <metrics.json>]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int requiredArgs = 10;
+
+    if ((argc < requiredArgs) || (argc > 15)) {
+        printUsage();
+        return 1;
+    }
+
+    if (strcmp(get_ext(argv[3]), "gal") != 0 || strcmp(get_ext(argv[4]), "gal") != 0) {
+        printf("Gallery files must be \".gal\" format.\n");
+        return 1;
+    }
+    for (int i=5; i<requiredArgs; i++)
+        if (strcmp(get_ext(argv[i]), "csv") != 0) {
+            printf("Metadata, pair, score and mask files must be \".csv\" format.\n");
+            return 1;
+        }
+
+    char *algorithm = NULL;
+    const char *metrics_file = NULL;
+    bool score_cache = false;
+    for (int i=0; i<argc-requiredArgs; i++)
+        if (strcmp(argv[requiredArgs+i],"-algorithm") == 0)
+            algorithm = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-score_cache") == 0)
+            score_cache = true;
+        else if (strcmp(argv[requiredArgs+i],"-metrics") == 0)
+            metrics_file = argv[requiredArgs+(++i)];
+        else {
+            fprintf(stderr, "Unrecognized flag: %s\n", argv[requiredArgs+i]);
+            return 1;
+        }
+
+    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm, 0))
+    if (score_cache)
+        JANUS_ASSERT(janus_set_score_cache(argv[2], algorithm))
+    JANUS_ASSERT(janus_evaluate_verify_pairs(argv[3], argv[4], argv[5], argv[6], argv[7], argv[8], argv[9]))
+    JANUS_ASSERT(janus_finalize())
+
+    const janus_metrics metrics = janus_get_metrics();
+    janus_print_metrics(metrics);
+    if (metrics_file)
+        JANUS_ASSERT(janus_write_metrics(metrics, metrics_file))
+    return EXIT_SUCCESS;
+}
@@ -1,9 +1,9 @@
 #include <stdlib.h>
 #include <string.h>
-#include <fstream>
 
 #include "iarpa_janus.h"
 #include "iarpa_janus_io.h"
+#include "iarpa_janus.hpp"
 using namespace std;
 
 const char *get_ext(const char *filename) {
@@ -14,14 +14,14 @@ const char *get_ext(const char *filename) {
 
 void printUsage()
 {
-    printf("Usage: janus_evaluate_search sdk_path temp_path target_gallery query_gallery target_metadata query_metadata simmat mask num_returns [-algorithm <algorithm>]\n");
+    printf("Usage: janus_evaluate_search sdk_path temp_path target_gallery query_gallery target_metadata query_metadata simmat mask num_returns [-algorithm <algorithm>] [-eval <results.csv>] [-no_matrix] [-score_encoding <float32|float16|quantized8>] [-mask_encoding <byte|packed2>] [-cascade <survivors>] [-agreement] [-trace <trace.json>] [-metrics <metrics.json>]\n");
 }
 
 int main(int argc, char *argv[])
 {
     int requiredArgs = 10;
 
-    if ((argc < requiredArgs) || (argc > 12)) {
+    if ((argc < requiredArgs) || (argc > 26)) {
         printUsage();
         return 1;
     }
@@ -32,8 +32,8 @@ int main(int argc, char *argv[])
     const char *ext5 = get_ext(argv[7]);
     const char *ext6 = get_ext(argv[8]);
 
-    if (strcmp(ext1, "gal") != 0 || strcmp(ext2, "gal") != 0) {
-        printf("Gallery files must be \".gal\" format.\n");
+    if ((strcmp(ext1, "gal") != 0 && strcmp(ext1, "idx") != 0) || strcmp(ext2, "gal") != 0) {
+        printf("Gallery files must be \".gal\" format, or \".idx\" for an incremental target gallery.\n");
         return 1;
     } else if (strcmp(ext3, "csv") != 0 || strcmp(ext4, "csv") != 0) {
         printf("Metadata files must be \".csv\" format. \n");
@@ -47,28 +47,77 @@ int main(int argc, char *argv[])
     }
 
     char *algorithm = NULL;
+    const char *metrics_file = NULL;
+    const char *results = NULL;
+    bool write_matrix = true;
+    janus_score_encoding score_encoding = JANUS_SCORES_FLOAT32;
+    janus_mask_encoding mask_encoding = JANUS_MASK_BYTE;
+    const char *trace = NULL;
+    int num_survivors = 0;
+    int agreement = 0;
     for (int i=0; i<argc-requiredArgs; i++)
         if (strcmp(argv[requiredArgs+i],"-algorithm") == 0)
             algorithm = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-eval") == 0)
+            results = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-no_matrix") == 0)
+            write_matrix = false;
+        else if (strcmp(argv[requiredArgs+i],"-trace") == 0)
+            trace = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-cascade") == 0)
+            num_survivors = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-agreement") == 0)
+            agreement = 1;
+        else if ((strcmp(argv[requiredArgs+i],"-score_encoding") == 0) || (strcmp(argv[requiredArgs+i],"-mask_encoding") == 0)) {
+            const char *option = argv[requiredArgs+i];
+            if (janus_parse_encoding(option, argv[requiredArgs+(++i)], &score_encoding, &mask_encoding) != JANUS_SUCCESS)
+                return 1;
+        } else if (strcmp(argv[requiredArgs+i],"-metrics") == 0)
+            metrics_file = argv[requiredArgs+(++i)];
         else {
             fprintf(stderr, "Unrecognized flag: %s\n", argv[requiredArgs+i]);
             return 1;
         }
 
-    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm))
+    if ((num_survivors > 0) && (strcmp(ext1, "gal") != 0)) {
+        printf("Cascade search requires a \".gal\" target gallery written with -summary_faces.\n");
+        return 1;
+    }
+
+    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm, 0))
+    JANUS_ASSERT(janus_set_online_evaluation(results))
+    JANUS_ASSERT(janus_set_matrix_encoding(score_encoding, mask_encoding))
+    if (trace)
+        JANUS_ASSERT(janus_set_trace_file(trace))
+    const char *simmat = write_matrix ? argv[7] : NULL;
+    const char *mask = write_matrix ? argv[8] : NULL;
     int num_requested_returns = atoi(argv[9]);
 
-    std::ifstream target;
-    target.open(argv[3], std::ios::binary | std::ios::ate);
-    size_t target_bytes = target.tellg();
-    target.seekg(0, ios::beg);
+    if ((strcmp(ext1, "idx") == 0) || (num_survivors > 0)) {
+        if (num_survivors > 0)
+            JANUS_ASSERT(janus_evaluate_cascade_search(argv[3], argv[4], argv[5], argv[6], simmat, mask, num_requested_returns, num_survivors, agreement))
+        else
+            JANUS_ASSERT(janus_evaluate_incremental_search(argv[3], argv[4], argv[5], argv[6], simmat, mask, num_requested_returns))
+        JANUS_ASSERT(janus_set_trace_file(NULL))
+        JANUS_ASSERT(janus_finalize())
+
+        const janus_metrics metrics = janus_get_metrics();
+        janus_print_metrics(metrics);
+        if (metrics_file)
+            JANUS_ASSERT(janus_write_metrics(metrics, metrics_file))
+        return EXIT_SUCCESS;
+    }
 
-    janus_flat_gallery target_flat = new janus_data[target_bytes];
-    target.read((char*)target_flat, target_bytes);
+    janus::Buffer target;
+    JANUS_ASSERT(target.read(argv[3]))
 
-    JANUS_ASSERT(janus_evaluate_search(target_flat, target_bytes, argv[4], argv[5], argv[6], argv[7], argv[8], num_requested_returns))
+    JANUS_ASSERT(janus_evaluate_search(target.data(), target.size(), argv[4], argv[5], argv[6], simmat, mask, num_requested_returns))
+    JANUS_ASSERT(janus_set_trace_file(NULL))
     JANUS_ASSERT(janus_finalize())
 
-    janus_print_metrics(janus_get_metrics());
+    const janus_metrics metrics = janus_get_metrics();
+    janus_print_metrics(metrics);
+    if (metrics_file)
+        JANUS_ASSERT(janus_write_metrics(metrics, metrics_file))
     return EXIT_SUCCESS;
 }
@@ -14,14 +14,14 @@ const char *get_ext(const char *filename) {
 
 void printUsage()
 {
-    printf("Usage: janus_evaluate_verify sdk_path temp_path target_gallery query_gallery target_metadata query_metadata simmat mask [-algorithm <algorithm>]\n");
+    printf("Usage: janus_evaluate_verify sdk_path temp_path target_gallery query_gallery target_metadata query_metadata simmat mask [-algorithm <algorithm>] [-score_cache] [-eval <results.csv>] [-no_matrix] [-score_encoding <float32|float16|quantized8>] [-mask_encoding <byte|packed2>] [-rows <begin> <end>] [-columns <begin> <end>] [-symmetric | -asymmetric] [-packed] [-threads <n>] [-metrics <metrics.json>]\n");
 }
 
 int main(int argc, char *argv[])
 {
     int requiredArgs = 9;
 
-    if ((argc < requiredArgs) || (argc > 11)) {
+    if ((argc < requiredArgs) || (argc > 31)) {
         printUsage();
         return 1;
     }
@@ -47,18 +47,73 @@ int main(int argc, char *argv[])
     }
 
     char *algorithm = NULL;
+    const char *metrics_file = NULL;
+    bool score_cache = false;
+    const char *results = NULL;
+    bool write_matrix = true;
+    janus_score_encoding score_encoding = JANUS_SCORES_FLOAT32;
+    janus_mask_encoding mask_encoding = JANUS_MASK_BYTE;
+    int row_begin = 0, row_end = -1, column_begin = 0, column_end = -1;
+    bool block = false;
+    int symmetric = 0, packed = 0;
+    int threads = 1;
     for (int i=0; i<argc-requiredArgs; i++)
         if (strcmp(argv[requiredArgs+i],"-algorithm") == 0)
             algorithm = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-score_cache") == 0)
+            score_cache = true;
+        else if (strcmp(argv[requiredArgs+i],"-eval") == 0)
+            results = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-no_matrix") == 0)
+            write_matrix = false;
+        else if ((strcmp(argv[requiredArgs+i],"-score_encoding") == 0) || (strcmp(argv[requiredArgs+i],"-mask_encoding") == 0)) {
+            const char *option = argv[requiredArgs+i];
+            if (janus_parse_encoding(option, argv[requiredArgs+(++i)], &score_encoding, &mask_encoding) != JANUS_SUCCESS)
+                return 1;
+        } else if (strcmp(argv[requiredArgs+i],"-rows") == 0) {
+            row_begin = atoi(argv[requiredArgs+(++i)]);
+            row_end = atoi(argv[requiredArgs+(++i)]);
+            block = true;
+        } else if (strcmp(argv[requiredArgs+i],"-columns") == 0) {
+            column_begin = atoi(argv[requiredArgs+(++i)]);
+            column_end = atoi(argv[requiredArgs+(++i)]);
+            block = true;
+        } else if (strcmp(argv[requiredArgs+i],"-symmetric") == 0)
+            symmetric = 1;
+        else if (strcmp(argv[requiredArgs+i],"-asymmetric") == 0)
+            symmetric = -1;
+        else if (strcmp(argv[requiredArgs+i],"-packed") == 0)
+            packed = 1;
+        else if (strcmp(argv[requiredArgs+i],"-threads") == 0)
+            threads = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-metrics") == 0)
+            metrics_file = argv[requiredArgs+(++i)];
         else {
             fprintf(stderr, "Unrecognized flag: %s\n", argv[requiredArgs+i]);
             return 1;
         }
 
-    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm))
-    JANUS_ASSERT(janus_evaluate_verify(argv[3], argv[4], argv[5], argv[6], argv[7], argv[8]))
+    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm, 0))
+    if (score_cache)
+        JANUS_ASSERT(janus_set_score_cache(argv[2], algorithm))
+    JANUS_ASSERT(janus_set_symmetric_verify(symmetric, packed))
+    JANUS_ASSERT(janus_set_online_evaluation(results))
+    JANUS_ASSERT(janus_set_matrix_encoding(score_encoding, mask_encoding))
+    if (threads != 1)
+        JANUS_ASSERT(janus_initialize_async(threads))
+    const char *simmat = write_matrix ? argv[7] : NULL;
+    const char *mask = write_matrix ? argv[8] : NULL;
+    if (block)
+        JANUS_ASSERT(janus_evaluate_verify_block(argv[3], argv[4], argv[5], argv[6], argv[7], argv[8], row_begin, row_end, column_begin, column_end))
+    else
+        JANUS_ASSERT(janus_evaluate_verify(argv[3], argv[4], argv[5], argv[6], simmat, mask))
+    if (threads != 1)
+        JANUS_ASSERT(janus_finalize_async())
     JANUS_ASSERT(janus_finalize())
 
-    janus_print_metrics(janus_get_metrics());
+    const janus_metrics metrics = janus_get_metrics();
+    janus_print_metrics(metrics);
+    if (metrics_file)
+        JANUS_ASSERT(janus_write_metrics(metrics, metrics_file))
     return EXIT_SUCCESS;
 }
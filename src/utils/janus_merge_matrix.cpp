@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "iarpa_janus.h"
+#include "iarpa_janus_io.h"
+using namespace std;
+
+const char *get_ext(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    if (!dot || dot == filename) return "";
+    return dot + 1;
+}
+
+void printUsage()
+{
+    printf("Usage: janus_merge_matrix matrix block [block ...] [-score_encoding <float32|float16|quantized8>] [-mask_encoding <byte|packed2>]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int requiredArgs = 3;
+
+    if (argc < requiredArgs) {
+        printUsage();
+        return 1;
+    }
+
+    const char *ext = get_ext(argv[1]);
+    if (strcmp(ext, "mtx") != 0 && strcmp(ext, "mask") != 0) {
+        printf("Matrix files should be \".mtx\" or \".mask\" format.\n");
+        return 1;
+    }
+
+    vector<janus_matrix> blocks;
+    janus_score_encoding score_encoding = JANUS_SCORES_FLOAT32;
+    janus_mask_encoding mask_encoding = JANUS_MASK_BYTE;
+    for (int i=requiredArgs-1; i<argc; i++) {
+        if (((strcmp(argv[i],"-score_encoding") == 0) || (strcmp(argv[i],"-mask_encoding") == 0)) && i+1 < argc) {
+            const char *option = argv[i];
+            if (janus_parse_encoding(option, argv[++i], &score_encoding, &mask_encoding) != JANUS_SUCCESS)
+                return 1;
+        } else if (strcmp(get_ext(argv[i]), ext) != 0) {
+            printf("Block files should be \".%s\" format.\n", ext);
+            return 1;
+        } else {
+            blocks.push_back(argv[i]);
+        }
+    }
+
+    if (blocks.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    JANUS_ASSERT(janus_set_matrix_encoding(score_encoding, mask_encoding))
+    JANUS_ASSERT(janus_merge_matrix_blocks(&blocks[0], int(blocks.size()), argv[1]))
+    return EXIT_SUCCESS;
+}
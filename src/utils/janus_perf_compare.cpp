@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "iarpa_janus.h"
+#include "iarpa_janus_io.h"
+using namespace std;
+
+const char *get_ext(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    if (!dot || dot == filename) return "";
+    return dot + 1;
+}
+
+void printUsage()
+{
+    printf("Usage: janus_perf_compare baseline_metrics current_metrics [-threshold <percent>] [-memory_threshold <percent>] [-alpha <p>] [-min_count <count>]\n");
+}
+
+static size_t histogramCount(const janus_metric &metric)
+{
+    size_t count = 0;
+    for (int i=0; i<JANUS_HISTOGRAM_BINS; i++)
+        count += metric.histogram[i];
+    return count;
+}
+
+// One-sided p-value that samples of a tend to exceed samples of b.
+// Mann-Whitney U test with samples in the same histogram bin tied, falling
+// back to Welch's t-test on the moments when histograms were not recorded.
+static double greaterPValue(const janus_metric &a, const janus_metric &b)
+{
+    const double n1 = histogramCount(a), n2 = histogramCount(b);
+    if ((n1 > 0) && (n2 > 0)) {
+        double below = 0, rankSum = 0, ties = 0;
+        for (int i=0; i<JANUS_HISTOGRAM_BINS; i++) {
+            const double tied = double(a.histogram[i]) + double(b.histogram[i]);
+            rankSum += a.histogram[i] * (below + (tied + 1) / 2);
+            ties += tied * tied * tied - tied;
+            below += tied;
+        }
+        const double n = n1 + n2;
+        const double u = rankSum - n1 * (n1 + 1) / 2;
+        const double variance = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+        if (variance <= 0)
+            return 1;
+        return 0.5 * erfc((u - n1 * n2 / 2 - 0.5) / sqrt(2 * variance));
+    }
+
+    if ((a.count < 2) || (b.count < 2) || (a.mean != a.mean) || (b.mean != b.mean))
+        return numeric_limits<double>::quiet_NaN();
+    const double error = sqrt(a.stddev * a.stddev / a.count + b.stddev * b.stddev / b.count);
+    if (error <= 0)
+        return (a.mean > b.mean) ? 0 : 1;
+    return 0.5 * erfc((a.mean - b.mean) / error / sqrt(2.0));
+}
+
+struct Comparison
+{
+    double threshold, memoryThreshold, alpha;
+    size_t minCount;
+    int regressions;
+
+    Comparison()
+        : threshold(10), memoryThreshold(10), alpha(0.01), minCount(10), regressions(0) {}
+
+    static double change(double baseline, double current)
+    {
+        return (baseline > 0) ? 100 * (current - baseline) / baseline : 0;
+    }
+
+    void report(const char *name, double baseline, double current, double p, const char *status)
+    {
+        if (strcmp(status, "regression") == 0)
+            regressions++;
+        printf("%-32s\t%.3g\t%.3g\t%+.1f%%\t%.2g\t%s\n", name, baseline, current, change(baseline, current), p, status);
+    }
+
+    // Latencies regress when the mean grows beyond the threshold and the
+    // distribution has significantly shifted upwards
+    void speed(const char *name, const janus_metric &baseline, const janus_metric &current)
+    {
+        if ((baseline.count == 0) && (current.count == 0))
+            return;
+        if ((baseline.count < minCount) || (current.count < minCount)) {
+            report(name, baseline.mean, current.mean, numeric_limits<double>::quiet_NaN(), "insufficient");
+            return;
+        }
+
+        const double slower = greaterPValue(current, baseline);
+        const double faster = greaterPValue(baseline, current);
+        const double delta = change(baseline.mean, current.mean);
+        if      ((delta >  threshold) && (slower < alpha)) report(name, baseline.mean, current.mean, slower, "regression");
+        else if ((delta < -threshold) && (faster < alpha)) report(name, baseline.mean, current.mean, faster, "improvement");
+        else                                               report(name, baseline.mean, current.mean, min(slower, faster), "ok");
+    }
+
+    // Sizes are deterministic for a given workload, so no test is applied
+    void size(const char *name, double baseline, double current)
+    {
+        if (!(baseline > 0) && !(current > 0))
+            return;
+        const double delta = change(baseline, current);
+        const char *status = (delta > memoryThreshold) ? "regression" : ((delta < -memoryThreshold) ? "improvement" : "ok");
+        report(name, baseline, current, numeric_limits<double>::quiet_NaN(), status);
+    }
+
+    void errors(const char *name, int baseline, int current)
+    {
+        if ((baseline == 0) && (current == 0))
+            return;
+        report(name, baseline, current, numeric_limits<double>::quiet_NaN(), current > baseline ? "regression" : "ok");
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    int requiredArgs = 3;
+
+    if ((argc < requiredArgs) || (argc > 11)) {
+        printUsage();
+        return 1;
+    }
+
+    const char *ext1 = get_ext(argv[1]);
+    const char *ext2 = get_ext(argv[2]);
+    if (strcmp(ext1, "json") != 0 || strcmp(ext2, "json") != 0) {
+        printf("Metrics files must be \".json\" format.\n");
+        return 1;
+    }
+
+    Comparison comparison;
+    for (int i=0; i<argc-requiredArgs; i++)
+        if (strcmp(argv[requiredArgs+i],"-threshold") == 0)
+            comparison.threshold = atof(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-memory_threshold") == 0)
+            comparison.memoryThreshold = atof(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-alpha") == 0)
+            comparison.alpha = atof(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-min_count") == 0)
+            comparison.minCount = atoi(argv[requiredArgs+(++i)]);
+        else {
+            fprintf(stderr, "Unrecognized flag: %s\n", argv[requiredArgs+i]);
+            return 1;
+        }
+
+    janus_metrics baseline, current;
+    JANUS_ASSERT(janus_read_metrics(argv[1], &baseline))
+    JANUS_ASSERT(janus_read_metrics(argv[2], &current))
+
+    printf("%-32s\tBaseline\tCurrent\tChange\tp\tStatus\n", "Metric");
+    comparison.speed("janus_initialize_template (ms)", baseline.janus_initialize_template_speed, current.janus_initialize_template_speed);
+    comparison.speed("janus_augment (ms)", baseline.janus_augment_speed, current.janus_augment_speed);
+    comparison.speed("janus_finalize_template (ms)", baseline.janus_finalize_template_speed, current.janus_finalize_template_speed);
+    comparison.speed("janus_read_image (ms)", baseline.janus_read_image_speed, current.janus_read_image_speed);
+    comparison.speed("janus_read_frame (ms)", baseline.janus_read_frame_speed, current.janus_read_frame_speed);
+    comparison.speed("janus_free_image (ms)", baseline.janus_free_image_speed, current.janus_free_image_speed);
+    comparison.speed("janus_verify (ms)", baseline.janus_verify_speed, current.janus_verify_speed);
+    comparison.speed("janus_search (ms)", baseline.janus_search_speed, current.janus_search_speed);
+    comparison.speed("janus_gallery_size (ms)", baseline.janus_gallery_size_speed, current.janus_gallery_size_speed);
+    comparison.speed("janus_finalize_gallery (ms)", baseline.janus_finalize_gallery_speed, current.janus_finalize_gallery_speed);
+    comparison.speed("janus_compact_template (ms)", baseline.janus_compact_template_speed, current.janus_compact_template_speed);
+    comparison.speed("janus_cascade_screen (ms)", baseline.janus_cascade_screen_speed, current.janus_cascade_screen_speed);
+    comparison.speed("janus_cascade_rescore (ms)", baseline.janus_cascade_rescore_speed, current.janus_cascade_rescore_speed);
+    comparison.size("janus_flat_template (KB)", baseline.janus_template_size.mean, current.janus_template_size.mean);
+    comparison.size("compacted_template (KB)", baseline.janus_compacted_template_size.mean, current.janus_compacted_template_size.mean);
+    comparison.size("Images peak (MB)", baseline.janus_image_memory.peak_bytes / (1024.0 * 1024.0), current.janus_image_memory.peak_bytes / (1024.0 * 1024.0));
+    comparison.size("Flat templates peak (MB)", baseline.janus_flat_template_memory.peak_bytes / (1024.0 * 1024.0), current.janus_flat_template_memory.peak_bytes / (1024.0 * 1024.0));
+    comparison.size("Galleries peak (MB)", baseline.janus_gallery_memory.peak_bytes / (1024.0 * 1024.0), current.janus_gallery_memory.peak_bytes / (1024.0 * 1024.0));
+    comparison.size("Matrices peak (MB)", baseline.janus_matrix_memory.peak_bytes / (1024.0 * 1024.0), current.janus_matrix_memory.peak_bytes / (1024.0 * 1024.0));
+    comparison.size("Metadata peak (MB)", baseline.janus_metadata_memory.peak_bytes / (1024.0 * 1024.0), current.janus_metadata_memory.peak_bytes / (1024.0 * 1024.0));
+    comparison.size("Enrollment peak RSS (MB)", baseline.janus_enrollment_peak_rss / 1024.0, current.janus_enrollment_peak_rss / 1024.0);
+    comparison.size("Search peak RSS (MB)", baseline.janus_search_peak_rss / 1024.0, current.janus_search_peak_rss / 1024.0);
+    comparison.size("Verify peak RSS (MB)", baseline.janus_verify_peak_rss / 1024.0, current.janus_verify_peak_rss / 1024.0);
+    comparison.errors("JANUS_FAILURE_TO_ENROLL", baseline.janus_failure_to_enroll_count, current.janus_failure_to_enroll_count);
+    comparison.errors("All other errors", baseline.janus_other_errors_count, current.janus_other_errors_count);
+
+    if (comparison.regressions > 0) {
+        printf("\n%d regression(s)\n", comparison.regressions);
+        return 1;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,33 @@
+# Runs one stage of the performance workload and compares its metrics with the
+# stored baseline. The baseline is recorded instead when RECORD is set or when
+# there is no baseline yet, as on the first run in a build directory.
+#
+#   cmake -DUTILITY=<exe> -DARGUMENTS=<arg|arg|...> -DCOMPARE=<janus_perf_compare>
+#         -DBASELINE=<metrics.json> -DCURRENT=<metrics.json> [-DRECORD=ON]
+#         -P janus_perf_test.cmake
+
+string(REPLACE "|" ";" ARGUMENTS "${ARGUMENTS}")
+if(NOT RECORD AND NOT EXISTS ${BASELINE})
+  message(STATUS "No baseline, recording ${BASELINE}")
+  set(RECORD ON)
+endif()
+if(RECORD)
+  get_filename_component(BASELINE_DIR ${BASELINE} PATH)
+  file(MAKE_DIRECTORY ${BASELINE_DIR})
+  set(METRICS ${BASELINE})
+else()
+  set(METRICS ${CURRENT})
+endif()
+
+execute_process(COMMAND ${UTILITY} ${ARGUMENTS} -metrics ${METRICS}
+                RESULT_VARIABLE RESULT OUTPUT_QUIET)
+if(NOT RESULT EQUAL 0)
+  message(FATAL_ERROR "${UTILITY} failed: ${RESULT}")
+endif()
+
+if(NOT RECORD)
+  execute_process(COMMAND ${COMPARE} ${BASELINE} ${CURRENT} RESULT_VARIABLE RESULT)
+  if(NOT RESULT EQUAL 0)
+    message(FATAL_ERROR "Performance regressed against ${BASELINE}")
+  endif()
+endif()
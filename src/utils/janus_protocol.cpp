@@ -0,0 +1,357 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iarpa_janus.h"
+#include "iarpa_janus_io.h"
+using namespace std;
+
+const char *get_ext(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    if (!dot || dot == filename) return "";
+    return dot + 1;
+}
+
+void printUsage()
+{
+    printf("Usage: janus_protocol metadata_file output_dir [-folds <n>] [-gallery_probe] [-frame_interval <n>] [-seed <seed>] [-threads <n>]\n");
+}
+
+struct Output;
+
+// Writes chunks for a subset of the outputs in the order they were submitted
+struct Writer
+{
+    static const size_t max_pending = 8;
+
+    mutex lock;
+    condition_variable changed;
+    deque<pair<Output*, string> > chunks;
+    bool stopping;
+    thread worker;
+
+    Writer()
+        : stopping(false)
+    {
+        worker = thread(&Writer::run, this);
+    }
+
+    // Takes the contents of data, blocking while the writer is behind
+    void submit(Output *output, string &data)
+    {
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [this] { return chunks.size() < max_pending; });
+        chunks.push_back(make_pair(output, string()));
+        chunks.back().second.swap(data);
+        changed.notify_all();
+    }
+
+    void stop()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+            changed.notify_all();
+        }
+        worker.join();
+    }
+
+    void run();
+};
+
+struct Output
+{
+    static const size_t chunk_bytes = 1 << 20;
+
+    string fileName;
+    ofstream file;
+    string buffer;
+    Writer *writer;
+    size_t rows;
+
+    Output(const string &fileName, const char *header, Writer *writer)
+        : fileName(fileName), file(fileName.c_str(), ios::out | ios::binary | ios::trunc), writer(writer), rows(0)
+    {
+        buffer = header;
+        buffer += '\n';
+    }
+
+    void write(const char *line)
+    {
+        buffer += line;
+        buffer += '\n';
+        rows++;
+        if (buffer.size() >= chunk_bytes)
+            writer->submit(this, buffer);
+    }
+
+    void flush()
+    {
+        if (!buffer.empty())
+            writer->submit(this, buffer);
+    }
+};
+
+void Writer::run()
+{
+    unique_lock<mutex> guard(lock);
+    while (true) {
+        changed.wait(guard, [this] { return stopping || !chunks.empty(); });
+        if (chunks.empty())
+            return;
+
+        pair<Output*, string> chunk;
+        chunk.first = chunks.front().first;
+        chunk.second.swap(chunks.front().second);
+        chunks.pop_front();
+        changed.notify_all();
+
+        guard.unlock();
+        chunk.first->file.write(chunk.second.data(), chunk.second.size());
+        guard.lock();
+    }
+}
+
+// Partitions rows as they are parsed. Folds and gallery/probe partitions are
+// assigned by subject, frame sampling applies to every output.
+struct Protocol
+{
+    int folds;
+    bool galleryProbe;
+    int frameInterval;
+    uint64_t seed;
+
+    vector<Writer*> writers;
+    vector<Output*> outputs;
+    vector<Output*> foldOutputs;
+    Output *gallery, *probe, *sequester, *sampled;
+
+    // Subjects are dealt to folds in order of first appearance, each round of
+    // folds subjects in a freshly shuffled order, so folds differ in size by
+    // at most one subject
+    mt19937_64 foldGenerator;
+    map<int, int> subjectFolds;
+    vector<int> foldOrder;
+
+    // Rows of the current subject, grouped by template in order of appearance
+    bool haveSubject;
+    int subject;
+    vector<janus_template_id> subjectTemplates;
+    vector<pair<janus_template_id, string> > subjectRows;
+    set<int> finishedSubjects;
+
+    Protocol()
+        : folds(0), galleryProbe(false), frameInterval(0), seed(0),
+          gallery(NULL), probe(NULL), sequester(NULL), sampled(NULL), haveSubject(false), subject(0) {}
+
+    Output *open(const string &directory, const string &name, const char *header)
+    {
+        Output *output = new Output(directory + "/" + name, header, writers[outputs.size() % writers.size()]);
+        outputs.push_back(output);
+        return output;
+    }
+
+    // Outputs are created with the header of the first row
+    void open(const string &directory, const char *header, int threads)
+    {
+        const int num_outputs = folds + (galleryProbe ? 3 : 0) + (frameInterval > 1 ? 1 : 0);
+        const int num_writers = max(1, min(threads, num_outputs));
+        for (int i=0; i<num_writers; i++)
+            writers.push_back(new Writer());
+
+        for (int i=0; i<folds; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "fold%d.csv", i);
+            foldOutputs.push_back(open(directory, name, header));
+        }
+        if (galleryProbe) {
+            gallery = open(directory, "gallery.csv", header);
+            probe = open(directory, "probe.csv", header);
+            sequester = open(directory, "sequester.csv", header);
+        }
+        if (frameInterval > 1)
+            sampled = open(directory, "sampled.csv", header);
+        foldGenerator.seed(seed);
+    }
+
+    janus_error close()
+    {
+        janus_error result = finishSubject();
+        for (size_t i=0; i<outputs.size(); i++)
+            outputs[i]->flush();
+        for (size_t i=0; i<writers.size(); i++) {
+            writers[i]->stop();
+            delete writers[i];
+        }
+        writers.clear();
+
+        for (size_t i=0; i<outputs.size(); i++) {
+            outputs[i]->file.close();
+            if (!outputs[i]->file && (result == JANUS_SUCCESS)) {
+                fprintf(stderr, "Failed to write: %s\n", outputs[i]->fileName.c_str());
+                result = JANUS_WRITE_ERROR;
+            }
+        }
+        return result;
+    }
+
+    static int frameNumber(const janus_attribute_list &attributes)
+    {
+        for (size_t i=0; i<attributes.size; i++)
+            if (attributes.attributes[i] == JANUS_FRAME)
+                return int(attributes.values[i]);
+        return -1;
+    }
+
+    int fold(int subjectID)
+    {
+        map<int, int>::const_iterator it = subjectFolds.find(subjectID);
+        if (it != subjectFolds.end())
+            return it->second;
+
+        // Fisher-Yates with the raw generator output, which unlike the
+        // standard distributions is identical across library implementations
+        const size_t position = subjectFolds.size() % folds;
+        if (position == 0) {
+            foldOrder.resize(folds);
+            for (int i=0; i<folds; i++)
+                foldOrder[i] = i;
+            for (int i=folds-1; i>0; i--)
+                swap(foldOrder[i], foldOrder[foldGenerator() % (i + 1)]);
+        }
+        return subjectFolds[subjectID] = foldOrder[position];
+    }
+
+    // One template of each subject is chosen for the gallery and the rest are
+    // probes, subjects with a single template are sequestered
+    janus_error finishSubject()
+    {
+        if (!haveSubject)
+            return JANUS_SUCCESS;
+        finishedSubjects.insert(subject);
+
+        // Seeded per subject so the choice does not depend on row order
+        seed_seq sequence = { uint32_t(seed), uint32_t(seed >> 32), uint32_t(subject) };
+        mt19937_64 generator(sequence);
+        const janus_template_id galleryTemplate = subjectTemplates[generator() % subjectTemplates.size()];
+
+        for (size_t i=0; i<subjectRows.size(); i++) {
+            Output *output = (subjectTemplates.size() == 1) ? sequester : (subjectRows[i].first == galleryTemplate ? gallery : probe);
+            output->write(subjectRows[i].second.c_str());
+        }
+        subjectTemplates.clear();
+        subjectRows.clear();
+        haveSubject = false;
+        return JANUS_SUCCESS;
+    }
+
+    janus_error add(const janus_metadata_row &row)
+    {
+        const int frame = frameNumber(row.attributes);
+        if ((frameInterval > 1) && (frame > 0) && (frame % frameInterval != 0))
+            return JANUS_SUCCESS;
+        if (sampled)
+            sampled->write(row.line);
+
+        if (folds > 0)
+            foldOutputs[fold(row.subject_id)]->write(row.line);
+
+        if (galleryProbe) {
+            if (!haveSubject || (row.subject_id != subject)) {
+                JANUS_CHECK(finishSubject())
+                if (finishedSubjects.find(row.subject_id) != finishedSubjects.end()) {
+                    fprintf(stderr, "Rows of SUBJECT_ID %d are not sequential, required by -gallery_probe.\n", row.subject_id);
+                    return JANUS_PARSE_ERROR;
+                }
+                haveSubject = true;
+                subject = row.subject_id;
+            }
+            if (find(subjectTemplates.begin(), subjectTemplates.end(), row.template_id) == subjectTemplates.end())
+                subjectTemplates.push_back(row.template_id);
+            subjectRows.push_back(make_pair(row.template_id, string(row.line)));
+        }
+        return JANUS_SUCCESS;
+    }
+};
+
+struct Context
+{
+    Protocol *protocol;
+    const char *directory;
+    int threads;
+};
+
+static janus_error addRow(const janus_metadata_row *row, void *user_data)
+{
+    Context *context = (Context*)user_data;
+    if (context->protocol->writers.empty())
+        context->protocol->open(context->directory, row->header, context->threads);
+    return context->protocol->add(*row);
+}
+
+int main(int argc, char *argv[])
+{
+    int requiredArgs = 3;
+
+    if ((argc < requiredArgs) || (argc > 12)) {
+        printUsage();
+        return 1;
+    }
+
+    if (strcmp(get_ext(argv[1]), "csv") != 0) {
+        printf("metadata_file must be \".csv\" format.\n");
+        return 1;
+    }
+
+    Protocol protocol;
+    int threads = int(thread::hardware_concurrency());
+    for (int i=0; i<argc-requiredArgs; i++)
+        if (strcmp(argv[requiredArgs+i],"-folds") == 0)
+            protocol.folds = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-gallery_probe") == 0)
+            protocol.galleryProbe = true;
+        else if (strcmp(argv[requiredArgs+i],"-frame_interval") == 0)
+            protocol.frameInterval = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-seed") == 0)
+            protocol.seed = strtoull(argv[requiredArgs+(++i)], NULL, 10);
+        else if (strcmp(argv[requiredArgs+i],"-threads") == 0)
+            threads = atoi(argv[requiredArgs+(++i)]);
+        else {
+            fprintf(stderr, "Unrecognized flag: %s\n", argv[requiredArgs+i]);
+            return 1;
+        }
+
+    if ((protocol.folds <= 0) && !protocol.galleryProbe && (protocol.frameInterval <= 1)) {
+        printf("At least one of -folds, -gallery_probe or -frame_interval is required.\n");
+        return 1;
+    }
+
+    Context context;
+    context.protocol = &protocol;
+    context.directory = argv[2];
+    context.threads = threads;
+    const janus_error parse_error = janus_parse_metadata(argv[1], addRow, &context);
+    JANUS_ASSERT(protocol.close())
+    JANUS_ASSERT(parse_error)
+
+    printf("Output                  \tRows\n");
+    for (size_t i=0; i<protocol.outputs.size(); i++) {
+        const string &fileName = protocol.outputs[i]->fileName;
+        printf("%-24s\t%zu\n", fileName.substr(fileName.find_last_of('/') + 1).c_str(), protocol.outputs[i]->rows);
+        delete protocol.outputs[i];
+    }
+    if (protocol.folds > 0)
+        printf("Subjects                \t%zu\n", protocol.subjectFolds.size());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,544 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iarpa_janus.h"
+#include "iarpa_janus_io.h"
+#include "iarpa_janus.hpp"
+using namespace std;
+
+const char *get_ext(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    if (!dot || dot == filename) return "";
+    return dot + 1;
+}
+
+void printUsage()
+{
+    printf("Usage: janus_server sdk_path temp_path socket_path [-gallery <flat_gallery.gal>] [-algorithm <algorithm>] [-threads <n>] [-max_batch <n>] [-window_ms <ms>] [-max_returns <n>] [-metrics <metrics.json>]\n");
+}
+
+// Wire protocol, in native byte order over a SOCK_STREAM Unix domain socket.
+// Each request is a RequestHeader followed by RequestHeader::bytes of payload
+// and is answered by a ResponseHeader followed by ResponseHeader::bytes of
+// payload. A connection may send any number of requests, one at a time.
+//
+//   AUGMENT request:  uint32_t num_attributes,
+//                     num_attributes x (int32_t janus_attribute, double value),
+//                     image file name
+//           response: flat template
+//   VERIFY  request:  uint64_t a_bytes, flat template a, flat template b
+//           response: float similarity
+//   SEARCH  request:  int32_t num_requested_returns, flat template probe
+//           response: num_actual_returns x (janus_template_id, float similarity)
+//                     num_requested_returns is limited to -max_returns
+//   STATS   request:  empty
+//           response: server statistics as printed on shutdown
+//
+// AUGMENT, VERIFY and SEARCH requests from all connections are queued and
+// submitted in batches to the asynchronous API worker pool. A batch is
+// dispatched once it reaches -max_batch requests or its oldest request has
+// waited -window_ms, and each request completes independently. Requests are
+// submitted individually since janus_search takes a single probe.
+enum RequestType
+{
+    AUGMENT = 1,
+    VERIFY  = 2,
+    SEARCH  = 3,
+    STATS   = 4
+};
+
+struct RequestHeader
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t bytes;
+};
+
+struct ResponseHeader
+{
+    int32_t error;
+    uint32_t reserved;
+    uint64_t bytes;
+};
+
+// Requests larger than this are rejected and the connection closed
+static const uint64_t max_request_bytes = uint64_t(1) << 30;
+
+static double elapsedMilliseconds(chrono::steady_clock::time_point start, chrono::steady_clock::time_point stop)
+{
+    return chrono::duration<double, milli>(stop - start).count();
+}
+
+struct Statistic
+{
+    size_t count;
+    double sum, sumOfSquares, maximum;
+
+    Statistic()
+        : count(0), sum(0), sumOfSquares(0), maximum(0) {}
+
+    void add(double sample)
+    {
+        count++;
+        sum += sample;
+        sumOfSquares += sample * sample;
+        maximum = max(maximum, sample);
+    }
+
+    string print(const char *name) const
+    {
+        if (count == 0)
+            return "";
+        const double mean = sum / count;
+        const double stddev = sqrt(max(sumOfSquares / count - mean * mean, 0.0));
+        char line[256];
+        snprintf(line, sizeof(line), "%s\t%.2g\t%.2g\t%.2g\t%zu\n", name, mean, stddev, maximum, count);
+        return line;
+    }
+};
+
+struct Server;
+
+struct Request
+{
+    RequestType type;
+    vector<char> payload;
+    janus::Image image; // AUGMENT, decoded by the connection
+    janus::AttributeList attributes;
+    chrono::steady_clock::time_point received;
+
+    // Outputs of the pending operation, owned by the request until it is done
+    Server *server;
+    janus_future future;
+    janus::Template template_;
+    float similarity;
+    vector<janus_template_id> templateIDs;
+    vector<float> scores;
+    int returns;
+
+    janus_error error;
+    vector<char> response;
+    int pending; // Dispatcher and completion callback yet to release the request
+    bool done;
+
+    Request()
+        : type(STATS), server(NULL), future(NULL), similarity(0), returns(0), error(JANUS_SUCCESS), pending(0), done(false) {}
+
+    ~Request()
+    {
+        if (future)
+            janus_free_future(future);
+    }
+};
+
+struct Server
+{
+    janus::Buffer gallery;
+    size_t maxBatch;
+    chrono::microseconds window;
+    int maxReturns;
+
+    mutex lock; // Guards everything below
+    condition_variable available, completed, disconnected;
+    deque<Request*> queue;
+    bool stopping;
+    set<int> connections; // Served by detached threads
+    Statistic queueDepth, batchSize, queueWait, latency;
+    size_t requests[STATS + 1];
+
+    Server()
+        : maxBatch(32), window(2000), maxReturns(1000), stopping(false)
+    {
+        fill(requests, requests + STATS + 1, size_t(0));
+    }
+
+    string statistics()
+    {
+        lock_guard<mutex> guard(lock);
+        string result = "Server                  \tMean\tStdDev\tMax\tCount\n";
+        result += queueDepth.print("Queue depth             ");
+        result += batchSize.print("Batch size              ");
+        result += queueWait.print("Queue wait (ms)         ");
+        result += latency.print("Latency (ms)            ");
+        char line[256];
+        snprintf(line, sizeof(line), "\nRequest                 \tCount\nAUGMENT                 \t%zu\nVERIFY                  \t%zu\nSEARCH                  \t%zu\nSTATS                   \t%zu\n",
+                 requests[AUGMENT], requests[VERIFY], requests[SEARCH], requests[STATS]);
+        return result + line;
+    }
+
+    // Blocks until the request has been executed by the dispatcher, requests
+    // arriving after stop() are refused since the dispatcher may have exited
+    janus_error execute(Request &request)
+    {
+        unique_lock<mutex> guard(lock);
+        if (stopping)
+            return JANUS_UNKNOWN_ERROR;
+        queue.push_back(&request);
+        queueDepth.add(queue.size());
+        available.notify_all();
+        completed.wait(guard, [&request] { return request.done; });
+        return request.error;
+    }
+
+    // Returns false once stopping with an empty queue
+    bool nextBatch(vector<Request*> &batch)
+    {
+        unique_lock<mutex> guard(lock);
+        available.wait(guard, [this] { return stopping || !queue.empty(); });
+        if (queue.empty())
+            return false;
+
+        const chrono::steady_clock::time_point deadline = queue.front()->received + window;
+        available.wait_until(guard, deadline, [this] { return stopping || (queue.size() >= maxBatch); });
+
+        const chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        batch.clear();
+        while (!queue.empty() && (batch.size() < maxBatch)) {
+            queueWait.add(elapsedMilliseconds(queue.front()->received, now));
+            batch.push_back(queue.front());
+            queue.pop_front();
+        }
+        batchSize.add(batch.size());
+        return true;
+    }
+
+    // Submits each batch to the worker pool without waiting for it, so the
+    // next batch is formed while earlier ones are still running
+    void dispatch()
+    {
+        vector<Request*> batch;
+        while (nextBatch(batch))
+            for (size_t i=0; i<batch.size(); i++) {
+                // The callback may run before submit() has stored the future,
+                // so the request is done once both have released it
+                Request &request = *batch[i];
+                request.server = this;
+                request.pending = 2;
+                const janus_error submit_error = submit(request);
+                if (submit_error != JANUS_SUCCESS) {
+                    request.error = submit_error;
+                    request.pending = 1;
+                }
+                release(request);
+            }
+    }
+
+    janus_error submit(Request &request)
+    {
+        const char *payload = request.payload.empty() ? NULL : &request.payload[0];
+        if (request.type == AUGMENT) {
+            JANUS_CHECK(janus_allocate_template(request.template_.put()))
+            return janus_augment_async(request.image.get(), request.attributes.view(), request.template_.get(), completed_callback, &request, &request.future);
+        } else if (request.type == VERIFY) {
+            uint64_t a_bytes;
+            memcpy(&a_bytes, payload, sizeof(a_bytes));
+            const janus_flat_template a = (janus_flat_template)(payload + sizeof(a_bytes));
+            const janus_flat_template b = a + a_bytes;
+            return janus_verify_async(a, a_bytes, b, request.payload.size() - sizeof(a_bytes) - a_bytes, &request.similarity, completed_callback, &request, &request.future);
+        } else if (request.type == SEARCH) {
+            int32_t requested;
+            memcpy(&requested, payload, sizeof(requested));
+            request.templateIDs.resize(max(requested, 1));
+            request.scores.resize(max(requested, 1));
+            return janus_search_async((janus_flat_template)(payload + sizeof(requested)), request.payload.size() - sizeof(requested),
+                                      gallery.data(), gallery.size(), requested,
+                                      &request.templateIDs[0], &request.scores[0], &request.returns, completed_callback, &request, &request.future);
+        }
+        return JANUS_SUCCESS;
+    }
+
+    // Builds the response on the worker that completed the operation, which
+    // keeps flattening AUGMENT results off the dispatcher
+    static void completed_callback(janus_error error, void *user_data)
+    {
+        Request &request = *(Request*)user_data;
+        request.error = error;
+        if (request.error == JANUS_SUCCESS) {
+            if (request.type == AUGMENT) {
+                janus::FlatTemplate flat;
+                request.error = flat.flatten(request.template_.get());
+                if (request.error == JANUS_SUCCESS)
+                    request.response.assign((const char*)flat.data(), (const char*)flat.data() + flat.size());
+            } else if (request.type == VERIFY) {
+                request.response.assign((const char*)&request.similarity, (const char*)&request.similarity + sizeof(float));
+            } else if (request.type == SEARCH) {
+                const int count = min(request.returns, int(request.templateIDs.size()));
+                for (int j=0; j<count; j++) {
+                    request.response.insert(request.response.end(), (const char*)&request.templateIDs[j], (const char*)&request.templateIDs[j] + sizeof(janus_template_id));
+                    request.response.insert(request.response.end(), (const char*)&request.scores[j], (const char*)&request.scores[j] + sizeof(float));
+                }
+            }
+        }
+        request.server->release(request);
+    }
+
+    void release(Request &request)
+    {
+        lock_guard<mutex> guard(lock);
+        if (--request.pending > 0)
+            return;
+        latency.add(elapsedMilliseconds(request.received, chrono::steady_clock::now()));
+        request.done = true;
+        completed.notify_all();
+    }
+
+    void stop()
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+        available.notify_all();
+        for (set<int>::const_iterator it = connections.begin(); it != connections.end(); ++it)
+            shutdown(*it, SHUT_RDWR);
+    }
+
+    // Blocks until every connection thread has finished with the server
+    void waitForConnections()
+    {
+        unique_lock<mutex> guard(lock);
+        disconnected.wait(guard, [this] { return connections.empty(); });
+    }
+};
+
+static bool readAll(int fd, void *data, size_t bytes)
+{
+    char *buffer = (char*)data;
+    while (bytes > 0) {
+        const ssize_t n = read(fd, buffer, bytes);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            return false;
+        buffer += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void *data, size_t bytes)
+{
+    const char *buffer = (const char*)data;
+    while (bytes > 0) {
+        const ssize_t n = send(fd, buffer, bytes, MSG_NOSIGNAL);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            return false;
+        buffer += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+// Validates the payload and decodes AUGMENT images outside of the dispatcher
+static janus_error prepare(Request &request, const Server &server)
+{
+    const size_t bytes = request.payload.size();
+    const char *payload = bytes ? &request.payload[0] : NULL;
+    if (request.type == AUGMENT) {
+        uint32_t num_attributes;
+        if (bytes < sizeof(num_attributes))
+            return JANUS_PARSE_ERROR;
+        memcpy(&num_attributes, payload, sizeof(num_attributes));
+        const size_t attribute_bytes = sizeof(int32_t) + sizeof(double);
+        if (num_attributes > (bytes - sizeof(num_attributes)) / attribute_bytes)
+            return JANUS_PARSE_ERROR;
+        size_t offset = sizeof(num_attributes);
+        for (uint32_t i=0; i<num_attributes; i++, offset += attribute_bytes) {
+            int32_t attribute;
+            double value;
+            memcpy(&attribute, payload + offset, sizeof(attribute));
+            memcpy(&value, payload + offset + sizeof(attribute), sizeof(value));
+            request.attributes.push_back(janus_attribute(attribute), value);
+        }
+        const string fileName(payload + offset, payload + bytes);
+        if (fileName.empty())
+            return JANUS_MISSING_FILE_NAME;
+        return janus_read_image(fileName.c_str(), request.image.put());
+    } else if (request.type == VERIFY) {
+        uint64_t a_bytes;
+        if (bytes < sizeof(a_bytes))
+            return JANUS_PARSE_ERROR;
+        memcpy(&a_bytes, payload, sizeof(a_bytes));
+        return (a_bytes <= bytes - sizeof(a_bytes)) ? JANUS_SUCCESS : JANUS_PARSE_ERROR;
+    } else if (request.type == SEARCH) {
+        int32_t requested;
+        if (bytes < sizeof(requested))
+            return JANUS_PARSE_ERROR;
+        memcpy(&requested, payload, sizeof(requested));
+        if (server.gallery.empty())
+            return JANUS_MISSING_TEMPLATE_ID;
+        if (requested <= 0)
+            return JANUS_PARSE_ERROR;
+
+        // Fewer results is a valid response, so large requests are clamped
+        // rather than allocating their results
+        requested = min(requested, int32_t(server.maxReturns));
+        memcpy(&request.payload[0], &requested, sizeof(requested));
+    }
+    return JANUS_SUCCESS;
+}
+
+static void serve(Server *server, int fd)
+{
+    RequestHeader header;
+    while (readAll(fd, &header, sizeof(header))) {
+        if ((header.type < AUGMENT) || (header.type > STATS) || (header.bytes > max_request_bytes))
+            break;
+
+        Request request;
+        request.type = RequestType(header.type);
+        request.payload.resize(header.bytes);
+        if ((header.bytes > 0) && !readAll(fd, &request.payload[0], header.bytes))
+            break;
+        request.received = chrono::steady_clock::now();
+        {
+            lock_guard<mutex> guard(server->lock);
+            server->requests[request.type]++;
+        }
+
+        if (request.type == STATS) {
+            const string statistics = server->statistics();
+            request.response.assign(statistics.begin(), statistics.end());
+        } else {
+            request.error = prepare(request, *server);
+            if (request.error == JANUS_SUCCESS)
+                request.error = server->execute(request);
+        }
+
+        ResponseHeader response;
+        response.error = request.error;
+        response.reserved = 0;
+        response.bytes = (request.error == JANUS_SUCCESS) ? request.response.size() : 0;
+        if (!writeAll(fd, &response, sizeof(response)) ||
+            ((response.bytes > 0) && !writeAll(fd, &request.response[0], response.bytes)))
+            break;
+    }
+
+    {
+        lock_guard<mutex> guard(server->lock);
+        server->connections.erase(fd);
+        server->disconnected.notify_all();
+    }
+    close(fd);
+}
+
+static volatile sig_atomic_t stopRequested = 0;
+static int listener = -1;
+
+static void requestStop(int)
+{
+    stopRequested = 1;
+    shutdown(listener, SHUT_RDWR);
+}
+
+int main(int argc, char *argv[])
+{
+    int requiredArgs = 4;
+
+    if ((argc < requiredArgs) || (argc > 18)) {
+        printUsage();
+        return 1;
+    }
+
+    Server server;
+    char *algorithm = NULL;
+    const char *metrics_file = NULL;
+    const char *gallery_file = NULL;
+    int threads = 0;
+    for (int i=0; i<argc-requiredArgs; i++)
+        if (strcmp(argv[requiredArgs+i],"-gallery") == 0)
+            gallery_file = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-algorithm") == 0)
+            algorithm = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-threads") == 0)
+            threads = atoi(argv[requiredArgs+(++i)]);
+        else if (strcmp(argv[requiredArgs+i],"-max_batch") == 0)
+            server.maxBatch = max(atoi(argv[requiredArgs+(++i)]), 1);
+        else if (strcmp(argv[requiredArgs+i],"-window_ms") == 0)
+            server.window = chrono::microseconds(int64_t(1000 * atof(argv[requiredArgs+(++i)])));
+        else if (strcmp(argv[requiredArgs+i],"-max_returns") == 0)
+            server.maxReturns = max(atoi(argv[requiredArgs+(++i)]), 1);
+        else if (strcmp(argv[requiredArgs+i],"-metrics") == 0)
+            metrics_file = argv[requiredArgs+(++i)];
+        else {
+            fprintf(stderr, "Unrecognized flag: %s\n", argv[requiredArgs+i]);
+            return 1;
+        }
+
+    if (gallery_file && (strcmp(get_ext(gallery_file), "gal") != 0)) {
+        printf("Gallery files must be \".gal\" format.\n");
+        return 1;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(argv[3]) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", argv[3]);
+        return 1;
+    }
+    strcpy(address.sun_path, argv[3]);
+
+    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm, 0))
+    JANUS_ASSERT(janus_initialize_async(threads))
+    if (gallery_file)
+        JANUS_ASSERT(server.gallery.read(gallery_file))
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(argv[3]);
+    if ((listener < 0) || (bind(listener, (sockaddr*)&address, sizeof(address)) != 0) || (listen(listener, SOMAXCONN) != 0)) {
+        perror("janus_server");
+        return 1;
+    }
+
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    fprintf(stderr, "Listening on %s\n", argv[3]);
+
+    thread dispatcher(&Server::dispatch, &server);
+    while (!stopRequested) {
+        const int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        lock_guard<mutex> guard(server.lock);
+        server.connections.insert(fd);
+        thread(serve, &server, fd).detach();
+    }
+
+    // Pending requests complete before their connections are closed
+    server.stop();
+    server.waitForConnections();
+    dispatcher.join();
+    close(listener);
+    unlink(argv[3]);
+
+    JANUS_ASSERT(janus_finalize_async())
+    printf("%s\n\n", server.statistics().c_str());
+    server.gallery = janus::Buffer();
+    JANUS_ASSERT(janus_finalize())
+
+    const janus_metrics metrics = janus_get_metrics();
+    janus_print_metrics(metrics);
+    if (metrics_file)
+        JANUS_ASSERT(janus_write_metrics(metrics, metrics_file))
+    return EXIT_SUCCESS;
+}
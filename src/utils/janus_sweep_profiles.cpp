@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "iarpa_janus.h"
+#include "iarpa_janus_io.h"
+using namespace std;
+
+const char *get_ext(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    if (!dot || dot == filename) return "";
+    return dot + 1;
+}
+
+void printUsage()
+{
+    printf("Usage: janus_sweep_profiles sdk_path temp_path data_path target_metadata query_metadata algorithm [algorithm ...] [-verbose]\n");
+}
+
+// Read a matrix written by janus_write_matrix in any encoding
+template <typename T>
+static vector<T> readMatrix(const string &file_name)
+{
+    void *data;
+    int rows, columns, is_mask;
+    JANUS_ASSERT(janus_read_matrix(file_name.c_str(), &data, &rows, &columns, &is_mask))
+    vector<T> matrix((const T*)data, (const T*)data + size_t(rows) * columns);
+    JANUS_ASSERT(janus_free_matrix(data))
+    return matrix;
+}
+
+// True accept rate at the score threshold admitting the given false accept rate
+static double trueAcceptRate(const vector<float> &genuine, vector<float> impostor, double false_accept_rate)
+{
+    if (genuine.empty() || impostor.empty())
+        return std::numeric_limits<double>::quiet_NaN();
+
+    sort(impostor.begin(), impostor.end(), greater<float>());
+    const float threshold = impostor[min(impostor.size() - 1, size_t(false_accept_rate * impostor.size()))];
+    size_t accepted = 0;
+    for (size_t i=0; i<genuine.size(); i++)
+        if (genuine[i] > threshold)
+            accepted++;
+    return double(accepted) / genuine.size();
+}
+
+static double elapsedMilliseconds(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    int requiredArgs = 7;
+
+    if (argc < requiredArgs) {
+        printUsage();
+        return 1;
+    }
+
+    const char *ext1 = get_ext(argv[4]);
+    const char *ext2 = get_ext(argv[5]);
+    if (strcmp(ext1, "csv") != 0 || strcmp(ext2, "csv") != 0) {
+        printf("Metadata files must be \".csv\" format.\n");
+        return 1;
+    }
+
+    vector<const char*> algorithms;
+    int verbose = 0;
+    for (int i=requiredArgs-1; i<argc; i++)
+        if (strcmp(argv[i], "-verbose") == 0)
+            verbose = 1;
+        else
+            algorithms.push_back(argv[i]);
+
+    const string temp_path = argv[2];
+    const string target_templates = temp_path + "/janus_sweep_target.gal";
+    const string query_templates = temp_path + "/janus_sweep_query.gal";
+    const string simmat = temp_path + "/janus_sweep.mtx";
+    const string mask = temp_path + "/janus_sweep.mask";
+
+    printf("Algorithm\tTemplates\tEnroll (ms)\tComparisons\tVerify (ms)\tFTE\tTAR@FAR=1e-2\tTAR@FAR=1e-3\n");
+    for (size_t i=0; i<algorithms.size(); i++) {
+        JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithms[i], 0))
+        janus_get_metrics(); // Reset
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        JANUS_ASSERT(janus_create_templates(argv[3], argv[4], target_templates.c_str(), verbose))
+        JANUS_ASSERT(janus_create_templates(argv[3], argv[5], query_templates.c_str(), verbose))
+        const double enroll_time = elapsedMilliseconds(start);
+        const janus_metrics enroll_metrics = janus_get_metrics();
+
+        start = chrono::steady_clock::now();
+        JANUS_ASSERT(janus_evaluate_verify(target_templates.c_str(), query_templates.c_str(), argv[4], argv[5], simmat.c_str(), mask.c_str()))
+        const double verify_time = elapsedMilliseconds(start);
+        const janus_metrics verify_metrics = janus_get_metrics();
+
+        JANUS_ASSERT(janus_finalize())
+
+        const vector<float> scores = readMatrix<float>(simmat);
+        const vector<unsigned char> truth = readMatrix<unsigned char>(mask);
+        vector<float> genuine, impostor;
+        for (size_t j=0; j<min(scores.size(), truth.size()); j++)
+            if      (truth[j] == 0xff) genuine.push_back(scores[j]);
+            else if (truth[j] == 0x7f) impostor.push_back(scores[j]);
+
+        const size_t templates = enroll_metrics.janus_initialize_template_speed.count;
+        const size_t comparisons = verify_metrics.janus_verify_speed.count;
+        printf("%s\t%zu\t%.3g\t%zu\t%.3g\t%d\t%.4f\t%.4f\n", algorithms[i], templates,
+               templates ? enroll_time / templates : 0.0, comparisons,
+               comparisons ? verify_time / comparisons : 0.0,
+               enroll_metrics.janus_failure_to_enroll_count,
+               trueAcceptRate(genuine, impostor, 1e-2), trueAcceptRate(genuine, impostor, 1e-3));
+        fflush(stdout);
+    }
+
+    remove(target_templates.c_str());
+    remove(query_templates.c_str());
+    remove((target_templates + ".checkpoint").c_str());
+    remove((query_templates + ".checkpoint").c_str());
+    remove(simmat.c_str());
+    remove(mask.c_str());
+    return EXIT_SUCCESS;
+}
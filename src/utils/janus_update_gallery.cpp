@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "iarpa_janus.h"
+#include "iarpa_janus_io.h"
+
+const char *get_ext(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    if (!dot || dot == filename) return "";
+    return dot + 1;
+}
+
+void printUsage()
+{
+    printf("Usage: janus_update_gallery sdk_path temp_path gallery_index [-append <data_path> <metadata_file>] [-remove <metadata_file>] [-compact] [-algorithm <algorithm>] [-verbose] [-metrics <metrics.json>]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int requiredArgs = 4;
+
+    if ((argc < requiredArgs) || (argc > 14)) {
+        printUsage();
+        return 1;
+    }
+
+    if (strcmp(get_ext(argv[3]), "idx") != 0) {
+        printf("gallery_index must be \".idx\" format.\n");
+        return 1;
+    }
+
+    char *algorithm = NULL;
+    const char *metrics_file = NULL;
+    const char *data_path = NULL;
+    const char *append_metadata = NULL;
+    const char *remove_metadata = NULL;
+    int compact = 0;
+    int verbose = 0;
+
+    for (int i=0; i<argc-requiredArgs; i++)
+        if ((strcmp(argv[requiredArgs+i],"-append") == 0) && (i+2 < argc-requiredArgs)) {
+            data_path = argv[requiredArgs+(++i)];
+            append_metadata = argv[requiredArgs+(++i)];
+        } else if (strcmp(argv[requiredArgs+i],"-remove") == 0)
+            remove_metadata = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-compact") == 0)
+            compact = 1;
+        else if (strcmp(argv[requiredArgs+i],"-algorithm") == 0)
+            algorithm = argv[requiredArgs+(++i)];
+        else if (strcmp(argv[requiredArgs+i],"-verbose") == 0)
+            verbose = 1;
+        else if (strcmp(argv[requiredArgs+i],"-metrics") == 0)
+            metrics_file = argv[requiredArgs+(++i)];
+        else {
+            fprintf(stderr, "Unrecognized flag: %s\n", argv[requiredArgs+i]);
+            return 1;
+        }
+
+    if (!append_metadata && !remove_metadata && !compact) {
+        printUsage();
+        return 1;
+    }
+
+    // Removals are applied first so a template may be removed and re-enrolled in one call
+    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm, 0))
+    if (remove_metadata)
+        JANUS_ASSERT(janus_remove_from_gallery(remove_metadata, argv[3]))
+    if (append_metadata)
+        JANUS_ASSERT(janus_append_gallery(data_path, append_metadata, argv[3], verbose))
+    if (compact)
+        JANUS_ASSERT(janus_compact_gallery(argv[3]))
+    JANUS_ASSERT(janus_finalize())
+
+    const janus_metrics metrics = janus_get_metrics();
+    janus_print_metrics(metrics);
+    if (metrics_file)
+        JANUS_ASSERT(janus_write_metrics(metrics, metrics_file))
+    return EXIT_SUCCESS;
+}
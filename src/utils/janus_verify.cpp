@@ -3,6 +3,7 @@
 
 #include "iarpa_janus.h"
 #include "iarpa_janus_io.h"
+#include "iarpa_janus.hpp"
 
 const char *get_ext(const char *filename) {
     const char *dot = strrchr(filename, '.');
@@ -15,14 +16,13 @@ void printUsage()
     printf("Usage: janus_verify sdk_path temp_path data_path target_metadata_file query_metadata_file [-algorithm <algorithm>]\n");
 }
 
-static janus_flat_template getFlatTemplate(const char *data_path, janus_metadata metadata, size_t *bytes)
+static janus::FlatTemplate getFlatTemplate(const char *data_path, janus_metadata metadata)
 {
-    janus_template template_;
+    janus::Template template_;
     janus_template_id template_id;
-    JANUS_ASSERT(janus_create_template(data_path, metadata, &template_, &template_id))
-    janus_flat_template flat_template = new janus_data[janus_max_template_size()];
-    JANUS_ASSERT(janus_flatten_template(template_, flat_template, bytes))
-    JANUS_ASSERT(janus_free_template(template_))
+    JANUS_ASSERT(janus_create_template(data_path, metadata, template_.put(), &template_id))
+    janus::FlatTemplate flat_template;
+    JANUS_ASSERT(flat_template.flatten(template_.get()))
     return flat_template;
 }
 
@@ -52,23 +52,18 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm))
+    JANUS_ASSERT(janus_initialize(argv[1], argv[2], algorithm, 0))
 
-    size_t target_bytes;
-    janus_flat_template target_flat = getFlatTemplate(argv[3], argv[4], &target_bytes);
-    printf("Target bytes: %zu\n", target_bytes);
+    const janus::FlatTemplate target_flat = getFlatTemplate(argv[3], argv[4]);
+    printf("Target bytes: %zu\n", target_flat.size());
 
-    size_t query_bytes;
-    janus_flat_template query_flat = getFlatTemplate(argv[3], argv[5], &query_bytes);
-    printf("Query bytes: %zu\n", query_bytes);
+    const janus::FlatTemplate query_flat = getFlatTemplate(argv[3], argv[5]);
+    printf("Query bytes: %zu\n", query_flat.size());
 
     float similarity;
-    JANUS_ASSERT(janus_verify(target_flat, target_bytes, query_flat, query_bytes, &similarity))
+    JANUS_ASSERT(janus_verify(target_flat.data(), target_flat.size(), query_flat.data(), query_flat.size(), &similarity))
     printf("Similarity: %g\n", similarity);
 
-    delete[] target_flat;
-    delete[] query_flat;
-
     JANUS_ASSERT(janus_finalize())
     return EXIT_SUCCESS;
 }